@@ -33,6 +33,7 @@
 #include "alignment_tables.hpp" // for DIFFERENT_NTS, IDENTICAL_NTS, PHRED_...
 #include "debug.hpp"            // for AR_DEBUG_ASSERT
 #include "fastq.hpp"            // for fastq, fastq_pair_vec
+#include "read_batch.hpp"       // for read_batch
 
 #if defined(__AVX2__)
 #include <immintrin.h>
@@ -171,28 +172,30 @@ compare_subsequences(const alignment_info& best,
 
 alignment_info
 sequence_aligner::pairwise_align_sequences(const alignment_info& best_alignment,
-                                           const std::string& seq1,
-                                           const std::string& seq2,
+                                           const char* seq1,
+                                           size_t length1,
+                                           const char* seq2,
+                                           size_t length2,
                                            int min_offset) const
 {
   const int start_offset =
-    std::max<int>(min_offset, -static_cast<int>(seq2.length()) + 1);
-  const int end_offset = static_cast<int>(seq1.length()) - 1;
+    std::max<int>(min_offset, -static_cast<int>(length2) + 1);
+  const int end_offset = static_cast<int>(length1) - 1;
 
   alignment_info best = best_alignment;
   for (int offset = start_offset; offset <= end_offset; ++offset) {
     const size_t initial_seq1_offset = std::max<int>(0, offset);
     const size_t initial_seq2_offset = std::max<int>(0, -offset);
-    const size_t length = std::min(seq1.length() - initial_seq1_offset,
-                                   seq2.length() - initial_seq2_offset);
+    const size_t length = std::min(length1 - initial_seq1_offset,
+                                   length2 - initial_seq2_offset);
 
     if (static_cast<int>(length) >= best.score) {
       alignment_info current;
       current.offset = offset;
       current.length = length;
 
-      const char* seq_1_ptr = seq1.data() + initial_seq1_offset;
-      const char* seq_2_ptr = seq2.data() + initial_seq2_offset;
+      const char* seq_1_ptr = seq1 + initial_seq1_offset;
+      const char* seq_2_ptr = seq2 + initial_seq2_offset;
 
       if (compare_subsequences(
             best, current, seq_1_ptr, seq_2_ptr, m_mismatch_threshold)) {
@@ -231,6 +234,95 @@ get_updated_phred_scores(char qual_1, char qual_2)
   return phred_scores(index);
 }
 
+/** Wraps the nth record of a batch, for functions shared with 'fastq'. */
+class batch_record
+{
+public:
+  batch_record(read_batch& reads, size_t nth)
+    : m_reads(reads)
+    , m_nth(nth)
+  {}
+
+  size_t length() const { return m_reads.length(m_nth); }
+
+  void truncate(size_t pos = 0, size_t len = std::string::npos)
+  {
+    m_reads.truncate(m_nth, pos, len);
+  }
+
+private:
+  //! The batch containing the record
+  read_batch& m_reads;
+  //! The index of the record in the batch
+  const size_t m_nth;
+};
+
+/** See 'alignment_info::truncate_paired_end'. */
+template<typename T>
+size_t
+truncate_paired_reads(const alignment_info& alignment, T& read1, T& read2)
+{
+  const int offset = alignment.offset;
+
+  size_t had_adapter = 0;
+  const int template_length =
+    std::max<int>(0, static_cast<int>(read2.length()) + offset);
+
+  AR_DEBUG_ASSERT(offset <= static_cast<int>(read1.length()));
+
+  if (offset >= 0) {
+    // Read1 can potentially extend past read2, but by definition read2
+    // cannot extend past read1 when the offset is not negative, so there
+    // is no need to edit read2.
+    had_adapter += static_cast<size_t>(template_length) < read1.length();
+    read1.truncate(0, static_cast<size_t>(template_length));
+  } else {
+    had_adapter += static_cast<size_t>(template_length) < read1.length();
+    had_adapter += static_cast<size_t>(template_length) < read2.length();
+
+    read1.truncate(0, static_cast<size_t>(template_length));
+    read2.truncate(
+      static_cast<size_t>(static_cast<int>(read2.length()) - template_length));
+  }
+
+  return had_adapter;
+}
+
+/** See 'extract_adapter_sequences'. */
+template<typename T>
+bool
+extract_adapters(const alignment_info& alignment, T& read1, T& read2)
+{
+  AR_DEBUG_ASSERT(alignment.offset <= static_cast<int>(read1.length()));
+  const int template_length =
+    std::max(0, static_cast<int>(read2.length()) + alignment.offset);
+
+  read1.truncate(std::min<size_t>(read1.length(), template_length));
+  read2.truncate(
+    0, std::max<int>(0, static_cast<int>(read2.length()) - template_length));
+
+  return read1.length() || read2.length();
+}
+
+/**
+ * Returns the position of the mate separator in a header, if the name ends
+ * with mate numbering (e.g. "/1"), and std::string::npos otherwise.
+ */
+size_t
+find_mate_info(const char* header, size_t length, const char mate_sep)
+{
+  const size_t pos = std::find(header, header + length, ' ') - header;
+  if (pos >= 2 && header[pos - 2] == mate_sep) {
+    const char digit = header[pos - 1];
+
+    if (digit == '1' || digit == '2') {
+      return pos - 2;
+    }
+  }
+
+  return std::string::npos;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Public functions
 
@@ -269,31 +361,27 @@ alignment_info::truncate_single_end(fastq& read) const
   return read.truncate(0, len);
 }
 
+void
+alignment_info::truncate_single_end(read_batch& reads, size_t nth) const
+{
+  reads.truncate(nth, 0, std::max<int>(0, offset));
+}
+
 size_t
 alignment_info::truncate_paired_end(fastq& read1, fastq& read2) const
 {
-  size_t had_adapter = 0;
-  const int template_length =
-    std::max<int>(0, static_cast<int>(read2.length()) + offset);
-
-  AR_DEBUG_ASSERT(offset <= static_cast<int>(read1.length()));
-
-  if (offset >= 0) {
-    // Read1 can potentially extend past read2, but by definition read2
-    // cannot extend past read1 when the offset is not negative, so there
-    // is no need to edit read2.
-    had_adapter += static_cast<size_t>(template_length) < read1.length();
-    read1.truncate(0, static_cast<size_t>(template_length));
-  } else {
-    had_adapter += static_cast<size_t>(template_length) < read1.length();
-    had_adapter += static_cast<size_t>(template_length) < read2.length();
+  return truncate_paired_reads(*this, read1, read2);
+}
 
-    read1.truncate(0, static_cast<size_t>(template_length));
-    read2.truncate(
-      static_cast<size_t>(static_cast<int>(read2.length()) - template_length));
-  }
+size_t
+alignment_info::truncate_paired_end(read_batch& reads_1,
+                                    read_batch& reads_2,
+                                    size_t nth) const
+{
+  batch_record read1(reads_1, nth);
+  batch_record read2(reads_2, nth);
 
-  return had_adapter;
+  return truncate_paired_reads(*this, read1, read2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -312,13 +400,59 @@ sequence_aligner::set_mismatch_threshold(double mm)
 
 alignment_info
 sequence_aligner::align_single_end(const fastq& read, int max_shift) const
+{
+  return align_single_end(read.sequence().data(), read.length(), max_shift);
+}
+
+alignment_info
+sequence_aligner::align_single_end(const read_batch& reads,
+                                   size_t nth,
+                                   int max_shift) const
+{
+  return align_single_end(reads.sequence(nth), reads.length(nth), max_shift);
+}
+
+alignment_info
+sequence_aligner::align_paired_end(const fastq& read1,
+                                   const fastq& read2,
+                                   int max_shift) const
+{
+  return align_paired_end(read1.sequence().data(),
+                          read1.length(),
+                          read2.sequence().data(),
+                          read2.length(),
+                          max_shift);
+}
+
+alignment_info
+sequence_aligner::align_paired_end(const read_batch& reads_1,
+                                   const read_batch& reads_2,
+                                   size_t nth,
+                                   int max_shift) const
+{
+  return align_paired_end(reads_1.sequence(nth),
+                          reads_1.length(nth),
+                          reads_2.sequence(nth),
+                          reads_2.length(nth),
+                          max_shift);
+}
+
+alignment_info
+sequence_aligner::align_single_end(const char* seq,
+                                   size_t length,
+                                   int max_shift) const
 {
   size_t adapter_id = 0;
   alignment_info best_alignment;
   for (const auto& adapter_pair : m_adapters) {
     const fastq& adapter = adapter_pair.first;
-    const alignment_info alignment = pairwise_align_sequences(
-      best_alignment, read.sequence(), adapter.sequence(), -max_shift);
+    const alignment_info alignment =
+      pairwise_align_sequences(best_alignment,
+                               seq,
+                               length,
+                               adapter.sequence().data(),
+                               adapter.length(),
+                               -max_shift);
 
     if (alignment.is_better_than(best_alignment)) {
       best_alignment = alignment;
@@ -332,8 +466,10 @@ sequence_aligner::align_single_end(const fastq& read, int max_shift) const
 }
 
 alignment_info
-sequence_aligner::align_paired_end(const fastq& read1,
-                                   const fastq& read2,
+sequence_aligner::align_paired_end(const char* seq1,
+                                   size_t length1,
+                                   const char* seq2,
+                                   size_t length2,
                                    int max_shift) const
 {
   size_t adapter_id = 0;
@@ -342,15 +478,22 @@ sequence_aligner::align_paired_end(const fastq& read1,
     const fastq& adapter1 = adapter_pair.first;
     const fastq& adapter2 = adapter_pair.second;
 
-    const std::string sequence1 = adapter2.sequence() + read1.sequence();
-    const std::string sequence2 = read2.sequence() + adapter1.sequence();
+    std::string sequence1 = adapter2.sequence();
+    sequence1.append(seq1, length1);
+    std::string sequence2(seq2, length2);
+    sequence2.append(adapter1.sequence());
 
     // Only consider alignments where at least one nucleotide from each read
     // is aligned against the other, included shifted alignments to account
     // for missing bases at the 5' ends of the reads.
-    const int min_offset = adapter2.length() - read2.length() - max_shift;
-    const alignment_info alignment = pairwise_align_sequences(
-      best_alignment, sequence1, sequence2, min_offset);
+    const int min_offset = adapter2.length() - length2 - max_shift;
+    const alignment_info alignment =
+      pairwise_align_sequences(best_alignment,
+                               sequence1.data(),
+                               sequence1.length(),
+                               sequence2.data(),
+                               sequence2.length(),
+                               min_offset);
 
     if (alignment.is_better_than(best_alignment)) {
       best_alignment = alignment;
@@ -365,23 +508,6 @@ sequence_aligner::align_paired_end(const fastq& read1,
   return best_alignment;
 }
 
-void
-strip_mate_info(std::string& header, const char mate_sep)
-{
-  size_t pos = header.find_first_of(' ');
-  if (pos == std::string::npos) {
-    pos = header.length();
-  }
-
-  if (pos >= 2 && header.at(pos - 2) == mate_sep) {
-    const char digit = header.at(pos - 1);
-
-    if (digit == '1' || digit == '2') {
-      header.erase(pos - 2, 2);
-    }
-  }
-}
-
 sequence_merger::sequence_merger()
   : m_mate_sep(MATE_SEPARATOR)
   , m_conservative(false)
@@ -429,22 +555,77 @@ sequence_merger::merge(const alignment_info& alignment,
   AR_DEBUG_ASSERT(read1.m_sequence.length() == read1.m_qualities.length());
 
   // Pick the best bases for the overlapping part of the reads
-  for (size_t i = 0; i < read_2_offset; ++i) {
-    char& nt_1 = read1.m_sequence.at(i + read_1_offset);
-    char& qual_1 = read1.m_qualities.at(i + read_1_offset);
-    const char nt_2 = read2.sequence().at(i);
-    const char qual_2 = read2.qualities().at(i);
+  merge_overlap(&read1.m_sequence[read_1_offset],
+                &read1.m_qualities[read_1_offset],
+                read2.sequence().data(),
+                read2.qualities().data(),
+                read_2_offset);
 
-    if (m_conservative) {
-      conservative_merge(nt_1, qual_1, nt_2, qual_2);
-    } else {
-      original_merge(nt_1, qual_1, nt_2, qual_2);
+  // Remove mate number from read, if present
+  if (m_mate_sep) {
+    std::string& header = read1.m_header;
+    const size_t pos = find_mate_info(header.data(), header.size(), m_mate_sep);
+    if (pos != std::string::npos) {
+      header.erase(pos, 2);
     }
   }
+}
+
+void
+sequence_merger::merge(const alignment_info& alignment,
+                       read_batch& reads_1,
+                       const read_batch& reads_2,
+                       size_t nth)
+{
+  const size_t length_1 = reads_1.length(nth);
+  const size_t length_2 = reads_2.length(nth);
+
+  // Gap between the two reads is not allowed
+  AR_DEBUG_ASSERT(alignment.offset <= static_cast<int>(length_1));
+
+  // Offset to the first base overlapping read 2
+  const size_t read_1_offset =
+    static_cast<size_t>(std::max(0, alignment.offset));
+  // Offset to the last base overlapping read 1
+  const size_t read_2_offset = length_1 - read_1_offset;
+  AR_DEBUG_ASSERT(read_2_offset <= length_2);
+
+  // Produce draft by merging r1 and the parts of r2 that extend past r1
+  reads_1.extend(nth,
+                 reads_2.sequence(nth) + read_2_offset,
+                 reads_2.qualities(nth) + read_2_offset,
+                 length_2 - read_2_offset);
+
+  // Pick the best bases for the overlapping part of the reads
+  merge_overlap(reads_1.sequence(nth) + read_1_offset,
+                reads_1.qualities(nth) + read_1_offset,
+                reads_2.sequence(nth),
+                reads_2.qualities(nth),
+                read_2_offset);
 
   // Remove mate number from read, if present
   if (m_mate_sep) {
-    strip_mate_info(read1.m_header, m_mate_sep);
+    const size_t pos = find_mate_info(
+      reads_1.header(nth), reads_1.header_length(nth), m_mate_sep);
+    if (pos != std::string::npos) {
+      reads_1.erase_header(nth, pos, 2);
+    }
+  }
+}
+
+void
+sequence_merger::merge_overlap(char* nts_1,
+                               char* quals_1,
+                               const char* nts_2,
+                               const char* quals_2,
+                               size_t length)
+{
+  for (size_t i = 0; i < length; ++i) {
+    if (m_conservative) {
+      conservative_merge(nts_1[i], quals_1[i], nts_2[i], quals_2[i]);
+    } else {
+      original_merge(nts_1[i], quals_1[i], nts_2[i], quals_2[i]);
+    }
   }
 }
 
@@ -517,13 +698,17 @@ extract_adapter_sequences(const alignment_info& alignment,
                           fastq& read1,
                           fastq& read2)
 {
-  AR_DEBUG_ASSERT(alignment.offset <= static_cast<int>(read1.length()));
-  const int template_length =
-    std::max(0, static_cast<int>(read2.length()) + alignment.offset);
+  return extract_adapters(alignment, read1, read2);
+}
 
-  read1.truncate(std::min<size_t>(read1.length(), template_length));
-  read2.truncate(
-    0, std::max<int>(0, static_cast<int>(read2.length()) - template_length));
+bool
+extract_adapter_sequences(const alignment_info& alignment,
+                          read_batch& reads_1,
+                          read_batch& reads_2,
+                          size_t nth)
+{
+  batch_record read1(reads_1, nth);
+  batch_record read2(reads_2, nth);
 
-  return read1.sequence().length() || read2.sequence().length();
+  return extract_adapters(alignment, read1, read2);
 }
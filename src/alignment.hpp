@@ -28,6 +28,8 @@
 #include "fastq.hpp"     // for fastq_pair_vec, fastq
 #include "fastq_enc.hpp" // for MATE_SEPARATOR
 
+class read_batch;
+
 /**
  * Summarizes an alignment.
  *
@@ -96,6 +98,8 @@ struct alignment_info
    * from the read passed to this function.
    */
   void truncate_single_end(fastq& read) const;
+  /** Truncates the nth SE read of a batch; see above. */
+  void truncate_single_end(read_batch& reads, size_t nth) const;
 
   /**
    * Truncate a pair of PE reads, such that any adapter sequence inferred from
@@ -104,6 +108,10 @@ struct alignment_info
    * @return The number of sequences (0 .. 2) which contained adapter sequence.
    */
   size_t truncate_paired_end(fastq& read1, fastq& read2) const;
+  /** Truncates the nth pair of PE reads in two batches; see above. */
+  size_t truncate_paired_end(read_batch& reads_1,
+                             read_batch& reads_2,
+                             size_t nth) const;
 
   //! Alignment score; equal to length - n_ambiguous - 2 * n_mismatches;
   int score;
@@ -142,6 +150,10 @@ public:
    * The best alignment is selected using alignment_info::is_better_than.
    */
   alignment_info align_single_end(const fastq& read, int max_shift) const;
+  /** Aligns adapter sequences against the nth read of a batch; see above. */
+  alignment_info align_single_end(const read_batch& reads,
+                                  size_t nth,
+                                  int max_shift) const;
 
   /**
    * Attempts to align PE mates, along with any adapter pairs.
@@ -164,8 +176,25 @@ public:
   alignment_info align_paired_end(const fastq& read1,
                                   const fastq& read2,
                                   int max_shift) const;
+  /** Aligns the nth pair of PE reads in two batches; see above. */
+  alignment_info align_paired_end(const read_batch& reads_1,
+                                  const read_batch& reads_2,
+                                  size_t nth,
+                                  int max_shift) const;
 
 private:
+  /** Aligns adapter sequences against a SE sequence. */
+  alignment_info align_single_end(const char* seq,
+                                  size_t length,
+                                  int max_shift) const;
+
+  /** Aligns a pair of PE sequences, along with any adapter pairs. */
+  alignment_info align_paired_end(const char* seq1,
+                                  size_t length1,
+                                  const char* seq2,
+                                  size_t length2,
+                                  int max_shift) const;
+
   /**
    * Perform pairwise alignment between two sequences.
    *
@@ -175,8 +204,10 @@ private:
    * @param offset Search for alignments from this offset.
    */
   alignment_info pairwise_align_sequences(const alignment_info& best_alignment,
-                                          const std::string& seq1,
-                                          const std::string& seq2,
+                                          const char* seq1,
+                                          size_t length1,
+                                          const char* seq2,
+                                          size_t length2,
                                           int min_offset) const;
 
   //! Adapter sequences against which to align the sequences
@@ -225,8 +256,20 @@ public:
    * the case!
    */
   void merge(const alignment_info& alignment, fastq& read1, const fastq& read2);
+  /** Merges the nth pair of reads in two batches into the first batch. */
+  void merge(const alignment_info& alignment,
+             read_batch& reads_1,
+             const read_batch& reads_2,
+             size_t nth);
 
 private:
+  /** Merges overlapping bases of read 2 into read 1 in place. */
+  void merge_overlap(char* nts_1,
+                     char* quals_1,
+                     const char* nts_2,
+                     const char* quals_2,
+                     size_t length);
+
   /** The original merging algorithm implemented in AdapterRemoval. */
   void original_merge(char& nt_1, char& qual_1, char nt_2, char qual_2);
 
@@ -253,3 +296,10 @@ bool
 extract_adapter_sequences(const alignment_info& alignment,
                           fastq& pcr1,
                           fastq& pcr2);
+
+/** Truncates the nth pair of reads in two batches; see above. */
+bool
+extract_adapter_sequences(const alignment_info& alignment,
+                          read_batch& reads_1,
+                          read_batch& reads_2,
+                          size_t nth);
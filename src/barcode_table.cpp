@@ -27,6 +27,7 @@
 #include <utility>   // for pair
 
 #include "barcode_table.hpp"
+#include "read_batch.hpp" // for read_batch
 
 typedef std::pair<std::string, size_t> barcode_pair;
 typedef std::vector<barcode_pair> barcode_vec;
@@ -206,11 +207,43 @@ barcode_table::barcode_table(const fastq_pair_vec& barcodes,
 int
 barcode_table::identify(const fastq& read_r1) const
 {
-  if (read_r1.length() < m_barcode_1_len) {
+  return identify(read_r1.sequence().data(), read_r1.length());
+}
+
+int
+barcode_table::identify(const fastq& read_r1, const fastq& read_r2) const
+{
+  return identify(read_r1.sequence().data(),
+                  read_r1.length(),
+                  read_r2.sequence().data(),
+                  read_r2.length());
+}
+
+int
+barcode_table::identify(const read_batch& reads_r1, size_t nth) const
+{
+  return identify(reads_r1.sequence(nth), reads_r1.length(nth));
+}
+
+int
+barcode_table::identify(const read_batch& reads_r1,
+                        const read_batch& reads_r2,
+                        size_t nth) const
+{
+  return identify(reads_r1.sequence(nth),
+                  reads_r1.length(nth),
+                  reads_r2.sequence(nth),
+                  reads_r2.length(nth));
+}
+
+int
+barcode_table::identify(const char* seq_r1, size_t length_r1) const
+{
+  if (length_r1 < m_barcode_1_len) {
     return barcode_table::no_match;
   }
 
-  const std::string barcode = read_r1.sequence().substr(0, m_barcode_1_len);
+  const std::string barcode(seq_r1, m_barcode_1_len);
   auto match = lookup(barcode.c_str(), 0, 0, nullptr);
   if (match.barcode == no_match && m_max_mismatches) {
     match = lookup_with_mm(
@@ -221,15 +254,17 @@ barcode_table::identify(const fastq& read_r1) const
 }
 
 int
-barcode_table::identify(const fastq& read_r1, const fastq& read_r2) const
+barcode_table::identify(const char* seq_r1,
+                        size_t length_r1,
+                        const char* seq_r2,
+                        size_t length_r2) const
 {
-  if (read_r1.length() < m_barcode_1_len ||
-      read_r2.length() < m_barcode_2_len) {
+  if (length_r1 < m_barcode_1_len || length_r2 < m_barcode_2_len) {
     return no_match;
   }
 
-  const auto barcode_1 = read_r1.sequence().substr(0, m_barcode_1_len);
-  const auto barcode_2 = read_r2.sequence().substr(0, m_barcode_2_len);
+  const std::string barcode_1(seq_r1, m_barcode_1_len);
+  const std::string barcode_2(seq_r2, m_barcode_2_len);
   const auto combined_barcode = barcode_1 + barcode_2;
 
   auto match = lookup(combined_barcode.c_str(), 0, 0, nullptr);
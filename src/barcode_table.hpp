@@ -33,6 +33,8 @@
 
 #include "fastq.hpp" // for fastq_pair_vec
 
+class read_batch;
+
 struct next_subsequence;
 
 /** Exception raised for FASTQ parsing and validation errors. */
@@ -80,6 +82,12 @@ public:
 
   int identify(const fastq& read_r1) const;
   int identify(const fastq& read_r1, const fastq& read_r2) const;
+  /** Identifies the barcode(s) of the nth SE read in a batch. */
+  int identify(const read_batch& reads_r1, size_t nth) const;
+  /** Identifies the barcodes of the nth pair of PE reads in two batches. */
+  int identify(const read_batch& reads_r1,
+               const read_batch& reads_r2,
+               size_t nth) const;
 
   static const int no_match = -1;
   static const int ambigious = -2;
@@ -94,6 +102,12 @@ protected:
     size_t mismatches;
   };
 
+  int identify(const char* seq_r1, size_t length_r1) const;
+  int identify(const char* seq_r1,
+               size_t length_r1,
+               const char* seq_r2,
+               size_t length_r2) const;
+
   candidate lookup(const char* seq,
                    int parent,
                    const size_t max_global_mismatches,
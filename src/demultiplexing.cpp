@@ -26,23 +26,40 @@
 #include <utility> // for move
 
 #include "adapterset.hpp"  // for adapter_set
-#include "commontypes.hpp" // for fastq_vec
 #include "debug.hpp"       // for AR_DEBUG_ASSERT, AR_DEBUG_LOCK
 #include "demultiplexing.hpp"
 #include "fastq_io.hpp"   // for fastq_read_chunk, fastq_output_chunk, rea...
+#include "read_batch.hpp" // for read_batch
 #include "statistics.hpp" // for demultiplexing_statistics, fastq_statistics
 #include "userconfig.hpp" // for userconfig, fastq_encoding_ptr
 
 ///////////////////////////////////////////////////////////////////////////////
 
+/** Replaces the chunk with an empty, recycled chunk. */
+void
+acquire_chunk(output_chunk_ptr& ptr)
+{
+  ptr = fastq_output_chunk::acquire();
+}
+
+/** Replaces the chunk with an empty, recycled chunk. */
+void
+acquire_chunk(read_chunk_ptr& ptr)
+{
+  ptr = fastq_read_chunk::acquire();
+}
+
 template<typename T>
 void
-flush_chunk(chunk_vec& output, std::unique_ptr<T>& ptr, size_t step, bool eof)
+flush_chunk(chunk_vec& output,
+            std::unique_ptr<T>& ptr,
+            const step_handle<T>& step,
+            bool eof)
 {
   if (eof || ptr->nucleotides >= INPUT_BLOCK_SIZE) {
     ptr->eof = eof;
-    output.push_back(chunk_pair(step, std::move(ptr)));
-    ptr.reset(new T());
+    push_chunk(output, step, std::move(ptr));
+    acquire_chunk(ptr);
   }
 }
 
@@ -50,20 +67,18 @@ flush_chunk(chunk_vec& output, std::unique_ptr<T>& ptr, size_t step, bool eof)
 // Implementations for `post_demux_steps`
 
 post_demux_steps::post_demux_steps()
-  : unidentified_1(post_demux_steps::disabled)
-  , unidentified_2(post_demux_steps::disabled)
+  : unidentified_1()
+  , unidentified_2()
   , samples()
 {}
 
-const size_t post_demux_steps::disabled = static_cast<size_t>(-1);
-
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for `demultiplex_reads`
 
 demultiplex_reads::demultiplex_reads(const userconfig& config,
                                      const post_demux_steps& steps,
                                      demultiplexing_statistics* statistics)
-  : analytical_step(processing_order::ordered)
+  : typed_step(processing_order::ordered)
   , m_barcodes(config.adapters.get_barcodes())
   , m_barcode_table(m_barcodes,
                     config.barcode_mm,
@@ -84,26 +99,28 @@ demultiplex_reads::demultiplex_reads(const userconfig& config,
 
   m_statistics->resize(m_barcodes.size());
 
-  AR_DEBUG_ASSERT(m_steps.unidentified_1 != post_demux_steps::disabled);
-  m_unidentified_1.reset(new fastq_output_chunk());
+  AR_DEBUG_ASSERT(m_steps.unidentified_1.is_set());
+  acquire_chunk(m_unidentified_1);
 
-  if (m_steps.unidentified_2 != post_demux_steps::disabled &&
+  if (m_steps.unidentified_2.is_set() &&
       m_steps.unidentified_1 != m_steps.unidentified_2) {
-    m_unidentified_2.reset(new fastq_output_chunk());
+    acquire_chunk(m_unidentified_2);
   }
 
-  for (const auto next_step : m_steps.samples) {
-    AR_DEBUG_ASSERT(next_step != post_demux_steps::disabled);
+  for (const auto& next_step : m_steps.samples) {
+    AR_DEBUG_ASSERT(next_step.is_set());
 
-    m_cache.push_back(read_chunk_ptr(new fastq_read_chunk()));
+    m_cache.emplace_back();
+    acquire_chunk(m_cache.back());
   }
 }
 
 demultiplex_reads::~demultiplex_reads() {}
 
 chunk_vec
-demultiplex_reads::flush_cache(bool eof)
+demultiplex_reads::flush_cache(const fastq_read_chunk& source)
 {
+  const bool eof = source.eof;
   chunk_vec output;
 
   flush_chunk(output, m_unidentified_1, m_steps.unidentified_1, eof);
@@ -113,6 +130,7 @@ demultiplex_reads::flush_cache(bool eof)
   }
 
   for (size_t nth = 0; nth < m_cache.size(); ++nth) {
+    m_cache.at(nth)->inherit_sizer(source);
     flush_chunk(output, m_cache.at(nth), m_steps.samples.at(nth), eof);
   }
 
@@ -129,16 +147,17 @@ demultiplex_se_reads::demultiplex_se_reads(
 {}
 
 chunk_vec
-demultiplex_se_reads::process(analytical_chunk* chunk)
+demultiplex_se_reads::process_chunk(read_chunk_ptr read_chunk)
 {
   AR_DEBUG_LOCK(m_lock);
-  read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+  read_chunk->begin_processing();
 
-  for (auto& read : read_chunk->reads_1) {
-    const int best_barcode = m_barcode_table.identify(read);
+  read_batch& reads = read_chunk->reads_1;
+  for (size_t i = 0; i < reads.size(); ++i) {
+    const int best_barcode = m_barcode_table.identify(reads, i);
 
     if (best_barcode < 0) {
-      m_unidentified_1->add(read);
+      m_unidentified_1->add(reads, i);
 
       if (best_barcode == -1) {
         m_statistics->unidentified += 1;
@@ -146,18 +165,24 @@ demultiplex_se_reads::process(analytical_chunk* chunk)
         m_statistics->ambiguous += 1;
       }
 
-      m_statistics->unidentified_stats_1.process(read);
+      m_statistics->unidentified_stats_1.process(reads, i);
     } else {
+      // Barcodes are trimmed before the remaining bases are copied
       read_chunk_ptr& dst = m_cache.at(best_barcode);
-      read.truncate(m_barcodes.at(best_barcode).first.length());
-      dst->nucleotides += read.length();
-      dst->reads_1.push_back(read);
+      reads.truncate(i, m_barcodes.at(best_barcode).first.length());
+      dst->nucleotides += reads.length(i);
+      dst->reads_1.add(reads, i);
 
       m_statistics->barcodes.at(best_barcode) += 1;
     }
   }
 
-  return flush_cache(read_chunk->eof);
+  m_statistics->unidentified_stats_1.flush();
+
+  chunk_vec output = flush_cache(*read_chunk);
+  fastq_read_chunk::release(read_chunk);
+
+  return output;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -170,23 +195,23 @@ demultiplex_pe_reads::demultiplex_pe_reads(
 {}
 
 chunk_vec
-demultiplex_pe_reads::process(analytical_chunk* chunk)
+demultiplex_pe_reads::process_chunk(read_chunk_ptr read_chunk)
 {
   AR_DEBUG_LOCK(m_lock);
-  read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
   AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
+  read_chunk->begin_processing();
 
-  fastq_vec::iterator it_1 = read_chunk->reads_1.begin();
-  fastq_vec::iterator it_2 = read_chunk->reads_2.begin();
-  for (; it_1 != read_chunk->reads_1.end(); ++it_1, ++it_2) {
-    const int best_barcode = m_barcode_table.identify(*it_1, *it_2);
+  read_batch& reads_1 = read_chunk->reads_1;
+  read_batch& reads_2 = read_chunk->reads_2;
+  for (size_t i = 0; i < reads_1.size(); ++i) {
+    const int best_barcode = m_barcode_table.identify(reads_1, reads_2, i);
 
     if (best_barcode < 0) {
-      m_unidentified_1->add(*it_1);
+      m_unidentified_1->add(reads_1, i);
       if (m_config.interleaved_output) {
-        m_unidentified_1->add(*it_2);
+        m_unidentified_1->add(reads_2, i);
       } else {
-        m_unidentified_2->add(*it_2);
+        m_unidentified_2->add(reads_2, i);
       }
 
       if (best_barcode == -1) {
@@ -195,21 +220,27 @@ demultiplex_pe_reads::process(analytical_chunk* chunk)
         m_statistics->ambiguous += 2;
       }
 
-      m_statistics->unidentified_stats_1.process(*it_1);
-      m_statistics->unidentified_stats_2.process(*it_2);
+      m_statistics->unidentified_stats_1.process(reads_1, i);
+      m_statistics->unidentified_stats_2.process(reads_2, i);
     } else {
       read_chunk_ptr& dst = m_cache.at(best_barcode);
 
-      it_1->truncate(m_barcodes.at(best_barcode).first.length());
-      dst->nucleotides += it_1->length();
-      dst->reads_1.push_back(*it_1);
-      it_2->truncate(m_barcodes.at(best_barcode).second.length());
-      dst->nucleotides += it_2->length();
-      dst->reads_2.push_back(*it_2);
+      reads_1.truncate(i, m_barcodes.at(best_barcode).first.length());
+      dst->nucleotides += reads_1.length(i);
+      dst->reads_1.add(reads_1, i);
+      reads_2.truncate(i, m_barcodes.at(best_barcode).second.length());
+      dst->nucleotides += reads_2.length(i);
+      dst->reads_2.add(reads_2, i);
 
       m_statistics->barcodes.at(best_barcode) += 2;
     }
   }
 
-  return flush_cache(read_chunk->eof);
+  m_statistics->unidentified_stats_1.flush();
+  m_statistics->unidentified_stats_2.flush();
+
+  chunk_vec output = flush_cache(*read_chunk);
+  fastq_read_chunk::release(read_chunk);
+
+  return output;
 }
@@ -32,7 +32,7 @@
 #include "barcode_table.hpp" // for barcode_table
 #include "fastq.hpp"         // for fastq_pair_vec
 #include "fastq_io.hpp"      // for read_chunk_ptr, output_chunk_ptr
-#include "scheduler.hpp"     // for chunk_vec, analytical_step
+#include "scheduler.hpp"     // for chunk_vec, typed_step
 
 class userconfig;
 struct demultiplexing_statistics;
@@ -44,15 +44,12 @@ public:
   post_demux_steps();
 
   /* Step used to write unidentified mate 1 reads. */
-  size_t unidentified_1;
-  /* Step used to write unidentified mate 2 reads; may be disabled. */
-  size_t unidentified_2;
+  output_step_id unidentified_1;
+  /* Step used to write unidentified mate 2 reads; may be unset. */
+  output_step_id unidentified_2;
 
   /* Processing step for each sample. */
-  std::vector<size_t> samples;
-
-  /** Constant indicating that a step has been disabled. */
-  static const size_t disabled;
+  std::vector<read_step_id> samples;
 };
 
 /**
@@ -60,7 +57,7 @@ public:
  * representing the set of adapter sequences, and for maintaining the cache of
  * demultiplexed reads.
  */
-class demultiplex_reads : public analytical_step
+class demultiplex_reads : public typed_step<fastq_read_chunk>
 {
 public:
   /** Setup demultiplexer; keeps reference to config object. */
@@ -85,9 +82,10 @@ protected:
   const userconfig& m_config;
 
   //! Returns a chunk-list with any set of reads exceeding the max cache size
-  //! If 'eof' is true, all chunks are returned, and the 'eof' values in the
-  //! chunks are set to true.
-  chunk_vec flush_cache(bool eof = false);
+  //! If 'source' is the last chunk (EOF), all chunks are returned, and the
+  //! 'eof' values in the chunks are set to true. Chunks of demultiplexed
+  //! reads are timed using the sizer of 'source'.
+  chunk_vec flush_cache(const fastq_read_chunk& source);
 
   typedef std::vector<read_chunk_ptr> demultiplexed_cache;
 
@@ -124,7 +122,7 @@ public:
    * the IDs corresponding to ai_analyses_offset * (nth + 1) for the nth
    * barcode (pair). Unidentified reads are sent to ai_write_unidentified_1.
    */
-  chunk_vec process(analytical_chunk* chunk);
+  chunk_vec process_chunk(read_chunk_ptr read_chunk);
 };
 
 /** Demultiplexer for paired-end reads. */
@@ -142,5 +140,5 @@ public:
    * barcode (pair). Unidentified reads are sent to ai_write_unidentified_1
    * and ai_write_unidentified_2.
    */
-  chunk_vec process(analytical_chunk* chunk);
+  chunk_vec process_chunk(read_chunk_ptr read_chunk);
 };
@@ -31,6 +31,12 @@
 #include "debug.hpp" // for AR_DEBUG_ASSERT, AR_DEBUG_FAIL
 #include "fastq.hpp"
 #include "linereader.hpp" // for line_reader_base
+#include "read_batch.hpp" // for read_batch
+#include "strutils.hpp"   // for find_newlines
+
+#if defined(__AVX2__)
+#include <immintrin.h> // for _mm256_cmpeq_epi8, _mm256_movemask_epi8, ...
+#endif
 
 enum class read_mate
 {
@@ -64,19 +70,22 @@ struct mate_info
   read_mate mate;
 };
 
+/** Returns the length of the name (excluding other fields) of a header. */
+inline size_t
+header_name_length(const char* header, size_t length)
+{
+  return std::find(header, header + length, ' ') - header;
+}
+
+/** Gets mate numbering and fixes the separator char in place. */
 inline mate_info
-get_and_fix_mate_info(fastq& read, char mate_separator)
+get_and_fix_mate_info(char* header, size_t length, char mate_separator)
 {
   mate_info info;
-  std::string& header = read.m_header;
-
-  size_t pos = header.find_first_of(' ');
-  if (pos == std::string::npos) {
-    pos = header.length();
-  }
 
-  if (pos >= 2 && header.at(pos - 2) == mate_separator) {
-    const char digit = header.at(pos - 1);
+  size_t pos = header_name_length(header, length);
+  if (pos >= 2 && header[pos - 2] == mate_separator) {
+    const char digit = header[pos - 1];
 
     if (digit == '1') {
       header[pos - 2] = MATE_SEPARATOR;
@@ -89,7 +98,7 @@ get_and_fix_mate_info(fastq& read, char mate_separator)
     }
   }
 
-  info.name = header.substr(0, pos);
+  info.name.assign(header, pos);
   return info;
 }
 
@@ -139,15 +148,32 @@ fastq::ntrimmed
 fastq::trim_trailing_bases(const bool trim_ns,
                            char low_quality,
                            const bool preserve5p)
+{
+  const kept_bases kept = trailing_bases(m_sequence.data(),
+                                         m_qualities.data(),
+                                         length(),
+                                         trim_ns,
+                                         low_quality,
+                                         preserve5p);
+
+  return trim_sequence_and_qualities(kept.first, kept.second);
+}
+
+fastq::kept_bases
+fastq::trailing_bases(const char* sequence,
+                      const char* qualities,
+                      size_t length,
+                      bool trim_ns,
+                      char low_quality,
+                      bool preserve5p)
 {
   low_quality += PHRED_OFFSET_33;
   auto is_quality_base = [&](size_t i) {
-    return m_qualities.at(i) > low_quality &&
-           (!trim_ns || m_sequence.at(i) != 'N');
+    return qualities[i] > low_quality && (!trim_ns || sequence[i] != 'N');
   };
 
   size_t right_exclusive = 0;
-  for (size_t i = m_sequence.length(); i; --i) {
+  for (size_t i = length; i; --i) {
     if (is_quality_base(i - 1)) {
       right_exclusive = i;
       break;
@@ -162,7 +188,7 @@ fastq::trim_trailing_bases(const bool trim_ns,
     }
   }
 
-  return trim_sequence_and_qualities(left_inclusive, right_exclusive);
+  return kept_bases(left_inclusive, right_exclusive);
 }
 
 //! Calculates the size of the sliding window for quality trimming given a
@@ -189,25 +215,43 @@ fastq::trim_windowed_bases(const bool trim_ns,
                            char low_quality,
                            const double window_size,
                            const bool preserve5p)
+{
+  const kept_bases kept = windowed_bases(m_sequence.data(),
+                                         m_qualities.data(),
+                                         length(),
+                                         trim_ns,
+                                         low_quality,
+                                         window_size,
+                                         preserve5p);
+
+  return trim_sequence_and_qualities(kept.first, kept.second);
+}
+
+fastq::kept_bases
+fastq::windowed_bases(const char* sequence,
+                      const char* qualities,
+                      size_t length,
+                      bool trim_ns,
+                      char low_quality,
+                      double window_size,
+                      bool preserve5p)
 {
   AR_DEBUG_ASSERT(window_size >= 0.0);
-  if (m_sequence.empty()) {
-    return ntrimmed();
+  if (!length) {
+    return kept_bases(0, 0);
   }
 
   low_quality += PHRED_OFFSET_33;
   auto is_quality_base = [&](size_t i) {
-    return m_qualities.at(i) > low_quality &&
-           (!trim_ns || m_sequence.at(i) != 'N');
+    return qualities[i] > low_quality && (!trim_ns || sequence[i] != 'N');
   };
 
-  const size_t winlen = calculate_winlen(length(), window_size);
-  long running_sum =
-    std::accumulate(m_qualities.begin(), m_qualities.begin() + winlen, 0);
+  const size_t winlen = calculate_winlen(length, window_size);
+  long running_sum = std::accumulate(qualities, qualities + winlen, 0);
 
   size_t left_inclusive = std::string::npos;
   size_t right_exclusive = std::string::npos;
-  for (size_t offset = 0; offset + winlen <= length(); ++offset) {
+  for (size_t offset = 0; offset + winlen <= length; ++offset) {
     const long running_avg = running_sum / static_cast<long>(winlen);
 
     // We trim away low quality bases and Ns from the start of reads,
@@ -218,30 +262,30 @@ fastq::trim_windowed_bases(const bool trim_ns,
     }
 
     if (left_inclusive != std::string::npos &&
-        (running_avg <= low_quality || offset + winlen == length())) {
+        (running_avg <= low_quality || offset + winlen == length)) {
       right_exclusive = offset;
-      while (right_exclusive < length() && is_quality_base(right_exclusive)) {
+      while (right_exclusive < length && is_quality_base(right_exclusive)) {
         right_exclusive++;
       }
 
       break;
     }
 
-    running_sum -= m_qualities.at(offset);
-    if (offset + winlen < length()) {
-      running_sum += m_qualities.at(offset + winlen);
+    running_sum -= qualities[offset];
+    if (offset + winlen < length) {
+      running_sum += qualities[offset + winlen];
     }
   }
 
   if (left_inclusive == std::string::npos) {
     // No starting window found. Trim all bases starting from start.
-    return trim_sequence_and_qualities(length(), length());
+    return kept_bases(length, length);
   } else if (preserve5p) {
     left_inclusive = 0;
   }
 
   AR_DEBUG_ASSERT(right_exclusive != std::string::npos);
-  return trim_sequence_and_qualities(left_inclusive, right_exclusive);
+  return kept_bases(left_inclusive, right_exclusive);
 }
 
 void
@@ -249,50 +293,56 @@ fastq::truncate(size_t pos, size_t len)
 {
   AR_DEBUG_ASSERT(pos == 0 || pos <= length());
 
-  if (pos || len < length()) {
-    m_sequence = m_sequence.substr(pos, len);
-    m_qualities = m_qualities.substr(pos, len);
-  }
+  trim_sequence_and_qualities(pos, pos + std::min(len, length() - pos));
 }
 
 void
 fastq::reverse_complement()
 {
-  std::reverse(m_sequence.begin(), m_sequence.end());
-  std::reverse(m_qualities.begin(), m_qualities.end());
+  reverse_complement(&m_sequence[0], &m_qualities[0], length());
+}
+
+void
+fastq::reverse_complement(char* sequence, char* qualities, size_t length)
+{
+  std::reverse(sequence, sequence + length);
+  std::reverse(qualities, qualities + length);
 
   // Lookup table for complementary bases based only on the last 4 bits
   static const char complements[] = "-T-GA--C------N-";
-  for (auto& nuc : m_sequence) {
-    nuc = complements[nuc & 0xf];
+  for (size_t i = 0; i < length; ++i) {
+    sequence[i] = complements[sequence[i] & 0xf];
   }
 }
 
 bool
 fastq::read_unsafe(line_reader_base& reader)
 {
-  std::string line;
+  // Lines are read directly into the existing buffers, so that no allocations
+  // are needed once these have grown large enough to hold typical records
   do {
-    if (!reader.getline(line)) {
+    if (!reader.getline(m_header)) {
       // End of file; terminate gracefully
       return false;
     }
-  } while (line.empty());
+  } while (m_header.empty());
 
-  m_header = line.substr(1);
-  if (m_header.empty() || line.at(0) != '@') {
+  if (m_header.size() < 2 || m_header.front() != '@') {
     throw fastq_error("Malformed or empty FASTQ header");
   }
 
+  m_header.erase(0, 1);
+
   if (!reader.getline(m_sequence)) {
     throw fastq_error("partial FASTQ record; cut off after header");
   } else if (m_sequence.empty()) {
     throw fastq_error("sequence is empty");
   }
 
-  if (!reader.getline(line)) {
+  // The separator is read into the buffer subsequently used for qualities
+  if (!reader.getline(m_qualities)) {
     throw fastq_error("partial FASTQ record; cut off after sequence");
-  } else if (line.empty() || line.at(0) != '+') {
+  } else if (m_qualities.empty() || m_qualities.front() != '+') {
     throw fastq_error("FASTQ record lacks separator character (+)");
   }
 
@@ -307,6 +357,12 @@ fastq::read_unsafe(line_reader_base& reader)
   return true;
 }
 
+bool
+fastq::read_unsafe(fastq_tokenizer& tokenizer)
+{
+  return tokenizer.next(m_header, m_sequence, m_qualities);
+}
+
 bool
 fastq::read(line_reader_base& reader, const fastq_encoding& encoding)
 {
@@ -335,9 +391,42 @@ fastq::into_string(std::string& dst) const
 // Public helper functions
 
 void
-fastq::clean_sequence(std::string& sequence)
+fastq::clean_sequence(char* sequence, size_t length)
 {
-  for (char& nuc : sequence) {
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  // Clearing bit 5 uppercases letters, and only 'x' and 'X' map to 'X'; blocks
+  // containing any other characters are left for the loop below, which
+  // produces the error message for the first invalid character.
+  const __m256i uppercase = _mm256_set1_epi8(static_cast<char>(~0x20));
+  const __m256i nuc_a = _mm256_set1_epi8('A');
+  const __m256i nuc_c = _mm256_set1_epi8('C');
+  const __m256i nuc_g = _mm256_set1_epi8('G');
+  const __m256i nuc_t = _mm256_set1_epi8('T');
+  const __m256i nuc_n = _mm256_set1_epi8('N');
+
+  for (; length - i >= 32; i += 32) {
+    __m256i* ptr = reinterpret_cast<__m256i*>(sequence + i);
+    const __m256i value = _mm256_and_si256(_mm256_loadu_si256(ptr), uppercase);
+
+    const __m256i valid = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(value, nuc_a),
+                      _mm256_cmpeq_epi8(value, nuc_c)),
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(value, nuc_g),
+                                      _mm256_cmpeq_epi8(value, nuc_t)),
+                      _mm256_cmpeq_epi8(value, nuc_n)));
+
+    if (_mm256_movemask_epi8(valid) != -1) {
+      break;
+    }
+
+    _mm256_storeu_si256(ptr, value);
+  }
+#endif
+
+  for (; i < length; ++i) {
+    char& nuc = sequence[i];
     switch (nuc) {
       case 'A':
       case 'C':
@@ -373,12 +462,32 @@ fastq::p_to_phred_33(double p)
 void
 fastq::validate_paired_reads(fastq& mate1, fastq& mate2, char mate_separator)
 {
-  if (mate1.length() == 0 || mate2.length() == 0) {
+  validate_paired_reads(&mate1.m_header[0],
+                        mate1.m_header.size(),
+                        mate1.length(),
+                        &mate2.m_header[0],
+                        mate2.m_header.size(),
+                        mate2.length(),
+                        mate_separator);
+}
+
+void
+fastq::validate_paired_reads(char* header_1,
+                             size_t header_length_1,
+                             size_t length_1,
+                             char* header_2,
+                             size_t header_length_2,
+                             size_t length_2,
+                             char mate_separator)
+{
+  if (length_1 == 0 || length_2 == 0) {
     throw fastq_error("Pair contains empty reads");
   }
 
-  const mate_info info1 = get_and_fix_mate_info(mate1, mate_separator);
-  const mate_info info2 = get_and_fix_mate_info(mate2, mate_separator);
+  const mate_info info1 =
+    get_and_fix_mate_info(header_1, header_length_1, mate_separator);
+  const mate_info info2 =
+    get_and_fix_mate_info(header_2, header_length_2, mate_separator);
 
   if (info1.name != info2.name) {
     std::stringstream error;
@@ -404,9 +513,12 @@ fastq::validate_paired_reads(fastq& mate1, fastq& mate2, char mate_separator)
     if (info1.mate != read_mate::mate_1 || info2.mate != read_mate::mate_2) {
       std::stringstream error;
       error << "Inconsistent mate numbering; please verify data:\n"
-            << "\nRead 1 identified as " << info1.desc() << ": " << mate1.name()
+            << "\nRead 1 identified as " << info1.desc() << ": "
+            << std::string(header_1,
+                           header_name_length(header_1, header_length_1))
             << "\nRead 2 identified as " << info2.desc() << ": "
-            << mate2.name();
+            << std::string(header_2,
+                           header_name_length(header_2, header_length_2));
 
       throw fastq_error(error.str());
     }
@@ -424,7 +536,8 @@ fastq::post_process(const fastq_encoding& encoding)
       "invalid FASTQ record; sequence/quality length does not match");
   }
 
-  clean_sequence(m_sequence);
+  clean_sequence(&m_sequence[0], length());
+
   encoding.decode(m_qualities);
 }
 
@@ -435,10 +548,162 @@ fastq::trim_sequence_and_qualities(const size_t left_inclusive,
   const ntrimmed summary(left_inclusive, length() - right_exclusive);
 
   if (summary.first || summary.second) {
-    const size_t retained = right_exclusive - left_inclusive;
-    m_sequence = m_sequence.substr(left_inclusive, retained);
-    m_qualities = m_qualities.substr(left_inclusive, retained);
+    // Bases are removed in place, so that the buffers are not re-allocated;
+    // only trimming the 5' end requires moving the remaining bases
+    m_sequence.resize(right_exclusive);
+    m_sequence.erase(0, left_inclusive);
+    m_qualities.resize(right_exclusive);
+    m_qualities.erase(0, left_inclusive);
   }
 
   return summary;
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// fastq_tokenizer
+
+fastq_tokenizer::fastq_tokenizer(const std::string& text)
+  : m_text(text)
+  , m_newlines()
+  , m_records()
+  , m_next(0)
+  , m_lines(0)
+  , m_tokenized_lines(0)
+  , m_error()
+{
+  find_newlines(m_text.data(), m_text.size(), m_newlines);
+  if (!m_text.empty() && m_text.back() != '\n') {
+    // The final line need not be terminated by a newline
+    m_newlines.push_back(m_text.size());
+  }
+
+  try {
+    tokenize();
+  } catch (const fastq_error& error) {
+    // Reported once the preceding (valid) records have been read
+    m_error = error.what();
+  }
+}
+
+bool
+fastq_tokenizer::next(std::string& header,
+                      std::string& sequence,
+                      std::string& qualities)
+{
+  const record* current = next_record();
+  if (current) {
+    const char* data = m_text.data();
+
+    header.assign(data + current->header, current->header_length);
+    sequence.assign(data + current->sequence, current->length);
+    qualities.assign(data + current->qualities, current->length);
+  }
+
+  return current;
+}
+
+bool
+fastq_tokenizer::next(read_batch& dst)
+{
+  const record* current = next_record();
+  if (current) {
+    const char* data = m_text.data();
+
+    dst.add(data + current->header,
+            current->header_length,
+            data + current->sequence,
+            data + current->qualities,
+            current->length);
+  }
+
+  return current;
+}
+
+size_t
+fastq_tokenizer::lines() const
+{
+  return m_lines;
+}
+
+const fastq_tokenizer::record*
+fastq_tokenizer::next_record()
+{
+  if (m_next < m_records.size()) {
+    const record& current = m_records.at(m_next++);
+    m_lines = current.lines;
+
+    return &current;
+  } else if (!m_error.empty()) {
+    m_lines = m_tokenized_lines;
+
+    throw fastq_error(m_error);
+  }
+
+  return nullptr;
+}
+
+void
+fastq_tokenizer::tokenize()
+{
+  const char* data = m_text.data();
+  const size_t nlines = m_newlines.size();
+  size_t& line = m_tokenized_lines;
+
+  // Start and end (excluding the newline and any terminal \r) of each line
+  size_t start = 0;
+  size_t end = 0;
+  auto next_line = [&]() {
+    start = line ? m_newlines.at(line - 1) + 1 : 0;
+    end = m_newlines.at(line++);
+    if (end != start && data[end - 1] == '\r') {
+      --end;
+    }
+  };
+
+  while (line < nlines) {
+    next_line();
+    if (start == end) {
+      // Empty lines before records are skipped
+      continue;
+    }
+
+    record current = record();
+    if (end - start < 2 || data[start] != '@') {
+      throw fastq_error("Malformed or empty FASTQ header");
+    } else if (line == nlines) {
+      throw fastq_error("partial FASTQ record; cut off after header");
+    }
+
+    current.header = start + 1;
+    current.header_length = end - start - 1;
+
+    next_line();
+    if (start == end) {
+      throw fastq_error("sequence is empty");
+    } else if (line == nlines) {
+      throw fastq_error("partial FASTQ record; cut off after sequence");
+    }
+
+    current.sequence = start;
+    current.length = end - start;
+
+    next_line();
+    if (start == end || data[start] != '+') {
+      throw fastq_error("FASTQ record lacks separator character (+)");
+    } else if (line == nlines) {
+      throw fastq_error("partial FASTQ record; cut off after separator");
+    }
+
+    next_line();
+    if (start == end) {
+      throw fastq_error("no qualities");
+    } else if (end - start != current.length) {
+      throw fastq_error("sequence/quality lengths do not match");
+    }
+
+    current.qualities = start;
+    current.lines = line;
+
+    m_records.push_back(current);
+  }
+}
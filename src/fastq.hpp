@@ -31,8 +31,9 @@
 
 #include "fastq_enc.hpp" // for FASTQ_ENCODING_33, MATE_SEPARATOR
 
+class fastq_tokenizer;
 class line_reader_base;
-struct mate_info;
+class read_batch;
 
 /**
  * Represents a FASTQ record with Phred (offset=33) encoded quality scores.
@@ -123,8 +124,8 @@ public:
   /**
    * Truncates the record in place.
    *
-   * This function behaves like std::string::substr, except that the
-   * substrings (sequence / qualities) are re-assigned to the record itself.
+   * This function behaves like std::string::substr, except that the sequence
+   * and qualities are truncated in place, without re-allocating buffers.
    */
   void truncate(size_t pos = 0, size_t len = std::string::npos);
 
@@ -152,6 +153,15 @@ public:
    */
   bool read_unsafe(line_reader_base& reader);
 
+  /**
+   * Reads the next FASTQ record located by a tokenizer.
+   *
+   * This is equivalent to `read_unsafe` for line readers, but re-uses the
+   * buffers of this record. `post_process` *must* be called before using bases
+   * or quality scores.
+   */
+  bool read_unsafe(fastq_tokenizer& tokenizer);
+
   /**
    * Finalizes read, validates sequence and transforms qualities. This function
    * *must* be called for all reads produced by calling `read_unsafe`.
@@ -182,13 +192,50 @@ public:
                                     char mate_separator = MATE_SEPARATOR);
 
 private:
+  //! The first base kept and the end of the bases kept when trimming a read
+  typedef std::pair<size_t, size_t> kept_bases;
+
   /**
    * Converting lower-case nucleotides to uppercase.
    *
    * If the sequence contains letters other than "acgtnACGTN.", a fastq_error
    * is thrown.
    **/
-  static void clean_sequence(std::string& sequence);
+  static void clean_sequence(char* sequence, size_t length);
+
+  /** Locates the bases kept by 'trim_trailing_bases'. */
+  static kept_bases trailing_bases(const char* sequence,
+                                   const char* qualities,
+                                   size_t length,
+                                   bool trim_ns,
+                                   char low_quality,
+                                   bool preserve5p);
+
+  /** Locates the bases kept by 'trim_windowed_bases'. */
+  static kept_bases windowed_bases(const char* sequence,
+                                   const char* qualities,
+                                   size_t length,
+                                   bool trim_ns,
+                                   char low_quality,
+                                   double window_size,
+                                   bool preserve5p);
+
+  /** Reverse complements a sequence and reverses its qualities in place. */
+  static void reverse_complement(char* sequence,
+                                 char* qualities,
+                                 size_t length);
+
+  /**
+   * Validates the headers of a pair of reads with sequences of the given
+   * lengths; see 'validate_paired_reads'. Headers are modified in place.
+   */
+  static void validate_paired_reads(char* header_1,
+                                    size_t header_length_1,
+                                    size_t length_1,
+                                    char* header_2,
+                                    size_t header_length_2,
+                                    size_t length_2,
+                                    char mate_separator);
 
   /**
    * Trims the read to the specified bases, and returns a pair specifying the
@@ -197,9 +244,6 @@ private:
   ntrimmed trim_sequence_and_qualities(const size_t left_inclusive,
                                        const size_t right_exclusive);
 
-  /** Helper function to get mate numbering and fix the separator char. */
-  friend mate_info get_and_fix_mate_info(fastq& read, char mate_separator);
-
   //! Header excluding the @ sigil, but (possibly) including meta-info
   std::string m_header;
   //! Nucleotide sequence; contains only uppercase letters "ACGTN"
@@ -209,6 +253,82 @@ private:
 
   //! Needs access to merge sequence/qualities to in-place
   friend class sequence_merger;
+  //! Processes records stored in arenas using the helper functions above
+  friend class read_batch;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Locates FASTQ records in a block of text consisting of complete records.
+ *
+ * The newlines of the entire text are located up front (see `find_newlines`),
+ * after which the header, sequence, separator, and quality lines of all
+ * records are located and validated in a single pass. Empty lines preceding
+ * records and terminal carriage returns are ignored, as in `read_unsafe` for
+ * line readers, and the same errors are reported for malformed records.
+ */
+class fastq_tokenizer
+{
+public:
+  /** Tokenizes 'text', which must outlive the tokenizer. */
+  explicit fastq_tokenizer(const std::string& text);
+
+  /**
+   * Assigns the fields of the next record, returning false if no records
+   * remain. Throws fastq_error when the first malformed record is reached.
+   */
+  bool next(std::string& header,
+            std::string& sequence,
+            std::string& qualities);
+
+  /**
+   * Appends the next record to a batch, without decoding it, returning false
+   * if no records remain. Throws fastq_error like 'next' above.
+   */
+  bool next(read_batch& dst);
+
+  /** Returns the number of lines consumed, including those of bad records. */
+  size_t lines() const;
+
+private:
+  /** Locates records using 'm_newlines'; throws fastq_error on bad records. */
+  void tokenize();
+
+  /** Offsets of the lines of a FASTQ record; the header excludes the '@' */
+  struct record
+  {
+    //! Offset of the header
+    size_t header;
+    //! Length of the header
+    size_t header_length;
+    //! Offset of the sequence
+    size_t sequence;
+    //! Offset of the qualities
+    size_t qualities;
+    //! Length of the sequence and of the qualities
+    size_t length;
+    //! Number of lines consumed up to and including this record
+    size_t lines;
+  };
+
+  /** Returns the next record, or nullptr; throws at the first bad record. */
+  const record* next_record();
+
+  //! The text being tokenized
+  const std::string& m_text;
+  //! Offsets of line terminators; includes the end of an unterminated line
+  std::vector<size_t> m_newlines;
+  //! Records located in the text, up to the first malformed record
+  std::vector<record> m_records;
+  //! Index of the next record returned by 'next'
+  size_t m_next;
+  //! Number of lines consumed by records returned by 'next'
+  size_t m_lines;
+  //! Number of lines consumed by 'tokenize', including those of bad records
+  size_t m_tokenized_lines;
+  //! Error message for the first malformed record, if any
+  std::string m_error;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -31,6 +31,10 @@
 #include "debug.hpp" // for AR_DEBUG_FAIL, AR_DEBUG_ASSERT
 #include "fastq_enc.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h> // for _mm256_cmpgt_epi8, _mm256_shuffle_epi8, ...
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////
 // fastq_error
 
@@ -241,16 +245,110 @@ fastq_encoding::fastq_encoding(quality_encoding encoding, char max_score)
 void
 fastq_encoding::encode(const std::string& qualities, std::string& dst)
 {
-  dst.append(qualities);
+  encode(qualities.data(), qualities.size(), dst);
+}
+
+void
+fastq_encoding::encode(const char* qualities, size_t length, std::string& dst)
+{
+  dst.append(qualities, length);
+}
+
+#if defined(__AVX2__)
+/**
+ * Validates and decodes qualities 32 at a time, returning the number of
+ * qualities decoded. Decoding stops at the first block containing invalid
+ * scores, leaving that block for the scalar loop, which produces the error
+ * message for the first invalid score.
+ */
+size_t
+decode_avx2(char* qualities,
+            size_t length,
+            quality_encoding encoding,
+            char min_score,
+            char max_score)
+{
+  // Scores are compared as signed bytes, so non-ASCII values are out of range
+  const __m256i lower_bound = _mm256_set1_epi8(min_score - 1);
+  const __m256i upper_bound = _mm256_set1_epi8(max_score + 1);
+  const __m256i offset = _mm256_set1_epi8(PHRED_OFFSET_64 - PHRED_OFFSET_33);
+
+  // Solexa scores -5 to 10 are converted via a lookup table, since the
+  // conversion is the identity for higher scores; pshufb looks up values per
+  // 128 bit lane, so the table is duplicated in both lanes.
+  const __m128i solexa_scores =
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_solexa_to_phred.data()));
+  const __m256i solexa_table =
+    _mm256_add_epi8(_mm256_broadcastsi128_si256(solexa_scores),
+                    _mm256_set1_epi8(PHRED_OFFSET_33));
+  const __m256i solexa_table_size = _mm256_set1_epi8(16);
+  const __m256i solexa_min = _mm256_set1_epi8(';');
+
+  size_t i = 0;
+  for (; length - i >= 32; i += 32) {
+    __m256i* ptr = reinterpret_cast<__m256i*>(qualities + i);
+    const __m256i value = _mm256_loadu_si256(ptr);
+
+    const __m256i valid =
+      _mm256_and_si256(_mm256_cmpgt_epi8(value, lower_bound),
+                       _mm256_cmpgt_epi8(upper_bound, value));
+    if (_mm256_movemask_epi8(valid) != -1) {
+      break;
+    }
+
+    switch (encoding) {
+      case quality_encoding::phred_33:
+        // Already Phred+33 encoded; only validation is required
+        break;
+
+      case quality_encoding::phred_64:
+        _mm256_storeu_si256(ptr, _mm256_sub_epi8(value, offset));
+        break;
+
+      case quality_encoding::solexa: {
+        const __m256i index = _mm256_sub_epi8(value, solexa_min);
+        const __m256i in_table = _mm256_cmpgt_epi8(solexa_table_size, index);
+        const __m256i decoded =
+          _mm256_blendv_epi8(_mm256_sub_epi8(value, offset),
+                             _mm256_shuffle_epi8(solexa_table, index),
+                             in_table);
+
+        _mm256_storeu_si256(ptr, decoded);
+        break;
+      }
+
+      default:
+        AR_DEBUG_FAIL("unknown encoding");
+    }
+  }
+
+  return i;
 }
+#endif
 
 void
 fastq_encoding::decode(std::string& qualities) const
+{
+  decode(&qualities[0], qualities.size());
+}
+
+void
+fastq_encoding::decode(char* qualities, size_t length) const
 {
   const char max_score = m_offset + m_max_score;
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  if (m_encoding == quality_encoding::solexa) {
+    i = decode_avx2(qualities, length, m_encoding, ';', max_score);
+  } else {
+    i = decode_avx2(qualities, length, m_encoding, m_offset, max_score);
+  }
+#endif
 
   if (m_encoding == quality_encoding::solexa) {
-    for (auto& quality : qualities) {
+    for (; i < length; ++i) {
+      char& quality = qualities[i];
       if (quality < ';' || quality > max_score) {
         invalid_solexa(m_max_score, quality);
       }
@@ -258,7 +356,8 @@ fastq_encoding::decode(std::string& qualities) const
       quality = g_solexa_to_phred.at(quality - ';') + PHRED_OFFSET_33;
     }
   } else {
-    for (auto& quality : qualities) {
+    for (; i < length; ++i) {
+      char& quality = qualities[i];
       if (quality < m_offset || quality > max_score) {
         if (m_offset == 33) {
           invalid_phred_33(m_max_score, quality);
@@ -86,8 +86,12 @@ public:
 
   /** Appends Phred+33 encoded qualities to dst. */
   static void encode(const std::string& qualities, std::string& dst);
+  /** Appends 'length' Phred+33 encoded qualities to dst. */
+  static void encode(const char* qualities, size_t length, std::string& dst);
   /** Decodes a string of ASCII values in-place. */
   void decode(std::string& qualities) const;
+  /** Decodes 'length' ASCII values in-place. */
+  void decode(char* qualities, size_t length) const;
 
 protected:
   //! Quality score encoding expected when decoding data
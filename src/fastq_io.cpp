@@ -24,8 +24,11 @@
 
 #include <algorithm> // for max, min
 #include <cerrno>    // for errno
-#include <cstring>   // for size_t, strerror, memcpy
+#include <chrono>    // for steady_clock, duration
+#include <cstring>   // for size_t, strerror, memcpy, memchr
+#include <fstream>   // for ofstream
 #include <iostream>  // for operator<<, basic_ostream, char_traits, endl
+#include <sstream>   // for stringstream
 #include <utility>   // for move, swap
 
 #ifdef USE_LIBDEFLATE
@@ -33,19 +36,23 @@
 #endif
 
 #include "debug.hpp"     // for AR_DEBUG_ASSERT, AR_DEBUG_LOCK
-#include "fastq.hpp"     // for fastq
+#include "fastq.hpp"     // for fastq, fastq_tokenizer
 #include "fastq_enc.hpp" // for fastq_error
 #include "fastq_io.hpp"
+#include "linereader.hpp" // for bgzf_decompress, gzip_error
 #include "statistics.hpp" // for fastq_statistics
-#include "strutils.hpp"   // for cli_formatter
+#include "strutils.hpp"   // for cli_formatter, find_newlines
 #include "threads.hpp"    // for thread_error, print_locker, thread_abort
 #include "userconfig.hpp" // for userconfig
 
 ///////////////////////////////////////////////////////////////////////////////
 // Helper functions for 'zlib'
 
+/** Initializes a gzip stream, or a raw deflate stream if window_bits < 0. */
 void
-checked_deflate_init2(z_streamp stream, unsigned int level)
+checked_deflate_init2(z_streamp stream,
+                      unsigned int level,
+                      int window_bits = 15 + 16)
 {
   AR_DEBUG_ASSERT(stream);
   stream->zalloc = nullptr;
@@ -55,7 +62,7 @@ checked_deflate_init2(z_streamp stream, unsigned int level)
   const int errorcode = deflateInit2(/* strm       = */ stream,
                                      /* level      = */ level,
                                      /* method     = */ Z_DEFLATED,
-                                     /* windowBits = */ 15 + 16,
+                                     /* windowBits = */ window_bits,
                                      /* memLevel   = */ 8,
                                      /* strategy   = */ Z_DEFAULT_STRATEGY);
 
@@ -120,13 +127,186 @@ checked_deflate_end(z_streamp stream)
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'fastq_read_chunk'
 
+//! Number of chunks of each type kept for re-use; see 'set_chunk_pool_size'
+size_t g_chunk_pool_size = 8;
+
+/**
+ * Returns a chunk to the pool for re-use, unless the pool is full or the
+ * chunk uses an unusual amount of memory, in which case it is freed.
+ */
+template<typename T>
+void
+release_chunk(chunk_pool<T>& pool, std::unique_ptr<T>& chunk)
+{
+  if (chunk->memory_usage() <= POOLED_CHUNK_SIZE_MAX) {
+    pool.release(chunk, g_chunk_pool_size);
+  } else {
+    chunk.reset();
+  }
+}
+
+void
+set_chunk_pool_size(size_t n)
+{
+  g_chunk_pool_size = n;
+}
+
 fastq_read_chunk::fastq_read_chunk(bool eof_)
   : eof(eof_)
   , nucleotides()
+  , sizer(nullptr)
+  , stage(0)
+  , started()
+  , elapsed()
   , reads_1()
   , reads_2()
 {}
 
+//! Pool of read chunks that are no longer in use
+chunk_pool<fastq_read_chunk> g_read_chunk_pool;
+
+read_chunk_ptr
+fastq_read_chunk::acquire()
+{
+  read_chunk_ptr chunk = g_read_chunk_pool.try_acquire();
+  if (chunk) {
+    chunk->eof = false;
+    chunk->nucleotides = 0;
+    chunk->sizer = nullptr;
+    chunk->stage = 0;
+    chunk->started = std::chrono::steady_clock::time_point();
+    chunk->elapsed = std::chrono::steady_clock::duration();
+    chunk->reads_1.clear();
+    chunk->reads_2.clear();
+  } else {
+    chunk.reset(new fastq_read_chunk());
+  }
+
+  return chunk;
+}
+
+void
+fastq_read_chunk::release(read_chunk_ptr& chunk)
+{
+  if (chunk->sizer) {
+    chunk->end_processing();
+    chunk->sizer->record(chunk->stage, chunk->nucleotides, chunk->elapsed);
+  }
+
+  release_chunk(g_read_chunk_pool, chunk);
+}
+
+void
+fastq_read_chunk::begin_processing()
+{
+  if (sizer) {
+    started = std::chrono::steady_clock::now();
+  }
+}
+
+void
+fastq_read_chunk::end_processing()
+{
+  if (started != std::chrono::steady_clock::time_point()) {
+    elapsed += std::chrono::steady_clock::now() - started;
+    started = std::chrono::steady_clock::time_point();
+  }
+}
+
+void
+fastq_read_chunk::inherit_sizer(const fastq_read_chunk& source)
+{
+  sizer = source.sizer;
+  stage = source.stage + 1;
+}
+
+size_t
+fastq_read_chunk::memory_usage() const
+{
+  return reads_1.memory_usage() + reads_2.memory_usage();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'chunk_sizer'
+
+chunk_sizer::chunk_sizer()
+  : m_lock()
+  , m_ns_per_nucleotide()
+  , m_size(INPUT_CHUNK_SIZE)
+  , m_statistics()
+{}
+
+size_t
+chunk_sizer::next_size()
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  if (!m_statistics.chunks++) {
+    m_statistics.minimum = m_size;
+    m_statistics.maximum = m_size;
+  } else {
+    m_statistics.minimum = std::min(m_statistics.minimum, m_size);
+    m_statistics.maximum = std::max(m_statistics.maximum, m_size);
+  }
+
+  m_statistics.last = m_size;
+
+  return m_size;
+}
+
+void
+chunk_sizer::record(size_t stage,
+                    size_t nucleotides,
+                    std::chrono::steady_clock::duration elapsed)
+{
+  typedef std::chrono::duration<double, std::nano> nanoseconds;
+  if (!nucleotides) {
+    return;
+  }
+
+  const double sample = nanoseconds(elapsed).count() / nucleotides;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  if (m_ns_per_nucleotide.size() <= stage) {
+    m_ns_per_nucleotide.resize(stage + 1);
+  }
+
+  double& average = m_ns_per_nucleotide.at(stage);
+  if (average > 0) {
+    // Smooth out variation caused by e.g. other threads competing for the CPU
+    average = 0.75 * average + 0.25 * sample;
+  } else {
+    average = sample;
+  }
+
+  double ns_per_nucleotide = 0;
+  for (const auto value : m_ns_per_nucleotide) {
+    ns_per_nucleotide += value;
+  }
+
+  if (ns_per_nucleotide > 0) {
+    const double target =
+      nanoseconds(INPUT_CHUNK_TIME).count() / ns_per_nucleotide;
+
+    // Sizes change by at most a factor of two per chunk, and are rounded to
+    // multiples of INPUT_CHUNK_SIZE_MIN to avoid needless changes in size
+    const double size = std::max(m_size / 2.0, std::min(target, m_size * 2.0));
+    const size_t rounded = static_cast<size_t>(size) / INPUT_CHUNK_SIZE_MIN;
+
+    m_size = std::max(INPUT_CHUNK_SIZE_MIN,
+                      std::min(INPUT_CHUNK_SIZE_MAX,
+                               rounded * INPUT_CHUNK_SIZE_MIN));
+  }
+}
+
+chunk_size_statistics
+chunk_sizer::statistics() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  return m_statistics;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'fastq_output_chunk'
 
@@ -137,119 +317,817 @@ fastq_output_chunk::fastq_output_chunk(bool eof_)
   , buffers()
 {}
 
+//! Pool of output chunks that are no longer in use
+chunk_pool<fastq_output_chunk> g_output_chunk_pool;
+
+output_chunk_ptr
+fastq_output_chunk::acquire(bool eof_)
+{
+  output_chunk_ptr chunk = g_output_chunk_pool.try_acquire();
+  if (chunk) {
+    chunk->eof = eof_;
+    chunk->nucleotides = 0;
+    chunk->reads.clear();
+    chunk->buffers.clear();
+  } else {
+    chunk.reset(new fastq_output_chunk(eof_));
+  }
+
+  return chunk;
+}
+
+void
+fastq_output_chunk::release(output_chunk_ptr& chunk)
+{
+  // Compressed blocks are not re-used and are freed right away
+  chunk->buffers.clear();
+
+  release_chunk(g_output_chunk_pool, chunk);
+}
+
 void
-fastq_output_chunk::add(const fastq& read)
+fastq_output_chunk::add(const read_batch& batch, size_t nth)
 {
-  nucleotides += read.length();
-  read.into_string(reads);
+  nucleotides += batch.length(nth);
+  batch.into_string(nth, reads);
+}
+
+size_t
+fastq_output_chunk::memory_usage() const
+{
+  size_t usage = reads.capacity();
+  for (const auto& buffer : buffers) {
+    usage += buffer.first;
+  }
+
+  return usage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'fastq_block_chunk'
+
+fastq_block::fastq_block()
+  : data()
+  , format(block_format::text)
+  , raw_size(0)
+  , buffer()
+  , filename()
+  , file_number(0)
+  , eof(false)
+  , prefix()
+  , line_offset(0)
+  , records()
+  , error()
+{}
+
+size_t
+fastq_block::memory_usage() const
+{
+  return data.capacity() + buffer.capacity() + prefix.capacity() +
+         records.memory_usage();
+}
+
+fastq_block_chunk::fastq_block_chunk()
+  : eof(false)
+  , mate_1()
+  , mate_2()
+{}
+
+//! Pool of block chunks that are no longer in use
+chunk_pool<fastq_block_chunk> g_block_chunk_pool;
+
+block_chunk_ptr
+fastq_block_chunk::acquire()
+{
+  block_chunk_ptr chunk = g_block_chunk_pool.try_acquire();
+  if (chunk) {
+    chunk->eof = false;
+  } else {
+    chunk.reset(new fastq_block_chunk());
+  }
+
+  return chunk;
+}
+
+void
+fastq_block_chunk::release(block_chunk_ptr& chunk)
+{
+  release_chunk(g_block_chunk_pool, chunk);
+}
+
+size_t
+fastq_block_chunk::memory_usage() const
+{
+  return mate_1.memory_usage() + mate_2.memory_usage();
+}
+
+fastq_block&
+fastq_block_chunk::block(read_type mate)
+{
+  switch (mate) {
+    case read_type::mate_1:
+      return mate_1;
+
+    case read_type::mate_2:
+      return mate_2;
+
+    default:
+      AR_DEBUG_FAIL("Invalid mate in fastq_block_chunk::block");
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'mate_balancer'
+
+mate_balancer::mate_balancer()
+  : m_lock()
+  , m_ratio(1.0)
+{}
+
+void
+mate_balancer::update(size_t bytes_1,
+                      size_t records_1,
+                      size_t bytes_2,
+                      size_t records_2)
+{
+  if (bytes_1 && records_1 && bytes_2 && records_2) {
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_ratio = (static_cast<double>(bytes_2) / records_2) /
+              (static_cast<double>(bytes_1) / records_1);
+  }
+}
+
+double
+mate_balancer::ratio() const
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  return m_ratio;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'read_fastq'
 
-bool
-read_record(joined_line_readers& reader,
-            fastq_vec* chunk,
-            fastq& record,
-            size_t& n_nucleotides)
+/** Reads a block from 'reader', returning the (raw) size. */
+size_t
+read_block(joined_line_readers& reader, fastq_block& block, size_t size)
+{
+  const size_t nread = reader.read_block(block.data, size, block.format);
+  block.raw_size = nread;
+  block.filename = reader.filename();
+  block.file_number = reader.file_number();
+  block.eof = !nread;
+
+  return nread;
+}
+
+read_fastq::read_fastq(const userconfig& config,
+                       const block_step_id& next_step,
+                       const mate_balancer& balancer)
+  : analytical_step(processing_order::ordered_io)
+  , m_filenames(config.input_files_1)
+  , m_io_input_1(config.input_files_1)
+  , m_io_input_2(config.input_files_2)
+  , m_next_step(next_step)
+  , m_balancer(balancer)
+  , m_bytes_1(0)
+  , m_bytes_2(0)
+  , m_eof_2(false)
+  , m_eof(false)
+  , m_lock()
+{
+  AR_DEBUG_ASSERT(config.input_files_2.empty() ||
+                  config.input_files_1.size() == config.input_files_2.size());
+
+  m_filenames.insert(m_filenames.end(),
+                     config.input_files_2.begin(),
+                     config.input_files_2.end());
+}
+
+chunk_vec
+read_fastq::process(analytical_chunk* chunk)
+{
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(chunk == nullptr);
+  if (m_eof) {
+    return chunk_vec();
+  }
+
+  block_chunk_ptr file_chunk = fastq_block_chunk::acquire();
+  fastq_block& mate_1 = file_chunk->mate_1;
+  fastq_block& mate_2 = file_chunk->mate_2;
+
+  m_bytes_1 += read_block(m_io_input_1, mate_1, INPUT_READ_SIZE);
+
+  // Mate 2 data is read such that the number of mate 2 records read matches
+  // the number of mate 1 records read, based on the mean size of records
+  size_t size_2 = INPUT_READ_SIZE;
+  if (!mate_1.eof) {
+    const double target = m_bytes_1 * m_balancer.ratio();
+    size_2 = std::min<double>(std::max<double>(0, target - m_bytes_2),
+                              INPUT_READ_SIZE * 4);
+  }
+
+  // Single-end and interleaved input have no mate 2 files, and thus no data
+  if (size_2 && !m_eof_2) {
+    m_bytes_2 += read_block(m_io_input_2, mate_2, size_2);
+    m_eof_2 = mate_2.eof;
+  } else {
+    mate_2.data.clear();
+    mate_2.format = block_format::text;
+    mate_2.raw_size = 0;
+    mate_2.eof = m_eof_2;
+  }
+
+  m_eof = mate_1.eof && mate_2.eof;
+  file_chunk->eof = m_eof;
+
+  chunk_vec chunks;
+  push_chunk(chunks, m_next_step, std::move(file_chunk));
+
+  return chunks;
+}
+
+void
+read_fastq::finalize()
+{
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(m_eof);
+}
+
+string_vec
+read_fastq::io_filenames() const
+{
+  return m_filenames;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'gunzip_fastq'
+
+/**
+ * Replaces the (compressed) data of a block with the decompressed data in the
+ * block's buffer. The buffer is released afterwards, so that blocks in flight
+ * or pooled do not hold on to both the compressed and decompressed data.
+ */
+void
+swap_decompressed(fastq_block& block)
+{
+  block.data.swap(block.buffer);
+  block.format = block_format::text;
+
+  std::string().swap(block.buffer);
+}
+
+/**
+ * Decompresses a block belonging to the gzip stream in 'stream', which was
+ * started for the file identified by 'file_number'. A new stream is started if
+ * 'stream' is not set, and the current stream is finished once a block from
+ * another file, or the EOF block, is encountered.
+ */
+void
+gunzip_block(fastq_block& block,
+             std::unique_ptr<gzip_inflater>& stream,
+             size_t& file_number)
 {
   try {
-    if (record.read_unsafe(reader)) {
-      chunk->push_back(record);
-      n_nucleotides += record.length();
+    // Blocks never span files, so a stream must end with the last block read
+    if (stream && (block.eof || (!block.data.empty() &&
+                                 block.file_number != file_number))) {
+      stream->finish();
+      stream.reset();
+    }
 
-      return true;
-    } else {
-      return false;
+    if (block.format == block_format::gzip) {
+      if (!stream) {
+        stream.reset(new gzip_inflater());
+        file_number = block.file_number;
+      }
+
+      // The buffer is grown as needed, starting from the size of the input
+      std::string& dst = block.buffer;
+      dst.resize(std::max<size_t>(block.data.size(), INPUT_READ_SIZE));
+
+      size_t size = 0;
+      stream->set_input(block.data.data(), block.data.size());
+      while (true) {
+        if (size == dst.size()) {
+          dst.resize(size * 2);
+        }
+
+        size += stream->inflate(&dst.at(size), dst.size() - size);
+        if (size < dst.size() && stream->needs_input()) {
+          break;
+        }
+      }
+
+      dst.resize(size);
+      swap_decompressed(block);
     }
-  } catch (const fastq_error& error) {
+  } catch (const gzip_error& error) {
     print_locker lock;
-    std::cerr << "Error reading FASTQ record from '" << reader.filename()
-              << "' at line " << reader.linenumber() << "; aborting:\n"
+    std::cerr << "Error decompressing '" << block.filename << "'; aborting:\n"
               << cli_formatter::fmt(error.what()) << std::endl;
 
     throw thread_abort();
   }
 }
 
-read_fastq::read_fastq(const userconfig& config, size_t next_step)
-  : analytical_step(processing_order::ordered_io)
-  , m_io_input_1_base(config.input_files_1)
-  , m_io_input_2_base(config.input_files_2)
-  , m_io_input_1(&m_io_input_1_base)
-  , m_io_input_2(&m_io_input_2_base)
+gunzip_fastq::gunzip_fastq(read_type mate, const block_step_id& next_step)
+  : typed_step(processing_order::ordered)
+  , m_mate(mate)
   , m_next_step(next_step)
-  , m_single_end(false)
+  , m_stream()
+  , m_file_number(0)
   , m_eof(false)
-  , m_timer("reads")
   , m_lock()
+{}
+
+chunk_vec
+gunzip_fastq::process_chunk(block_chunk_ptr chunk)
 {
-  if (config.interleaved_input) {
-    AR_DEBUG_ASSERT(config.input_files_2.empty());
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(!m_eof);
+
+  gunzip_block(chunk->block(m_mate), m_stream, m_file_number);
+  m_eof = chunk->eof;
+
+  chunk_vec chunks;
+  push_chunk(chunks, m_next_step, std::move(chunk));
+
+  return chunks;
+}
 
-    m_io_input_2 = &m_io_input_1_base;
-  } else if (config.input_files_2.empty()) {
-    m_io_input_2 = &m_io_input_1_base;
-    m_single_end = true;
+void
+gunzip_fastq::finalize()
+{
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(m_eof);
+  AR_DEBUG_ASSERT(!m_stream);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'gunzip_split_fastq'
+
+gunzip_split_fastq::gunzip_split_fastq(const block_step_id& next_step)
+  : typed_step(processing_order::unordered)
+  , m_next_step(next_step)
+{}
+
+chunk_vec
+gunzip_split_fastq::process_chunk(block_chunk_ptr chunk)
+{
+  fastq_block* blocks[] = { &chunk->mate_1, &chunk->mate_2 };
+  for (auto block : blocks) {
+    if (block->format == block_format::bgzf) {
+      try {
+        bgzf_decompress(block->data, block->buffer);
+      } catch (const gzip_error& error) {
+        print_locker lock;
+        std::cerr << "Error decompressing '" << block->filename
+                  << "'; aborting:\n"
+                  << cli_formatter::fmt(error.what()) << std::endl;
+
+        throw thread_abort();
+      }
+
+      swap_decompressed(*block);
+    }
+  }
+
+  chunk_vec chunks;
+  push_chunk(chunks, m_next_step, std::move(chunk));
+
+  return chunks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'fastq_delimiter'
+
+/** Formats an error message for a malformed record at the given line. */
+std::string
+format_record_error(const std::string& filename,
+                    size_t line,
+                    const fastq_error& error)
+{
+  std::stringstream stream;
+  stream << "Error reading FASTQ record from '" << filename << "' at line "
+         << line << "; aborting:\n"
+         << cli_formatter::fmt(error.what());
+
+  return stream.str();
+}
+
+/**
+ * Parses the records in 'text', read from 'filename' following 'lines' lines,
+ * and appends them to the records of the block after validating and decoding
+ * them (see 'fastq::post_process'). Parsing stops at the first malformed
+ * record, for which an error message is saved in the block.
+ */
+void
+parse_records(const std::string& text,
+              const std::string& filename,
+              size_t lines,
+              const fastq_encoding& encoding,
+              fastq_block& block)
+{
+  fastq_tokenizer tokenizer(text);
+
+  read_batch& records = block.records;
+
+  while (true) {
+    // Records are copied straight into the arenas of the block
+    try {
+      if (!tokenizer.next(records)) {
+        break;
+      }
+    } catch (const fastq_error& error) {
+      block.error =
+        format_record_error(filename, lines + tokenizer.lines() + 1, error);
+      break;
+    }
+
+    try {
+      records.post_process(records.size() - 1, encoding);
+    } catch (const fastq_error& error) {
+      // Reported at the header of the record, which spans four lines
+      block.error =
+        format_record_error(filename, lines + tokenizer.lines() - 3, error);
+      records.pop_back();
+      break;
+    }
+  }
+}
+
+/** Returns true if the line is empty, not counting a terminal \r. */
+bool
+is_blank_line(const char* start, const char* end)
+{
+  return end == start || (end - start == 1 && *start == '\r');
+}
+
+fastq_delimiter::fastq_delimiter(const fastq_encoding& encoding)
+  : m_encoding(encoding)
+  , m_carry()
+  , m_filename()
+  , m_file_number(0)
+  , m_lines(0)
+  , m_newlines()
+{}
+
+void
+fastq_delimiter::delimit(fastq_block& block)
+{
+  AR_DEBUG_ASSERT(block.format == block_format::text);
+  AR_DEBUG_ASSERT(block.records.empty());
+  block.prefix.clear();
+  block.error.clear();
+
+  if (block.eof ||
+      (!block.data.empty() && block.file_number != m_file_number)) {
+    // Records never span files, so the previous file must end with the
+    // carried over text; this is at most one record and is parsed right away
+    parse_records(m_carry, m_filename, m_lines, m_encoding, block);
+
+    m_carry.clear();
+    m_filename = block.filename;
+    m_file_number = block.file_number;
+    m_lines = 0;
+  }
+
+  if (block.data.empty()) {
+    return;
+  }
+
+  // Records consist of four lines, optionally preceded by empty lines (see
+  // 'fastq::read_unsafe'); the carried over text never contains a full record
+  size_t lines = 0;
+  size_t record_lines = 0;
+  const char* start = m_carry.data();
+  const char* const carry_end = m_carry.data() + m_carry.size();
+  while (const char* end = static_cast<const char*>(
+           memchr(start, '\n', carry_end - start))) {
+    if (record_lines || !is_blank_line(start, end)) {
+      record_lines++;
+    }
+
+    lines++;
+    start = end + 1;
+  }
+
+  // The partial line at the end of the carried over text, if any
+  const char* partial = start;
+
+  m_newlines.clear();
+  find_newlines(block.data.data(), block.data.size(), m_newlines);
+
+  size_t boundary = 0;
+  size_t boundary_lines = 0;
+  start = block.data.data();
+  for (const size_t newline : m_newlines) {
+    const char* end = block.data.data() + newline;
+    bool blank = is_blank_line(start, end);
+    if (partial != carry_end) {
+      blank = (start == end) && is_blank_line(partial, carry_end);
+      partial = carry_end;
+    }
+
+    lines++;
+    if ((record_lines || !blank) && ++record_lines == 4) {
+      record_lines = 0;
+      boundary = end + 1 - block.data.data();
+      boundary_lines = lines;
+    }
+
+    start = end + 1;
+  }
+
+  if (boundary) {
+    block.prefix.swap(m_carry);
+    m_carry.assign(block.data, boundary, std::string::npos);
+    block.data.resize(boundary);
+    block.line_offset = m_lines;
+
+    m_lines += boundary_lines;
   } else {
-    AR_DEBUG_ASSERT(config.input_files_1.size() == config.input_files_2.size());
+    // No complete records; everything is carried over to the next block
+    m_carry.append(block.data);
+    block.data.clear();
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'delimit_fastq'
+
+delimit_fastq::delimit_fastq(read_type mate,
+                             const fastq_encoding& encoding,
+                             const block_step_id& next_step)
+  : typed_step(processing_order::ordered)
+  , m_mate(mate)
+  , m_delimiter(encoding)
+  , m_next_step(next_step)
+  , m_eof(false)
+  , m_lock()
+{}
+
 chunk_vec
-read_fastq::process(analytical_chunk* chunk)
+delimit_fastq::process_chunk(block_chunk_ptr chunk)
 {
   AR_DEBUG_LOCK(m_lock);
-  AR_DEBUG_ASSERT(chunk == nullptr);
-  if (m_eof) {
-    return chunk_vec();
+  AR_DEBUG_ASSERT(!m_eof);
+
+  m_delimiter.delimit(chunk->block(m_mate));
+  m_eof = chunk->eof;
+
+  chunk_vec chunks;
+  push_chunk(chunks, m_next_step, std::move(chunk));
+
+  return chunks;
+}
+
+void
+delimit_fastq::finalize()
+{
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(m_eof);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'parse_fastq'
+
+parse_fastq::parse_fastq(const fastq_encoding& encoding,
+                         const block_step_id& next_step)
+  : typed_step(processing_order::unordered)
+  , m_encoding(encoding)
+  , m_next_step(next_step)
+{}
+
+chunk_vec
+parse_fastq::process_chunk(block_chunk_ptr chunk)
+{
+  fastq_block* blocks[] = { &chunk->mate_1, &chunk->mate_2 };
+  for (auto block : blocks) {
+    if (block->error.empty() && !block->data.empty()) {
+      if (!block->prefix.empty()) {
+        block->prefix.append(block->data);
+        block->data.swap(block->prefix);
+      }
+
+      parse_records(block->data,
+                    block->filename,
+                    block->line_offset,
+                    m_encoding,
+                    *block);
+    }
   }
 
-  read_chunk_ptr file_chunk(new fastq_read_chunk());
-  auto reads_1 = &file_chunk->reads_1;
-  auto reads_2 = m_single_end ? reads_1 : &file_chunk->reads_2;
+  chunk_vec chunks;
+  push_chunk(chunks, m_next_step, std::move(chunk));
+
+  return chunks;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'fastq_queue'
+
+fastq_queue::fastq_queue()
+  : m_filename()
+  , m_records()
+  , m_spare()
+  , m_next(0)
+  , m_total_records(0)
+  , m_total_bytes(0)
+  , m_eof(false)
+{}
+
+void
+fastq_queue::add(fastq_block& block)
+{
+  if (!block.error.empty()) {
+    print_locker lock;
+    std::cerr << block.error << std::endl;
+
+    throw thread_abort();
+  } else if (m_eof) {
+    AR_DEBUG_ASSERT(block.eof && block.records.empty());
+    return;
+  }
+
+  if (block.raw_size) {
+    m_filename = block.filename;
+  }
+
+  m_total_bytes += block.raw_size;
+  m_total_records += block.records.size();
+  if (m_next == m_records.size()) {
+    // All records have been taken, so the arenas of the block can be used
+    // as is; the old arenas are re-used by the (pooled) block instead
+    std::swap(m_records, block.records);
+  } else {
+    // Records that have not been taken are copied along with the new records
+    m_spare.clear();
+    for (size_t i = m_next; i < m_records.size(); ++i) {
+      m_spare.add(m_records, i);
+    }
+
+    for (size_t i = 0; i < block.records.size(); ++i) {
+      m_spare.add(block.records, i);
+    }
+
+    std::swap(m_records, m_spare);
+  }
+
+  m_next = 0;
+  block.records.clear();
+  m_eof = block.eof;
+}
+
+size_t
+fastq_queue::available() const
+{
+  return m_records.size() - m_next;
+}
+
+size_t
+fastq_queue::take(read_batch& dst)
+{
+  AR_DEBUG_ASSERT(m_next < m_records.size());
+  dst.add(m_records, m_next);
+
+  return m_records.length(m_next++);
+}
+
+size_t
+fastq_queue::records() const
+{
+  return m_total_records;
+}
+
+size_t
+fastq_queue::bytes() const
+{
+  return m_total_bytes;
+}
+
+bool
+fastq_queue::eof() const
+{
+  return m_eof;
+}
+
+const std::string&
+fastq_queue::filename() const
+{
+  return m_filename;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'collect_fastq'
+
+collect_fastq::collect_fastq(const userconfig& config,
+                             const read_step_id& next_step)
+  : typed_step(processing_order::ordered)
+  , m_mate_1()
+  , m_mate_2()
+  , m_next_step(next_step)
+  , m_reads()
+  , m_chunk_size(0)
+  , m_chunk_sizer()
+  , m_balancer()
+  , m_paired(!config.input_files_2.empty())
+  , m_interleaved(config.interleaved_input)
+  , m_eof(false)
+  , m_timer("reads")
+  , m_lock()
+{
+  AR_DEBUG_ASSERT(!(m_paired && m_interleaved));
+}
+
+chunk_vec
+collect_fastq::process_chunk(block_chunk_ptr chunk)
+{
+  AR_DEBUG_LOCK(m_lock);
+  AR_DEBUG_ASSERT(!m_eof);
+  m_eof = chunk->eof;
+
+  m_mate_1.add(chunk->mate_1);
+  if (m_paired) {
+    m_mate_2.add(chunk->mate_2);
+  }
 
-  fastq record;
-  bool eof = false;
-  size_t n_nucleotides = 0;
-  while (n_nucleotides < INPUT_BLOCK_SIZE * 4 && !eof) {
-    eof = !read_record(*m_io_input_1, reads_1, record, n_nucleotides);
+  fastq_block_chunk::release(chunk);
 
-    bool eof_2 = !read_record(*m_io_input_2, reads_2, record, n_nucleotides);
+  chunk_vec chunks;
+  if (m_paired) {
+    m_balancer.update(m_mate_1.bytes(),
+                      m_mate_1.records(),
+                      m_mate_2.bytes(),
+                      m_mate_2.records());
+
+    while (m_mate_1.available() && m_mate_2.available()) {
+      auto& reads = current_reads();
+      reads.nucleotides += m_mate_1.take(reads.reads_1);
+      reads.nucleotides += m_mate_2.take(reads.reads_2);
+
+      if (reads.nucleotides >= m_chunk_size) {
+        push_reads(chunks, false);
+      }
+    }
 
-    if (eof && !eof_2) {
+    if (m_mate_1.eof() && m_mate_2.available()) {
       print_locker lock;
       std::cerr << "ERROR: More mate 2 reads than mate 1 reads found in '"
-                << m_io_input_1->filename() << "'; file may be truncated. "
+                << m_mate_1.filename() << "'; file may be truncated. "
                 << "Please fix before continuing." << std::endl;
 
       throw thread_abort();
-    } else if (eof_2 && !(eof || m_single_end)) {
+    } else if (m_mate_2.eof() && m_mate_1.available()) {
       print_locker lock;
       std::cerr << "ERROR: More mate 1 reads than mate 2 reads found in '"
-                << m_io_input_2->filename() << "'; file may be truncated. "
+                << m_mate_2.filename() << "'; file may be truncated. "
                 << "Please fix before continuing." << std::endl;
 
       throw thread_abort();
     }
+  } else if (m_interleaved) {
+    while (m_mate_1.available() >= 2) {
+      auto& reads = current_reads();
+      reads.nucleotides += m_mate_1.take(reads.reads_1);
+      reads.nucleotides += m_mate_1.take(reads.reads_2);
+
+      if (reads.nucleotides >= m_chunk_size) {
+        push_reads(chunks, false);
+      }
+    }
 
-    eof |= eof_2;
-  }
+    if (m_mate_1.eof() && m_mate_1.available()) {
+      print_locker lock;
+      std::cerr << "ERROR: More mate 1 reads than mate 2 reads found in '"
+                << m_mate_1.filename() << "'; file may be truncated. "
+                << "Please fix before continuing." << std::endl;
 
-  file_chunk->eof = eof;
-  m_eof = eof;
+      throw thread_abort();
+    }
+  } else {
+    while (m_mate_1.available()) {
+      auto& reads = current_reads();
+      reads.nucleotides += m_mate_1.take(reads.reads_1);
 
-  m_timer.increment(file_chunk->reads_1.size());
-  m_timer.increment(file_chunk->reads_2.size());
+      if (reads.nucleotides >= m_chunk_size) {
+        push_reads(chunks, false);
+      }
+    }
+  }
 
-  chunk_vec chunks;
-  chunks.emplace_back(m_next_step, std::move(file_chunk));
+  if (m_eof) {
+    push_reads(chunks, true);
+  }
 
   return chunks;
 }
 
 void
-read_fastq::finalize()
+collect_fastq::finalize()
 {
   AR_DEBUG_LOCK(m_lock);
   AR_DEBUG_ASSERT(m_eof);
@@ -257,46 +1135,88 @@ read_fastq::finalize()
   m_timer.finalize();
 }
 
+chunk_size_statistics
+collect_fastq::chunk_sizes() const
+{
+  return m_chunk_sizer.statistics();
+}
+
+const mate_balancer&
+collect_fastq::balancer() const
+{
+  return m_balancer;
+}
+
+fastq_read_chunk&
+collect_fastq::current_reads()
+{
+  if (!m_reads) {
+    m_reads = fastq_read_chunk::acquire();
+
+    m_chunk_size = m_chunk_sizer.next_size();
+  }
+
+  return *m_reads;
+}
+
+void
+collect_fastq::push_reads(chunk_vec& chunks, bool eof)
+{
+  auto& reads = current_reads();
+  reads.eof = eof;
+  reads.sizer = &m_chunk_sizer;
+
+  m_timer.increment(reads.reads_1.size());
+  m_timer.increment(reads.reads_2.size());
+
+  push_chunk(chunks, m_next_step, std::move(m_reads));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'post_process_fastq'
 
-post_process_fastq::post_process_fastq(const fastq_encoding& encoding,
-                                       size_t next_step,
-                                       ar_statistics* statistics)
-  : analytical_step(processing_order::ordered)
-  , m_encoding(encoding)
-  , m_statistics_1(statistics ? &statistics->input_1 : nullptr)
-  , m_statistics_2(statistics ? &statistics->input_2 : nullptr)
+post_process_fastq::post_process_fastq(const userconfig& config,
+                                       const read_step_id& next_step,
+                                       ar_statistics& statistics)
+  : typed_step(processing_order::unordered)
+  , m_stats_1()
+  , m_stats_2()
+  , m_statistics_1(&statistics.input_1)
+  , m_statistics_2(&statistics.input_2)
   , m_next_step(next_step)
-  , m_eof(false)
-  , m_lock()
-{}
+{
+  for (size_t i = 0; i < config.max_threads; ++i) {
+    m_stats_1.emplace_back(config.report_sample_rate);
+    m_stats_2.emplace_back(config.report_sample_rate);
+  }
+}
 
 chunk_vec
-post_process_fastq::process(analytical_chunk* chunk)
+post_process_fastq::process_chunk(read_chunk_ptr file_chunk)
 {
-  read_chunk_ptr file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
-  AR_DEBUG_ASSERT(!m_eof);
-  AR_DEBUG_LOCK(m_lock);
+  file_chunk->begin_processing();
 
-  m_eof = file_chunk->eof;
-
-  for (auto& read : file_chunk->reads_1) {
-    read.post_process(m_encoding);
-    if (m_statistics_1) {
-      m_statistics_1->process(read);
-    }
+  auto stats_1 = m_stats_1.acquire();
+  const read_batch& reads_1 = file_chunk->reads_1;
+  for (size_t i = 0; i < reads_1.size(); ++i) {
+    stats_1->process(reads_1, i);
   }
+  stats_1->flush();
 
-  for (auto& read : file_chunk->reads_2) {
-    read.post_process(m_encoding);
-    if (m_statistics_2) {
-      m_statistics_2->process(read);
-    }
+  auto stats_2 = m_stats_2.acquire();
+  const read_batch& reads_2 = file_chunk->reads_2;
+  for (size_t i = 0; i < reads_2.size(); ++i) {
+    stats_2->process(reads_2, i);
   }
+  stats_2->flush();
+
+  m_stats_1.release(stats_1);
+  m_stats_2.release(stats_2);
+
+  file_chunk->end_processing();
 
   chunk_vec chunks;
-  chunks.emplace_back(m_next_step, std::move(file_chunk));
+  push_chunk(chunks, m_next_step, std::move(file_chunk));
 
   return chunks;
 }
@@ -304,15 +1224,21 @@ post_process_fastq::process(analytical_chunk* chunk)
 void
 post_process_fastq::finalize()
 {
-  AR_DEBUG_LOCK(m_lock);
-  AR_DEBUG_ASSERT(m_eof);
+  while (!m_stats_1.empty()) {
+    *m_statistics_1 += *m_stats_1.acquire();
+  }
+
+  while (!m_stats_2.empty()) {
+    *m_statistics_2 += *m_stats_2.acquire();
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'gzip_fastq'
 
-gzip_fastq::gzip_fastq(const userconfig& config, size_t next_step)
-  : analytical_step(processing_order::ordered)
+gzip_fastq::gzip_fastq(const userconfig& config,
+                       const output_step_id& next_step)
+  : typed_step(processing_order::ordered)
   , m_next_step(next_step)
   , m_stream()
   , m_eof(false)
@@ -331,10 +1257,8 @@ gzip_fastq::finalize()
 }
 
 chunk_vec
-gzip_fastq::process(analytical_chunk* chunk)
+gzip_fastq::process_chunk(output_chunk_ptr file_chunk)
 {
-  output_chunk_ptr file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
-
   AR_DEBUG_LOCK(m_lock);
   AR_DEBUG_ASSERT(!m_eof);
 
@@ -369,7 +1293,7 @@ gzip_fastq::process(analytical_chunk* chunk)
 
   chunk_vec chunks;
   if (!file_chunk->buffers.empty() || m_eof) {
-    chunks.emplace_back(m_next_step, std::move(file_chunk));
+    push_chunk(chunks, m_next_step, std::move(file_chunk));
   }
 
   return chunks;
@@ -378,8 +1302,8 @@ gzip_fastq::process(analytical_chunk* chunk)
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'split_fastq'
 
-split_fastq::split_fastq(size_t next_step)
-  : analytical_step(processing_order::ordered)
+split_fastq::split_fastq(const output_step_id& next_step)
+  : typed_step(processing_order::ordered)
   , m_next_step(next_step)
   , m_buffer(new unsigned char[GZIP_BLOCK_SIZE])
   , m_offset()
@@ -397,10 +1321,8 @@ split_fastq::finalize()
 }
 
 chunk_vec
-split_fastq::process(analytical_chunk* chunk)
+split_fastq::process_chunk(output_chunk_ptr file_chunk)
 {
-  output_chunk_ptr file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
-
   AR_DEBUG_LOCK(m_lock);
   AR_DEBUG_ASSERT(!m_eof);
   m_eof = file_chunk->eof;
@@ -416,10 +1338,10 @@ split_fastq::process(analytical_chunk* chunk)
     m_offset += n;
 
     if (m_offset == GZIP_BLOCK_SIZE) {
-      output_chunk_ptr block(new fastq_output_chunk());
+      output_chunk_ptr block = fastq_output_chunk::acquire();
       block->buffers.emplace_back(GZIP_BLOCK_SIZE, std::move(m_buffer));
 
-      chunks.emplace_back(m_next_step, std::move(block));
+      push_chunk(chunks, m_next_step, std::move(block));
 
       m_buffer.reset(new unsigned char[GZIP_BLOCK_SIZE]);
       m_offset = 0;
@@ -427,30 +1349,56 @@ split_fastq::process(analytical_chunk* chunk)
   }
 
   if (m_eof) {
-    output_chunk_ptr block(new fastq_output_chunk(true));
+    output_chunk_ptr block = fastq_output_chunk::acquire(true);
     block->buffers.emplace_back(m_offset, std::move(m_buffer));
-    chunks.emplace_back(m_next_step, std::move(block));
+    push_chunk(chunks, m_next_step, std::move(block));
 
     m_offset = 0;
   }
 
+  fastq_output_chunk::release(file_chunk);
+
   return chunks;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'gzip_split_fastq'
 
-gzip_split_fastq::gzip_split_fastq(const userconfig& config, size_t next_step)
-  : analytical_step(processing_order::unordered)
+//! Size of the BGZF header, including the 'BC' subfield
+const size_t BGZF_HEADER_SIZE = 18;
+//! Size of the BGZF header and of the gzip trailer (CRC32 and ISIZE)
+const size_t BGZF_OVERHEAD = BGZF_HEADER_SIZE + 8;
+//! BGZF header; the final two bytes (BSIZE) are set for each member
+const unsigned char BGZF_HEADER[BGZF_HEADER_SIZE] = {
+  0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0xff, 0x06, 0x00, 0x42, 0x43, 0x02, 0x00, 0x00, 0x00
+};
+//! The standard BGZF EOF marker; an empty member written at the end of files
+const unsigned char BGZF_EOF[] = { 0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00,
+                                   0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+                                   0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00,
+                                   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+/** Writes 'value' as an unsigned, little-endian integer of 'size' bytes. */
+void
+write_le(unsigned char* dst, size_t value, size_t size)
+{
+  for (size_t i = 0; i < size; ++i, value >>= 8) {
+    dst[i] = value & 0xff;
+  }
+}
+
+gzip_split_fastq::gzip_split_fastq(const userconfig& config,
+                                   const output_step_id& next_step)
+  : typed_step(processing_order::unordered)
   , m_config(config)
   , m_next_step(next_step)
   , m_buffers()
 {}
 
 chunk_vec
-gzip_split_fastq::process(analytical_chunk* chunk)
+gzip_split_fastq::process_chunk(output_chunk_ptr input_chunk)
 {
-  output_chunk_ptr input_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
   AR_DEBUG_ASSERT(input_chunk->buffers.size() == 1);
 
   buffer_pair& input_buffer = input_chunk->buffers.front();
@@ -463,40 +1411,64 @@ gzip_split_fastq::process(analytical_chunk* chunk)
     output_buffer.second.reset(new unsigned char[GZIP_BLOCK_SIZE]);
   }
 
+  // Each block is written as a BGZF member (a gzip member with a 'BC' extra
+  // subfield recording its size), allowing decompression in parallel
+  unsigned char* output = output_buffer.second.get();
+  std::memcpy(output, BGZF_HEADER, BGZF_HEADER_SIZE);
+
 #ifdef USE_LIBDEFLATE
   auto compressor = libdeflate_alloc_compressor(m_config.gzip_level);
-  auto compressed_size = libdeflate_gzip_compress(compressor,
-                                                  input_buffer.second.get(),
-                                                  input_buffer.first,
-                                                  output_buffer.second.get(),
-                                                  output_buffer.first);
+  auto compressed_size =
+    libdeflate_deflate_compress(compressor,
+                                input_buffer.second.get(),
+                                input_buffer.first,
+                                output + BGZF_HEADER_SIZE,
+                                output_buffer.first - BGZF_OVERHEAD);
   libdeflate_free_compressor(compressor);
 
   // The easily compressible input should fit in a single output block
   AR_DEBUG_ASSERT(compressed_size);
+  compressed_size += BGZF_OVERHEAD;
+
+  const auto crc =
+    libdeflate_crc32(0, input_buffer.second.get(), input_buffer.first);
 #else
   z_stream stream;
-  checked_deflate_init2(&stream, m_config.gzip_level);
+  checked_deflate_init2(&stream, m_config.gzip_level, -15);
 
   stream.avail_in = input_buffer.first;
   stream.next_in = input_buffer.second.get();
-  stream.avail_out = output_buffer.first;
-  stream.next_out = output_buffer.second.get();
+  stream.avail_out = output_buffer.first - BGZF_OVERHEAD;
+  stream.next_out = output + BGZF_HEADER_SIZE;
   // The easily compressible input should fit in a single output block
   const int returncode = checked_deflate(&stream, Z_FINISH);
   AR_DEBUG_ASSERT(stream.avail_out && returncode == Z_STREAM_END);
 
   const auto compressed_size = GZIP_BLOCK_SIZE - stream.avail_out;
   checked_deflate_end(&stream);
+
+  const auto crc = crc32(0, input_buffer.second.get(), input_buffer.first);
 #endif
 
+  // BSIZE is the total size of the member minus 1
+  write_le(output + BGZF_HEADER_SIZE - 2, compressed_size - 1, 2);
+  write_le(output + compressed_size - 8, crc, 4);
+  write_le(output + compressed_size - 4, input_buffer.first, 4);
+
   // Re-use the input chunk and make its buffer available for re-use above
   output_buffer.first = compressed_size;
   std::swap(input_buffer, output_buffer);
   m_buffers.release(output_buffer.second);
 
+  if (input_chunk->eof) {
+    // The last block is followed by the EOF marker expected by BGZF readers
+    buffer_ptr marker(new unsigned char[sizeof(BGZF_EOF)]);
+    std::memcpy(marker.get(), BGZF_EOF, sizeof(BGZF_EOF));
+    input_chunk->buffers.emplace_back(sizeof(BGZF_EOF), std::move(marker));
+  }
+
   chunk_vec chunks;
-  chunks.emplace_back(m_next_step, std::move(input_chunk));
+  push_chunk(chunks, m_next_step, std::move(input_chunk));
 
   return chunks;
 }
@@ -508,18 +1480,16 @@ const std::string STDOUT = "/dev/stdout";
 
 write_fastq::write_fastq(const std::string& filename)
   // Allow disk IO and writing to STDOUT at the same time
-  : analytical_step(filename == STDOUT ? processing_order::ordered
-                                       : processing_order::ordered_io)
+  : typed_step(filename == STDOUT ? processing_order::ordered
+                                  : processing_order::ordered_io)
   , m_output(filename)
   , m_eof(false)
   , m_lock()
 {}
 
 chunk_vec
-write_fastq::process(analytical_chunk* chunk)
+write_fastq::process_chunk(output_chunk_ptr file_chunk)
 {
-  output_chunk_ptr file_chunk(dynamic_cast<fastq_output_chunk*>(chunk));
-
   AR_DEBUG_LOCK(m_lock);
   AR_DEBUG_ASSERT(!m_eof);
 
@@ -538,6 +1508,8 @@ write_fastq::process(analytical_chunk* chunk)
     throw std::ofstream::failure(message + std::strerror(errno));
   }
 
+  fastq_output_chunk::release(file_chunk);
+
   return chunk_vec();
 }
 
@@ -556,3 +1528,51 @@ write_fastq::finalize()
     throw std::ofstream::failure(message + std::strerror(errno));
   }
 }
+
+string_vec
+write_fastq::io_filenames() const
+{
+  return string_vec(1, m_output.filename());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Input pipeline
+
+collect_fastq*
+add_read_steps(scheduler& sch,
+               const userconfig& config,
+               const read_step_id& next_step)
+{
+  const bool paired = !config.input_files_2.empty();
+
+  set_chunk_pool_size(config.max_threads);
+  sch.set_task_memory_usage(INPUT_TASK_MEMORY);
+
+  collect_fastq* collector = new collect_fastq(config, next_step);
+  block_step_id step = sch.add_step("collect_fastq", collector);
+  step =
+    sch.add_step("parse_fastq", new parse_fastq(config.io_encoding, step));
+
+  if (paired) {
+    step = sch.add_step(
+      "delimit_fastq_2",
+      new delimit_fastq(read_type::mate_2, config.io_encoding, step));
+  }
+
+  step = sch.add_step(
+    "delimit_fastq_1",
+    new delimit_fastq(read_type::mate_1, config.io_encoding, step));
+  step = sch.add_step("gunzip_split_fastq", new gunzip_split_fastq(step));
+
+  if (paired) {
+    step = sch.add_step("gunzip_fastq_2",
+                        new gunzip_fastq(read_type::mate_2, step));
+  }
+
+  step =
+    sch.add_step("gunzip_fastq_1", new gunzip_fastq(read_type::mate_1, step));
+  sch.add_step("read_fastq",
+               new read_fastq(config, step, collector->balancer()));
+
+  return collector;
+}
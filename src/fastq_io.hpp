@@ -23,36 +23,129 @@
 \*************************************************************************/
 #pragma once
 
+#include <chrono>   // for steady_clock
 #include <memory>   // for unique_ptr
 #include <mutex>    // for mutex
 #include <stddef.h> // for size_t
 #include <string>   // for string
+#include <vector>   // for vector
 #include <zlib.h>   // for z_stream
 
-#include "commontypes.hpp"       // for fastq_vec, string_vec
+#include "commontypes.hpp"       // for string_vec
 #include "fastq_enc.hpp"         // for fastq_encoding
 #include "linereader_joined.hpp" // for joined_line_readers
 #include "managed_writer.hpp"    // for buffer_ptr, buffer_vec, managed_writer
+#include "read_batch.hpp"        // for read_batch
 #include "scheduler.hpp"         // for analytical_step, chunk_vec, analyti...
+#include "statistics.hpp"        // for chunk_size_statistics
 #include "timer.hpp"             // for progress_timer
 
-struct ar_statistics;
+class chunk_sizer;
 class fastq;
+class fastq_block_chunk;
 class fastq_encoding;
 class fastq_output_chunk;
 class fastq_read_chunk;
 class fastq_statistics;
 class userconfig;
 
+typedef std::unique_ptr<fastq_block_chunk> block_chunk_ptr;
 typedef std::unique_ptr<fastq_output_chunk> output_chunk_ptr;
 typedef std::unique_ptr<fastq_read_chunk> read_chunk_ptr;
+//! Steps processing blocks of (compressed) input
+typedef step_handle<fastq_block_chunk> block_step_id;
+//! Steps processing read chunks
+typedef step_handle<fastq_read_chunk> read_step_id;
+//! Steps processing output chunks
+typedef step_handle<fastq_output_chunk> output_step_id;
 
 //! Rough number of nucleotides to read every cycle
 const size_t INPUT_BLOCK_SIZE = 4 * 64 * 1024;
+//! Initial number of nucleotides read per chunk, for both mates combined
+const size_t INPUT_CHUNK_SIZE = INPUT_BLOCK_SIZE * 4;
+//! Smallest number of nucleotides read per chunk; also the size increment
+const size_t INPUT_CHUNK_SIZE_MIN = INPUT_BLOCK_SIZE / 4;
+//! Largest number of nucleotides read per chunk; bounds the cache footprint
+const size_t INPUT_CHUNK_SIZE_MAX = INPUT_BLOCK_SIZE * 8;
+//! Targeted time spent processing a chunk of reads
+const std::chrono::milliseconds INPUT_CHUNK_TIME(10);
+//! Number of (raw) bytes read from each input file per block; kept small, as
+//! blocks are parsed in parallel and compressed data grows several fold
+const size_t INPUT_READ_SIZE = 64 * 1024;
 //! Size of chunks of when performing block compression
 const size_t GZIP_BLOCK_SIZE = 64 * 1024;
 //! Size of blocks to generate before writing to output
 const size_t OUTPUT_BLOCK_SIZE = 4 * 64 * 1024;
+//! Bytes budgeted per task unless --max-memory is set; blocks of input are
+//! much smaller than chunks of reads, so more blocks may be held in flight
+const size_t INPUT_TASK_MEMORY = INPUT_CHUNK_SIZE;
+//! Released chunks using more memory than this are freed instead of re-used
+const size_t POOLED_CHUNK_SIZE_MAX = INPUT_CHUNK_SIZE_MAX * 4;
+
+/**
+ * A block of data read from a single input file.
+ */
+struct fastq_block
+{
+  /** Constructor; creates an empty block. */
+  fastq_block();
+
+  /** Returns the approximate number of bytes used by the block. */
+  size_t memory_usage() const;
+
+  //! Data read from the file; either text or compressed data (see 'format')
+  std::string data;
+  //! The current format of 'data'; text once decompressed
+  block_format format;
+  //! The number of bytes read from the file, prior to decompression
+  size_t raw_size;
+  //! Buffer used for decompression; swapped with 'data' and then released
+  std::string buffer;
+  //! The file from which 'data' was read
+  std::string filename;
+  //! Identifies the file from which 'data' was read; see joined_line_readers
+  size_t file_number;
+  //! Indicates that all files have been read
+  bool eof;
+
+  //! Partial record carried over from the previous block; precedes 'data'
+  std::string prefix;
+  //! Number of lines in the file preceding 'prefix' / 'data'
+  size_t line_offset;
+  //! Records parsed from the block; the arenas are re-used by pooled blocks
+  read_batch records;
+  //! Error message for the first malformed record, if any
+  std::string error;
+};
+
+/**
+ * Container object for blocks of input data.
+ */
+class fastq_block_chunk : public analytical_chunk
+{
+public:
+  /** Constructor; creates a chunk containing empty blocks. */
+  fastq_block_chunk();
+
+  /** Returns a recycled chunk if available, otherwise a new chunk. */
+  static block_chunk_ptr acquire();
+  /** Makes a chunk that is no longer needed available for re-use. */
+  static void release(block_chunk_ptr& chunk);
+
+  /** Returns the approximate number of bytes used by the blocks. */
+  virtual size_t memory_usage() const;
+
+  /** Returns the block for read_type::mate_1 or read_type::mate_2. */
+  fastq_block& block(read_type mate);
+
+  //! Indicates that EOF has been reached for both mates.
+  bool eof;
+
+  //! Data read from the mate 1 files (or from interleaved / single-end files)
+  fastq_block mate_1;
+  //! Data read from the mate 2 files, if any
+  fastq_block mate_2;
+};
 
 /**
  * Container object for (demultiplexed) reads.
@@ -63,16 +156,60 @@ public:
   /** Create chunk representing lines starting at line offset (1-based). */
   fastq_read_chunk(bool eof_ = false);
 
+  /**
+   * Returns a recycled chunk if one is available, otherwise a new chunk. The
+   * reads of recycled chunks are cleared, but the arenas of the batches are
+   * kept, so that these need not be re-allocated.
+   */
+  static read_chunk_ptr acquire();
+  /**
+   * Makes a chunk that is no longer needed available for re-use; the time
+   * spent processing the chunk (see 'begin_processing') is reported to
+   * 'sizer', if set.
+   */
+  static void release(read_chunk_ptr& chunk);
+
+  /** Marks the start of the processing of the reads by a step. */
+  void begin_processing();
+  /**
+   * Marks the end of the processing of the reads by a step that passes the
+   * chunk on to another step; processing otherwise ends on 'release'.
+   */
+  void end_processing();
+  /**
+   * Times the processing of this chunk using the sizer of 'source', as a
+   * stage following that of 'source'; used for chunks of reads taken from
+   * 'source', e.g. demultiplexed reads.
+   */
+  void inherit_sizer(const fastq_read_chunk& source);
+
+  /** Returns the approximate number of bytes used by the reads. */
+  virtual size_t memory_usage() const;
+
   //! Indicates that EOF has been reached.
   bool eof;
 
   //! Total number of nucleotides in this chunk
   size_t nucleotides;
 
+  //! Selects chunk sizes based on processing time; set by the parser
+  chunk_sizer* sizer;
+  //! The stage of processing timed by this chunk; see 'inherit_sizer'
+  size_t stage;
+  //! The time at which processing by the current step started, if any
+  std::chrono::steady_clock::time_point started;
+  //! Time spent processing the chunk by steps that have finished with it
+  std::chrono::steady_clock::duration elapsed;
+
   //! Lines read from the mate 1 files
-  fastq_vec reads_1;
+  read_batch reads_1;
   //! Lines read from the mate 2 files
-  fastq_vec reads_2;
+  read_batch reads_2;
+
+  //! Copy construction not supported
+  fastq_read_chunk(const fastq_read_chunk&) = delete;
+  //! Assignment not supported
+  fastq_read_chunk& operator=(const fastq_read_chunk&) = delete;
 };
 
 /**
@@ -84,8 +221,16 @@ public:
   /** Constructor; does nothing. */
   fastq_output_chunk(bool eof_ = false);
 
-  /** Add FASTQ read to output buffer. */
-  void add(const fastq& read);
+  /** Returns an empty, recycled chunk if available, otherwise a new chunk. */
+  static output_chunk_ptr acquire(bool eof_ = false);
+  /** Makes a chunk that is no longer needed available for re-use. */
+  static void release(output_chunk_ptr& chunk);
+
+  /** Add the nth FASTQ read of a batch to output buffer. */
+  void add(const read_batch& batch, size_t nth);
+
+  /** Returns the approximate number of bytes used by the output. */
+  virtual size_t memory_usage() const;
 
   //! Indicates that EOF has been reached.
   bool eof;
@@ -100,107 +245,456 @@ public:
   buffer_vec buffers;
 };
 
+/**
+ * Selects the number of nucleotides to read per chunk.
+ *
+ * Chunks are sized such that processing a chunk takes roughly
+ * INPUT_CHUNK_TIME, within the range INPUT_CHUNK_SIZE_MIN to
+ * INPUT_CHUNK_SIZE_MAX. Small chunks improve load balancing when reads are
+ * slow to process (e.g. long reads or many barcodes), while large chunks
+ * reduce the overhead per chunk when reads are fast to process.
+ */
+class chunk_sizer
+{
+public:
+  /** Constructor; chunks initially contain INPUT_CHUNK_SIZE nucleotides. */
+  chunk_sizer();
+
+  /** Returns the number of nucleotides to read for the next chunk. */
+  size_t next_size();
+
+  /**
+   * Records the time taken to process a chunk; may be called by any thread.
+   * Times are averaged per stage, and the processing time of a nucleotide is
+   * the sum over all stages (e.g. demultiplexing followed by trimming).
+   */
+  void record(size_t stage,
+              size_t nucleotides,
+              std::chrono::steady_clock::duration elapsed);
+
+  /** Returns a summary of the chunk sizes selected so far. */
+  chunk_size_statistics statistics() const;
+
+  //! Copy construction not supported
+  chunk_sizer(const chunk_sizer&) = delete;
+  //! Assignment not supported
+  chunk_sizer& operator=(const chunk_sizer&) = delete;
+
+private:
+  //! Lock used to protect the members below
+  mutable std::mutex m_lock;
+  //! Running averages of the time spent processing a nucleotide per stage
+  std::vector<double> m_ns_per_nucleotide;
+  //! The number of nucleotides to read for the next chunk
+  size_t m_size;
+  //! Summary of sizes returned by 'next_size'
+  chunk_size_statistics m_statistics;
+};
+
+/**
+ * Tracks the mean size of records parsed from the mate 1 and mate 2 files, so
+ * that 'read_fastq' can read blocks containing similar numbers of records for
+ * either mate; the number of records in a block is otherwise only known once
+ * the block has been parsed. May be used by any thread.
+ */
+class mate_balancer
+{
+public:
+  /** Constructor; records are initially assumed to be of equal size. */
+  mate_balancer();
+
+  /** Sets the total number of bytes and records parsed for either mate. */
+  void update(size_t bytes_1, size_t records_1, size_t bytes_2, size_t records_2);
+
+  /** Returns the mean size of mate 2 records relative to mate 1 records. */
+  double ratio() const;
+
+  //! Copy construction not supported
+  mate_balancer(const mate_balancer&) = delete;
+  //! Assignment not supported
+  mate_balancer& operator=(const mate_balancer&) = delete;
+
+private:
+  //! Lock used to protect the members below
+  mutable std::mutex m_lock;
+  //! The mean size of mate 2 records relative to mate 1 records
+  double m_ratio;
+};
+
 /**
  * Simple file reading step.
  *
- * Reads from the mate 1 and the mate 2 files, storing the reads in a
- * fastq_file_chunk. Once the EOF has been reached, a single empty chunk will
- * be returned, marked using the 'eof' property.
+ * Reads blocks of data from the mate 1 and the mate 2 files, storing these in
+ * a fastq_block_chunk. Data is not decompressed while reading; regular gzip
+ * streams are left for 'gunzip_fastq', while the members of BGZF files
+ * (including files written by AdapterRemoval) are left for
+ * 'gunzip_split_fastq'. Once the EOF has been reached, a final chunk marked
+ * using the 'eof' property will be returned.
  */
 class read_fastq : public analytical_step
 {
 public:
   /**
-   * Constructor.
+   * Constructor; 'balancer' is used to select the amount of mate 2 data read
+   * per chunk, and is expected to be updated by the 'collect_fastq' step.
    */
-  read_fastq(const userconfig& config, size_t next_step);
+  read_fastq(const userconfig& config,
+             const block_step_id& next_step,
+             const mate_balancer& balancer);
 
-  /** Reads lines from the input file and saves them in an fastq_file_chunk. */
+  /** Reads blocks from the input files and saves them in a chunk. */
   virtual chunk_vec process(analytical_chunk* chunk);
 
   /** Finalizer; checks that all input has been processed. */
   virtual void finalize();
 
+  /** Returns the input files read by this step. */
+  virtual string_vec io_filenames() const;
+
   //! Copy construction not supported
   read_fastq(const read_fastq&) = delete;
   //! Assignment not supported
   read_fastq& operator=(const read_fastq&) = delete;
 
 private:
-  //! The underlying file reader for mate 1 (and possibly mate 2) reads
-  joined_line_readers m_io_input_1_base;
-  //! The underlying file reader for mate 2 read (if not interleaved)
-  joined_line_readers m_io_input_2_base;
-  //! The reader used to read mate 1 reads.
-  joined_line_readers* m_io_input_1;
-  //! The reader used to read mate 1 reads; may be equal to m_io_input_1.
-  joined_line_readers* m_io_input_2;
+  //! Input files for mate 1 and mate 2 reads
+  string_vec m_filenames;
+  //! The file reader for mate 1 (and possibly interleaved mate 2) reads
+  joined_line_readers m_io_input_1;
+  //! The file reader for mate 2 reads; no files if single-end / interleaved
+  joined_line_readers m_io_input_2;
   //! The analytical step following this step
-  const size_t m_next_step;
+  const block_step_id m_next_step;
+  //! Used to balance the number of mate 1 and mate 2 records read
+  const mate_balancer& m_balancer;
+  //! Total number of (raw) bytes read for mate 1
+  size_t m_bytes_1;
+  //! Total number of (raw) bytes read for mate 2
+  size_t m_bytes_2;
+
+  //! Used to track whether the mate 2 files have been read.
+  bool m_eof_2;
+  //! Used to track whether an EOF block has been received.
+  bool m_eof;
+
+  //! Lock used to verify that the analytical_step is only run sequentially.
+  std::mutex m_lock;
+};
+
+/**
+ * Decompresses regular gzip streams read by 'read_fastq' for one mate. Such
+ * streams can only be decompressed sequentially, so chunks are processed in
+ * order, but this is done concurrently with reading the input, with parsing
+ * previous chunks, and with decompressing the other mate. Blocks in other
+ * formats are passed through as is; BGZF blocks are decompressed in parallel
+ * by 'gunzip_split_fastq' instead.
+ */
+class gunzip_fastq : public typed_step<fastq_block_chunk>
+{
+public:
+  /** Constructor; 'mate' selects the block to decompress in each chunk. */
+  gunzip_fastq(read_type mate, const block_step_id& next_step);
+
+  /** Decompresses the block for this mate if it is gzip compressed. */
+  virtual chunk_vec process_chunk(block_chunk_ptr chunk);
 
-  //! True if input is single-end
-  bool m_single_end;
+  /** Checks that all input has been processed and all streams finished. */
+  virtual void finalize();
+
+  //! Copy construction not supported
+  gunzip_fastq(const gunzip_fastq&) = delete;
+  //! Assignment not supported
+  gunzip_fastq& operator=(const gunzip_fastq&) = delete;
+
+private:
+  //! The mate for which blocks are decompressed
+  const read_type m_mate;
+  //! The analytical step following this step
+  const block_step_id m_next_step;
+  //! Stream for the file currently being decompressed, if any
+  std::unique_ptr<gzip_inflater> m_stream;
+  //! Identifies the file being decompressed; see joined_line_readers
+  size_t m_file_number;
   //! Used to track whether an EOF block has been received.
   bool m_eof;
 
-  //! Timer for displaying read progress.
-  progress_timer m_timer;
+  //! Lock used to verify that the analytical_step is only run sequentially.
+  std::mutex m_lock;
+};
+
+/**
+ * Decompresses BGZF members read by 'read_fastq'; as members can be
+ * decompressed independently, chunks are processed in parallel. Blocks in
+ * other formats are passed through as is.
+ */
+class gunzip_split_fastq : public typed_step<fastq_block_chunk>
+{
+public:
+  /** Constructor. */
+  gunzip_split_fastq(const block_step_id& next_step);
+
+  /** Decompresses any BGZF members in the chunk. */
+  virtual chunk_vec process_chunk(block_chunk_ptr chunk);
+
+private:
+  //! The analytical step following this step
+  const block_step_id m_next_step;
+};
+
+/**
+ * Splits consecutive blocks of text read from one or more files at record
+ * boundaries, so that the records in each block can be parsed independently.
+ * The partial record at the end of a block is carried over to the next block
+ * read from the same file.
+ */
+class fastq_delimiter
+{
+public:
+  /** Constructor; 'encoding' is used for records parsed by 'delimit'. */
+  fastq_delimiter(const fastq_encoding& encoding);
+
+  /**
+   * Splits the text of the block at the last record boundary. If the block is
+   * the first block of a new file, or the EOF block, then the text carried
+   * over from the previous file is parsed into 'block.records'.
+   */
+  void delimit(fastq_block& block);
+
+private:
+  //! Encoding used to decode records parsed from the carried over text
+  const fastq_encoding m_encoding;
+  //! Text following the last record boundary in the current file
+  std::string m_carry;
+  //! The file from which 'm_carry' was read
+  std::string m_filename;
+  //! Identifies the file from which 'm_carry' was read
+  size_t m_file_number;
+  //! Number of lines preceding 'm_carry' in the current file
+  size_t m_lines;
+  //! Offsets of newlines in the current block; re-used between blocks
+  std::vector<size_t> m_newlines;
+};
+
+/**
+ * Finds record boundaries in blocks of decompressed text for one mate, in the
+ * order the blocks were read, so that the records can be parsed by
+ * 'parse_fastq'.
+ */
+class delimit_fastq : public typed_step<fastq_block_chunk>
+{
+public:
+  /** Constructor; 'mate' selects the block to split in each chunk. */
+  delimit_fastq(read_type mate,
+                const fastq_encoding& encoding,
+                const block_step_id& next_step);
+
+  /** Splits the block for this mate at record boundaries. */
+  virtual chunk_vec process_chunk(block_chunk_ptr chunk);
+
+  /** Finalizer; checks that all input has been processed. */
+  virtual void finalize();
+
+  //! Copy construction not supported
+  delimit_fastq(const delimit_fastq&) = delete;
+  //! Assignment not supported
+  delimit_fastq& operator=(const delimit_fastq&) = delete;
+
+private:
+  //! The mate for which blocks are split
+  const read_type m_mate;
+  //! Delimiter for the files of this mate
+  fastq_delimiter m_delimiter;
+  //! The analytical step following this step
+  const block_step_id m_next_step;
+  //! Used to track whether an EOF block has been received.
+  bool m_eof;
 
   //! Lock used to verify that the analytical_step is only run sequentially.
   std::mutex m_lock;
 };
 
 /**
- * Class responsible for validating FASTQ records and collecting statistics.
- * This is split into a seperate step to minimize the amount of time that IO
- * is blocked by the FASTQ reading step.
+ * Parses, validates, and decodes the records in blocks split by
+ * 'delimit_fastq'; as these blocks contain only complete records, chunks are
+ * processed in parallel. Malformed records are recorded in 'fastq_block::error'
+ * and reported by 'collect_fastq', so that the first error in the input is
+ * always the one reported.
  */
-class post_process_fastq : public analytical_step
+class parse_fastq : public typed_step<fastq_block_chunk>
 {
 public:
   /** Constructor. */
-  post_process_fastq(const fastq_encoding& encoding,
-                     size_t next_step,
-                     ar_statistics* statitics = nullptr);
+  parse_fastq(const fastq_encoding& encoding, const block_step_id& next_step);
 
-  /** Reads lines from the input file and saves them in an fastq_file_chunk. */
-  virtual chunk_vec process(analytical_chunk* chunk);
+  /** Parses the records in the blocks of the chunk. */
+  virtual chunk_vec process_chunk(block_chunk_ptr chunk);
+
+private:
+  //! Encoding used to decode quality scores
+  const fastq_encoding m_encoding;
+  //! The analytical step following this step
+  const block_step_id m_next_step;
+};
+
+/**
+ * Queue of records parsed from consecutive blocks read from one or more files.
+ */
+class fastq_queue
+{
+public:
+  /** Constructor. */
+  fastq_queue();
+
+  /**
+   * Moves the records parsed from the block to the queue; errors recorded for
+   * the block are reported and processing is aborted.
+   */
+  void add(fastq_block& block);
+
+  /** Returns the number of records not yet taken. */
+  size_t available() const;
+  /** Appends the next record to 'dst' and returns its length. */
+  size_t take(read_batch& dst);
+
+  /** Returns the total number of records added. */
+  size_t records() const;
+  /** Returns the total number of (raw) bytes read for the blocks added. */
+  size_t bytes() const;
+  /** Returns true if all records have been added. */
+  bool eof() const;
+  /** Returns the file from which records were last read. */
+  const std::string& filename() const;
+
+private:
+  //! The file from which records were last read
+  std::string m_filename;
+  //! Queued records; the records before 'm_next' have been taken
+  read_batch m_records;
+  //! Used to collect records not yet taken when adding records
+  read_batch m_spare;
+  //! Index of the next record to be taken
+  size_t m_next;
+  //! Total number of records added
+  size_t m_total_records;
+  //! Total number of (raw) bytes read for the blocks added
+  size_t m_total_bytes;
+  //! Indicates that all files have been read
+  bool m_eof;
+};
+
+/**
+ * Collects FASTQ records from parsed blocks in the order they were read,
+ * pairing mate 1 and mate 2 reads and collecting the reads into chunks; the
+ * number of reads per chunk is selected using a 'chunk_sizer'. Once the EOF
+ * has been reached, a final chunk marked using the 'eof' property will be
+ * returned.
+ */
+class collect_fastq : public typed_step<fastq_block_chunk>
+{
+public:
+  /** Constructor. */
+  collect_fastq(const userconfig& config, const read_step_id& next_step);
+
+  /** Collects the records parsed from the blocks in read chunks. */
+  virtual chunk_vec process_chunk(block_chunk_ptr chunk);
 
   /** Finalizer; checks that all input has been processed. */
   virtual void finalize();
 
+  /** Returns a summary of the sizes of the chunks read. */
+  chunk_size_statistics chunk_sizes() const;
+
+  /** Returns the balancer to be used by the 'read_fastq' step. */
+  const mate_balancer& balancer() const;
+
+  //! Copy construction not supported
+  collect_fastq(const collect_fastq&) = delete;
+  //! Assignment not supported
+  collect_fastq& operator=(const collect_fastq&) = delete;
+
+private:
+  /** Returns the chunk of reads currently being collected. */
+  fastq_read_chunk& current_reads();
+  /** Pushes the current chunk of reads to the list of chunks. */
+  void push_reads(chunk_vec& chunks, bool eof);
+
+  //! Records parsed from the mate 1 (or interleaved / single-end) files
+  fastq_queue m_mate_1;
+  //! Records parsed from the mate 2 files, if any
+  fastq_queue m_mate_2;
+  //! The analytical step following this step
+  const read_step_id m_next_step;
+  //! The chunk of reads currently being collected
+  read_chunk_ptr m_reads;
+  //! Number of nucleotides to collect for the current chunk
+  size_t m_chunk_size;
+  //! Selects the number of nucleotides to read per chunk
+  chunk_sizer m_chunk_sizer;
+  //! Tracks the relative size of mate 1 and mate 2 records
+  mate_balancer m_balancer;
+
+  //! True if mate 2 reads are read from separate files
+  bool m_paired;
+  //! True if mate 1 and mate 2 reads are read from the same files
+  bool m_interleaved;
+  //! Used to track whether an EOF block has been received.
+  bool m_eof;
+
+  //! Timer for displaying read progress.
+  progress_timer m_timer;
+
+  //! Lock used to verify that the analytical_step is only run sequentially.
+  std::mutex m_lock;
+};
+
+/**
+ * Collects statistics for the input reads. Reads are validated and decoded by
+ * 'parse_fastq', so chunks are processed in parallel, using per-thread
+ * statistics that are merged once all chunks have been processed.
+ */
+class post_process_fastq : public typed_step<fastq_read_chunk>
+{
+public:
+  /** Constructor; statistics are merged into 'statistics' when finalized. */
+  post_process_fastq(const userconfig& config,
+                     const read_step_id& next_step,
+                     ar_statistics& statistics);
+
+  /** Collects statistics for the reads in the chunk. */
+  virtual chunk_vec process_chunk(read_chunk_ptr chunk);
+
+  /** Merges the per-thread statistics into the final statistics. */
+  virtual void finalize();
+
   //! Copy construction not supported
   post_process_fastq(const post_process_fastq&) = delete;
   //! Assignment not supported
   post_process_fastq& operator=(const post_process_fastq&) = delete;
 
 private:
-  //! Encoding used to parse FASTQ reads.
-  const fastq_encoding m_encoding;
+  //! Per-thread statistics collected from raw mate 1 reads
+  threadstate<fastq_statistics> m_stats_1;
+  //! Per-thread statistics collected from raw mate 2 reads
+  threadstate<fastq_statistics> m_stats_2;
   //! Statistics collected from raw mate 1 reads
   fastq_statistics* m_statistics_1;
   //! Statistics collected from raw mate 2 reads
   fastq_statistics* m_statistics_2;
   //! The analytical step following this step
-  const size_t m_next_step;
-
-  //! Used to track whether an EOF block has been received.
-  bool m_eof;
-  //! Lock used to verify that the analytical_step is only run sequentially.
-  std::mutex m_lock;
+  const read_step_id m_next_step;
 };
 
 /**
  * GZip compression step; takes any lines in the input chunk, compresses them,
  * and adds them to the buffer list of the chunk, before forwarding it. */
-class gzip_fastq : public analytical_step
+class gzip_fastq : public typed_step<fastq_output_chunk>
 {
 public:
   /** Constructor; 'next_step' sets the destination of compressed chunks. */
-  gzip_fastq(const userconfig& config, size_t next_step);
+  gzip_fastq(const userconfig& config, const output_step_id& next_step);
 
   /** Compresses input lines, saving compressed chunks to chunk->buffers. */
-  virtual chunk_vec process(analytical_chunk* chunk);
+  virtual chunk_vec process_chunk(output_chunk_ptr chunk);
 
   /** Checks that all input has been processed and frees stream. */
   virtual void finalize();
@@ -212,7 +706,7 @@ public:
 
 private:
   //! The analytical step following this step
-  const size_t m_next_step;
+  const output_step_id m_next_step;
   //! GZip stream object
   z_stream m_stream;
   //! Used to track whether an EOF block has been received.
@@ -224,13 +718,13 @@ private:
 /**
  * Splits input into chunks that can be GZipped in parallel.
  */
-class split_fastq : public analytical_step
+class split_fastq : public typed_step<fastq_output_chunk>
 {
 public:
   /** Constructor; 'next_step' sets the destination of compressed chunks. */
-  split_fastq(size_t next_step);
+  split_fastq(const output_step_id& next_step);
 
-  virtual chunk_vec process(analytical_chunk* chunk);
+  virtual chunk_vec process_chunk(output_chunk_ptr chunk);
   virtual void finalize();
 
   //! Copy construction not supported
@@ -240,7 +734,7 @@ public:
 
 private:
   //! The analytical step following this step
-  const size_t m_next_step;
+  const output_step_id m_next_step;
   //! Buffer used to store partial blocks
   buffer_ptr m_buffer;
   //! Offset in current buffer
@@ -255,14 +749,14 @@ private:
 /**
  * GZip compression step; takes any lines in the input chunk, compresses them,
  * and adds them to the buffer list of the chunk, before forwarding it. */
-class gzip_split_fastq : public analytical_step
+class gzip_split_fastq : public typed_step<fastq_output_chunk>
 {
 public:
   /** Constructor; 'next_step' sets the destination of compressed chunks. */
-  gzip_split_fastq(const userconfig& config, size_t next_step);
+  gzip_split_fastq(const userconfig& config, const output_step_id& next_step);
 
   /** Compresses input lines, saving compressed chunks to chunk->buffers. */
-  virtual chunk_vec process(analytical_chunk* chunk);
+  virtual chunk_vec process_chunk(output_chunk_ptr chunk);
 
   //! Copy construction not supported
   gzip_split_fastq(const gzip_split_fastq&) = delete;
@@ -272,7 +766,7 @@ public:
 private:
   const userconfig& m_config;
   //! The analytical step following this step
-  const size_t m_next_step;
+  const output_step_id m_next_step;
   //! Already allocated buffers usable for compressed output
   threadstate<unsigned char[]> m_buffers;
 };
@@ -284,7 +778,7 @@ private:
  * at the offset corresponding to the 'type' argument to the corresponding
  * output file. The list of lines is cleared upon writing.
  */
-class write_fastq : public analytical_step
+class write_fastq : public typed_step<fastq_output_chunk>
 {
 public:
   /**
@@ -296,11 +790,14 @@ public:
   write_fastq(const std::string& filename);
 
   /** Writes the reads of the type specified in the constructor. */
-  virtual chunk_vec process(analytical_chunk* chunk);
+  virtual chunk_vec process_chunk(output_chunk_ptr chunk);
 
   /** Flushes the output file and prints progress report (if enabled). */
   virtual void finalize();
 
+  /** Returns the output file written by this step. */
+  virtual string_vec io_filenames() const;
+
 private:
   //! Lazily opened / automatically closed handle
   managed_writer m_output;
@@ -310,3 +807,23 @@ private:
   //! Lock used to verify that the analytical_step is only run sequentially.
   std::mutex m_lock;
 };
+
+/**
+ * Sets the number of read, output, and block chunks kept for re-use (each);
+ * chunks released while the pool is full are freed instead.
+ */
+void
+set_chunk_pool_size(size_t n);
+
+/**
+ * Adds the steps reading, decompressing and parsing the input files to the
+ * scheduler, with the reads being sent to 'next_step'. For paired-end input,
+ * the mate 1 and mate 2 files are decompressed and split by separate steps,
+ * allowing both to be processed at the same time. The number of pooled chunks
+ * is set to the number of threads (see 'set_chunk_pool_size'). Returns the
+ * final step, which is owned by the scheduler.
+ */
+collect_fastq*
+add_read_steps(scheduler& sch,
+               const userconfig& config,
+               const read_step_id& next_step);
@@ -21,12 +21,26 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#include <cerrno>   // for errno
-#include <cstdio>   // for BUFSIZ
-#include <cstdlib>  // for exit
-#include <cstring>  // for strerror
-#include <iostream> // for operator<<, basic_ostream, endl, cerr
-#include <sstream>  // for stringstream
+#include <algorithm>  // for min
+#include <cerrno>     // for errno
+#include <cstdio>     // for BUFSIZ, fseeko
+#include <cstdlib>    // for exit
+#include <cstring>    // for strerror, memchr
+#include <fcntl.h>    // for posix_fadvise, POSIX_FADV_WILLNEED
+#include <iostream>   // for operator<<, basic_ostream, endl, cerr
+#include <sstream>    // for stringstream
+#include <stdint.h>   // for SIZE_MAX, uintmax_t
+#include <sys/mman.h> // for mmap, munmap, madvise, MADV_SEQUENTIAL, ...
+#include <sys/stat.h> // for fstat, S_ISREG
+#include <vector>     // for vector
+
+#if defined(USE_LIBDEFLATE)
+#include <libdeflate.h> // for libdeflate_deflate_decompress, ...
+#endif
+
+#if defined(USE_LIBURING)
+#include <liburing.h> // for io_uring, io_uring_queue_init, ...
+#endif
 
 #include "debug.hpp" // for AR_DEBUG_ASSSERT
 #include "linereader.hpp"
@@ -35,6 +49,8 @@
 
 //! Size of compressed and uncompressed buffers.
 const int BUF_SIZE = 10 * BUFSIZ;
+//! Number of bytes read ahead at the start of files opened ahead of time
+const off_t PREFETCH_SIZE = 4 * 1024 * 1024;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'io_error'
@@ -80,7 +96,7 @@ throw_isal_error(const char* func, const char* msg)
 }
 
 #define THROW_GZIP_ERROR(msg)                                                  \
-  throw_gzip_error(__func__, m_gzip_stream.get(), (msg))
+  throw_gzip_error(__func__, m_stream.get(), (msg))
 
 gzip_error::gzip_error(const std::string& message)
   : io_error(message)
@@ -140,26 +156,771 @@ check_isal_return_code(const char* func, int returncode)
 
 #endif
 
+///////////////////////////////////////////////////////////////////////////////
+// Helper functions for BGZF members
+
+//! Size of the fixed part of gzip headers, including the XLEN field
+const size_t GZIP_HEADER_SIZE = 12;
+//! Size of gzip trailers, consisting of the CRC32 and ISIZE fields
+const size_t GZIP_TRAILER_SIZE = 8;
+//! Maximum size of the data contained in a single BGZF member
+const size_t BGZF_MAX_DATA_SIZE = 64 * 1024;
+
+/** Reads an unsigned, little-endian integer of 'size' bytes. */
+size_t
+read_le(const char* data, size_t size)
+{
+  size_t value = 0;
+  for (size_t i = size; i; --i) {
+    value = (value << 8) | static_cast<unsigned char>(data[i - 1]);
+  }
+
+  return value;
+}
+
+size_t
+bgzf_member_size(const char* data, size_t length)
+{
+  // Magic bytes, CM = deflate, and FLG with the FEXTRA bit set
+  if (length < GZIP_HEADER_SIZE || data[0] != '\x1f' || data[1] != '\x8b' ||
+      data[2] != '\x08' || !(data[3] & 0x04)) {
+    return 0;
+  }
+
+  const size_t xlen = read_le(data + 10, 2);
+  if (length < GZIP_HEADER_SIZE + xlen) {
+    return 0;
+  }
+
+  // Subfields consist of SI1, SI2, SLEN, followed by SLEN bytes of data
+  const char* field = data + GZIP_HEADER_SIZE;
+  const char* const end = field + xlen;
+  while (end - field >= 4) {
+    const size_t slen = read_le(field + 2, 2);
+    if (field[0] == 'B' && field[1] == 'C' && slen == 2 && end - field >= 6) {
+      return read_le(field + 4, 2) + 1;
+    }
+
+    field += 4 + slen;
+  }
+
+  return 0;
+}
+
+/** Returns the size of the gzip header of a BGZF member; 0 if invalid. */
+size_t
+bgzf_header_size(const char* data, size_t length)
+{
+  const char flags = data[3];
+  size_t size = GZIP_HEADER_SIZE + read_le(data + 10, 2);
+
+  // Optional, zero-terminated FNAME and FCOMMENT fields
+  for (const char flag : { 0x08, 0x10 }) {
+    if (flags & flag) {
+      if (size >= length) {
+        return 0;
+      }
+
+      const void* ptr = memchr(data + size, '\0', length - size);
+      if (!ptr) {
+        return 0;
+      }
+
+      size = static_cast<const char*>(ptr) - data + 1;
+    }
+  }
+
+  // Optional FHCRC field
+  if (flags & 0x02) {
+    size += 2;
+  }
+
+  return size + GZIP_TRAILER_SIZE <= length ? size : 0;
+}
+
+void
+bgzf_decompress(const std::string& src, std::string& dst)
+{
+  // Members are located first, so that the output can be allocated up front
+  size_t total_size = 0;
+  for (size_t offset = 0; offset < src.size();) {
+    const char* member = src.data() + offset;
+    const size_t size = bgzf_member_size(member, src.size() - offset);
+    if (!size || size > src.size() - offset || !bgzf_header_size(member, size)) {
+      throw gzip_error("bgzf_decompress: invalid or truncated BGZF member");
+    }
+
+    // ISIZE is checked, as it is used to allocate the output up front
+    const size_t output_size = read_le(member + size - 4, 4);
+    if (output_size > BGZF_MAX_DATA_SIZE) {
+      throw gzip_error("bgzf_decompress: BGZF member contains more than 64 kB");
+    }
+
+    total_size += output_size;
+    offset += size;
+  }
+
+  dst.resize(total_size);
+
+#if defined(USE_LIBDEFLATE)
+  auto decompressor = libdeflate_alloc_decompressor();
+  if (!decompressor) {
+    throw gzip_error("bgzf_decompress (libdeflate): insufficient memory");
+  }
+#else
+  z_stream stream;
+  stream.zalloc = nullptr;
+  stream.zfree = nullptr;
+  stream.opaque = nullptr;
+  stream.avail_in = 0;
+  stream.next_in = nullptr;
+
+  // Members are decompressed as raw deflate data; the trailer is checked below
+  if (inflateInit2(&stream, -15) != Z_OK) {
+    throw_gzip_error(__func__, &stream, "failed to initialize stream");
+  }
+#endif
+
+  try {
+    char* output = &dst[0];
+    for (size_t offset = 0; offset < src.size();) {
+      const char* member = src.data() + offset;
+      const size_t size = bgzf_member_size(member, src.size() - offset);
+      const size_t header_size = bgzf_header_size(member, size);
+      const char* trailer = member + size - GZIP_TRAILER_SIZE;
+      const size_t output_size = read_le(trailer + 4, 4);
+
+      // Empty members, such as the BGZF EOF marker, require no work
+      if (output_size) {
+        const char* input = member + header_size;
+        const size_t input_size = trailer - input;
+
+#if defined(USE_LIBDEFLATE)
+        if (libdeflate_deflate_decompress(decompressor,
+                                          input,
+                                          input_size,
+                                          output,
+                                          output_size,
+                                          nullptr) != LIBDEFLATE_SUCCESS) {
+          throw gzip_error("bgzf_decompress (libdeflate): invalid member");
+        }
+
+        const size_t crc = libdeflate_crc32(0, output, output_size);
+#else
+        stream.avail_in = input_size;
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input));
+        stream.avail_out = output_size;
+        stream.next_out = reinterpret_cast<Bytef*>(output);
+
+        if (inflate(&stream, Z_FINISH) != Z_STREAM_END || stream.avail_out ||
+            inflateReset(&stream) != Z_OK) {
+          throw_gzip_error(__func__, &stream, "invalid member");
+        }
+
+        const size_t crc =
+          crc32(0, reinterpret_cast<const Bytef*>(output), output_size);
+#endif
+
+        if (crc != read_le(trailer, 4)) {
+          throw gzip_error("bgzf_decompress: incorrect checksum found");
+        }
+      }
+
+      output += output_size;
+      offset += size;
+    }
+  } catch (...) {
+#if defined(USE_LIBDEFLATE)
+    libdeflate_free_decompressor(decompressor);
+#else
+    inflateEnd(&stream);
+#endif
+    throw;
+  }
+
+#if defined(USE_LIBDEFLATE)
+  libdeflate_free_decompressor(decompressor);
+#else
+  inflateEnd(&stream);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'uring_reader'
+
+#if defined(USE_LIBURING)
+
+//! Number of reads of BUF_SIZE bytes kept in flight per file
+const size_t URING_QUEUE_DEPTH = 8;
+
+/**
+ * Reads a regular file using io_uring, keeping URING_QUEUE_DEPTH reads in
+ * flight ahead of the consumer. Buffers are handed out in file order, and
+ * each buffer is re-used for a new read once the next buffer is requested.
+ */
+class uring_reader
+{
+public:
+  /** Returns a reader for regular files, or null if io_uring is unusable. */
+  static std::unique_ptr<uring_reader> create(FILE* file);
+
+  /** Waits for reads in flight and closes the ring. */
+  ~uring_reader();
+
+  /** Points 'dst' to the next block of data and returns the size; 0 on EOF. */
+  size_t read(char*& dst);
+
+  //! Copy construction not supported
+  uring_reader(const uring_reader&) = delete;
+  //! Assignment not supported
+  uring_reader& operator=(const uring_reader&) = delete;
+
+private:
+  /** Initializes the ring and starts reading; throws io_error on failure. */
+  uring_reader(int fd);
+
+  /** Queues a read into the specified buffer at the current offset. */
+  void prepare(size_t idx);
+  /** Submits queued reads to the kernel. */
+  void submit();
+  /** Waits for a single read to complete. */
+  void wait();
+  /** Waits for reads in flight and starts reading from the given offset. */
+  void restart(off_t offset);
+
+  struct buffer
+  {
+    buffer();
+
+    //! Buffer of BUF_SIZE bytes
+    std::unique_ptr<char[]> data;
+    //! Result of the last read; number of bytes read or -errno
+    int result;
+    //! Indicates if a read into this buffer is in flight
+    bool pending;
+  };
+
+  //! The io_uring instance used for this file
+  io_uring m_ring;
+  //! File descriptor of the file being read
+  int m_fd;
+  //! Buffers in the order in which they are handed out
+  std::vector<buffer> m_buffers;
+  //! Index of the next buffer to hand out
+  size_t m_next;
+  //! Number of reads submitted but not yet completed
+  size_t m_in_flight;
+  //! File offset of the next read to be queued
+  off_t m_offset;
+  //! File offset following the last byte handed out
+  off_t m_consumed;
+  //! Indicates if the previous buffer is held by the caller
+  bool m_handed_out;
+  //! Indicates if reads in flight must be discarded due to a short read
+  bool m_resync;
+  //! Indicates if EOF has been reached
+  bool m_eof;
+};
+
+uring_reader::buffer::buffer()
+  : data(new char[BUF_SIZE])
+  , result(0)
+  , pending(false)
+{}
+
+std::unique_ptr<uring_reader>
+uring_reader::create(FILE* file)
+{
+  struct stat info;
+  const int fd = fileno(file);
+  if (fstat(fd, &info) || !S_ISREG(info.st_mode)) {
+    // Pipes, etc. have no offsets, so reads cannot be queued ahead of time
+    return nullptr;
+  }
+
+  try {
+    return std::unique_ptr<uring_reader>(new uring_reader(fd));
+  } catch (const io_error&) {
+    // io_uring may be unsupported by or disabled in the running kernel
+    return nullptr;
+  }
+}
+
+uring_reader::uring_reader(int fd)
+  : m_ring()
+  , m_fd(fd)
+  , m_buffers(URING_QUEUE_DEPTH)
+  , m_next(0)
+  , m_in_flight(0)
+  , m_offset(0)
+  , m_consumed(0)
+  , m_handed_out(false)
+  , m_resync(false)
+  , m_eof(false)
+{
+  const int result = io_uring_queue_init(URING_QUEUE_DEPTH, &m_ring, 0);
+  if (result < 0) {
+    throw io_error("uring_reader: failed to initialize io_uring", -result);
+  }
+
+  try {
+    restart(0);
+  } catch (...) {
+    io_uring_queue_exit(&m_ring);
+    throw;
+  }
+}
+
+uring_reader::~uring_reader()
+{
+  // Buffers cannot be freed while the kernel may still write to them
+  while (m_in_flight) {
+    io_uring_cqe* cqe = nullptr;
+    const int result = io_uring_wait_cqe(&m_ring, &cqe);
+    if (result == 0) {
+      io_uring_cqe_seen(&m_ring, cqe);
+      m_in_flight--;
+    } else if (result != -EINTR) {
+      break;
+    }
+  }
+
+  io_uring_queue_exit(&m_ring);
+}
+
+size_t
+uring_reader::read(char*& dst)
+{
+  if (m_eof) {
+    return 0;
+  } else if (m_resync) {
+    restart(m_consumed);
+  } else if (m_handed_out) {
+    // The previous buffer is re-used for a read following those in flight
+    prepare((m_next + m_buffers.size() - 1) % m_buffers.size());
+    submit();
+    m_handed_out = false;
+  }
+
+  buffer& buf = m_buffers.at(m_next);
+  while (buf.pending) {
+    wait();
+  }
+
+  if (buf.result < 0) {
+    throw io_error("line_reader::refill_buffer: error reading file",
+                   -buf.result);
+  }
+
+  const size_t nread = buf.result;
+  m_next = (m_next + 1) % m_buffers.size();
+  m_consumed += nread;
+  m_handed_out = true;
+
+  if (!nread) {
+    m_eof = true;
+  } else if (nread < static_cast<size_t>(BUF_SIZE)) {
+    // Reads in flight assume that this block was filled; this normally only
+    // happens at EOF, in which case the restarted reads simply return 0 bytes
+    m_resync = true;
+  }
+
+  dst = buf.data.get();
+  return nread;
+}
+
+void
+uring_reader::prepare(size_t idx)
+{
+  buffer& buf = m_buffers.at(idx);
+  AR_DEBUG_ASSERT(!buf.pending);
+
+  io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+  // The ring has room for one read per buffer
+  AR_DEBUG_ASSERT(sqe);
+
+  io_uring_prep_read(sqe, m_fd, buf.data.get(), BUF_SIZE, m_offset);
+  io_uring_sqe_set_data(sqe, &buf);
+
+  buf.pending = true;
+  m_offset += BUF_SIZE;
+  m_in_flight++;
+}
+
+void
+uring_reader::submit()
+{
+  const int result = io_uring_submit(&m_ring);
+  if (result < 0) {
+    throw io_error("uring_reader: failed to submit reads", -result);
+  }
+}
+
+void
+uring_reader::wait()
+{
+  AR_DEBUG_ASSERT(m_in_flight);
+
+  io_uring_cqe* cqe = nullptr;
+  const int result = io_uring_wait_cqe(&m_ring, &cqe);
+  if (result == -EINTR) {
+    return;
+  } else if (result < 0) {
+    throw io_error("uring_reader: failed to wait for reads", -result);
+  }
+
+  buffer* buf = static_cast<buffer*>(io_uring_cqe_get_data(cqe));
+  buf->result = cqe->res;
+  buf->pending = false;
+
+  io_uring_cqe_seen(&m_ring, cqe);
+  m_in_flight--;
+}
+
+void
+uring_reader::restart(off_t offset)
+{
+  while (m_in_flight) {
+    wait();
+  }
+
+  m_next = 0;
+  m_offset = offset;
+  m_handed_out = false;
+  m_resync = false;
+
+  for (size_t i = 0; i < m_buffers.size(); ++i) {
+    prepare(i);
+  }
+
+  submit();
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'mmap_reader'
+
+//! Size of the windows of a memory mapped file handed out by 'mmap_reader'
+const size_t MMAP_WINDOW_SIZE = 1024 * 1024;
+
+/**
+ * Reads a regular file via a read-only memory mapping, handing out windows of
+ * MMAP_WINDOW_SIZE bytes in file order without copying the data. The kernel is
+ * asked to read the window following the current window ahead of time, and a
+ * window is dropped from the mapping once the next window is requested.
+ *
+ * Accessing a mapping past the end of a truncated file raises SIGBUS, and data
+ * appended to the file is not part of the mapping. Callers must therefore use
+ * 'changed' before each window, and switch to regular reads starting at
+ * 'offset' if the size of the file has changed. A file truncated while a
+ * window is in use may still result in SIGBUS, but only for that window.
+ */
+class mmap_reader
+{
+public:
+  /** Returns a reader for non-empty regular files, or null if mmap fails. */
+  static std::unique_ptr<mmap_reader> create(FILE* file);
+
+  /** Unmaps the file. */
+  ~mmap_reader();
+
+  /** Points 'dst' to the next window of data and returns the size; 0 on EOF. */
+  size_t read(char*& dst);
+
+  /** Returns true if the size of the file no longer matches the mapping. */
+  bool changed() const;
+
+  /** Returns the offset of the next window; i.e. the number of bytes read. */
+  size_t offset() const;
+
+  //! Copy construction not supported
+  mmap_reader(const mmap_reader&) = delete;
+  //! Assignment not supported
+  mmap_reader& operator=(const mmap_reader&) = delete;
+
+private:
+  /** Takes ownership of a mapping of the given size of the file 'fd'. */
+  mmap_reader(int fd, char* data, size_t size);
+
+  /** Asks the kernel to start reading the window at the given offset. */
+  void will_need(size_t offset);
+
+  //! Descriptor of the mapped file; owned by the caller
+  int m_fd;
+  //! Start of the mapping
+  char* m_data;
+  //! Size of the mapping, i.e. the size of the file when it was mapped
+  size_t m_size;
+  //! Offset of the next window to hand out
+  size_t m_offset;
+};
+
+std::unique_ptr<mmap_reader>
+mmap_reader::create(FILE* file)
+{
+  struct stat info;
+  const int fd = fileno(file);
+  if (fstat(fd, &info) || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+    // Pipes, etc. cannot be mapped, and empty files cannot be mapped
+    return nullptr;
+  } else if (static_cast<uintmax_t>(info.st_size) > SIZE_MAX) {
+    return nullptr;
+  }
+
+  const size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    // Falls back to regular reads, e.g. if the address space is exhausted
+    return nullptr;
+  }
+
+  return std::unique_ptr<mmap_reader>(
+    new mmap_reader(fd, static_cast<char*>(data), size));
+}
+
+mmap_reader::mmap_reader(int fd, char* data, size_t size)
+  : m_fd(fd)
+  , m_data(data)
+  , m_size(size)
+  , m_offset(0)
+{
+  // Advice is merely a hint, so failures are not treated as errors
+  madvise(m_data, m_size, MADV_SEQUENTIAL);
+  will_need(0);
+}
+
+mmap_reader::~mmap_reader()
+{
+  munmap(m_data, m_size);
+}
+
+size_t
+mmap_reader::read(char*& dst)
+{
+  if (m_offset >= m_size) {
+    return 0;
+  } else if (m_offset) {
+    // The previous window is no longer used by the caller; pages are still
+    // cached by the kernel, but no longer count towards our resident memory
+    madvise(
+      m_data + m_offset - MMAP_WINDOW_SIZE, MMAP_WINDOW_SIZE, MADV_DONTNEED);
+  }
+
+  const size_t size = std::min(MMAP_WINDOW_SIZE, m_size - m_offset);
+  dst = m_data + m_offset;
+  m_offset += size;
+  will_need(m_offset);
+
+  return size;
+}
+
+bool
+mmap_reader::changed() const
+{
+  struct stat info;
+  if (fstat(m_fd, &info)) {
+    // Errors are left for regular reads to report
+    return true;
+  }
+
+  return static_cast<uintmax_t>(info.st_size) != m_size;
+}
+
+size_t
+mmap_reader::offset() const
+{
+  return m_offset;
+}
+
+void
+mmap_reader::will_need(size_t offset)
+{
+  if (offset < m_size) {
+    const size_t size = std::min(MMAP_WINDOW_SIZE, m_size - offset);
+    madvise(m_data + offset, size, MADV_WILLNEED);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Implementations for 'gzip_inflater'
+
+gzip_inflater::gzip_inflater()
+  : m_stream()
+#if defined(USE_LIBISAL)
+  , m_header(new isal_gzip_header())
+  , m_header_read(false)
+{
+  m_stream.reset(new inflate_state());
+
+  isal_inflate_init(m_stream.get());
+  m_stream->crc_flag = ISAL_GZIP_NO_HDR_VER;
+}
+#else
+{
+  m_stream.reset(new z_stream());
+  m_stream->zalloc = nullptr;
+  m_stream->zfree = nullptr;
+  m_stream->opaque = nullptr;
+  m_stream->avail_in = 0;
+  m_stream->next_in = nullptr;
+
+  switch (inflateInit2(m_stream.get(), 15 + 16)) {
+    case Z_OK:
+      break;
+
+    case Z_MEM_ERROR:
+      THROW_GZIP_ERROR("insufficient memory");
+
+    case Z_VERSION_ERROR:
+      THROW_GZIP_ERROR("incompatible zlib version");
+
+    case Z_STREAM_ERROR:
+      THROW_GZIP_ERROR("invalid parameters");
+
+    default:
+      THROW_GZIP_ERROR("unknown error");
+  }
+}
+#endif
+
+gzip_inflater::~gzip_inflater()
+{
+#if !defined(USE_LIBISAL)
+  if (m_stream) {
+    inflateEnd(m_stream.get());
+  }
+#endif
+}
+
+void
+gzip_inflater::set_input(const char* data, size_t length)
+{
+  AR_DEBUG_ASSERT(needs_input());
+
+#if defined(USE_LIBISAL)
+  m_stream->next_in = reinterpret_cast<uint8_t*>(const_cast<char*>(data));
+#else
+  m_stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+#endif
+  m_stream->avail_in = length;
+}
+
+bool
+gzip_inflater::needs_input() const
+{
+  return !m_stream->avail_in;
+}
+
+size_t
+gzip_inflater::inflate(char* dst, size_t size)
+{
+#if defined(USE_LIBISAL)
+  if (!m_header_read) {
+    auto result = isal_read_gzip_header(m_stream.get(), m_header.get());
+    check_isal_return_code(__func__, result);
+    m_header_read = true;
+  }
+
+  m_stream->avail_out = size;
+  m_stream->next_out = reinterpret_cast<uint8_t*>(dst);
+
+  if (m_stream->avail_in &&
+      m_stream->block_state == isal_block_state::ISAL_BLOCK_FINISH) {
+    isal_inflate_reset(m_stream.get());
+  }
+
+  check_isal_return_code(__func__, isal_inflate(m_stream.get()));
+#else
+  m_stream->avail_out = size;
+  m_stream->next_out = reinterpret_cast<Bytef*>(dst);
+  switch (::inflate(m_stream.get(), Z_NO_FLUSH)) {
+    case Z_OK:
+    case Z_BUF_ERROR: /* input buffer empty or output buffer full */
+      break;
+
+    case Z_STREAM_END:
+      // Handle concatenated streams; causes unnecessary reset at EOF
+      if (inflateReset(m_stream.get()) != Z_OK) {
+        THROW_GZIP_ERROR("failed to reset stream");
+      }
+      break;
+
+    case Z_STREAM_ERROR:
+      THROW_GZIP_ERROR("inconsistent stream state");
+
+    default:
+      THROW_GZIP_ERROR("unknown error");
+  }
+#endif
+
+  return size - m_stream->avail_out;
+}
+
+void
+gzip_inflater::finish()
+{
+#if defined(USE_LIBISAL)
+  if (m_stream->block_state != isal_block_state::ISAL_BLOCK_FINISH) {
+    throw_gzip_error(__func__, nullptr, "incomplete gzip stream");
+  }
+#else
+  switch (inflateEnd(m_stream.get())) {
+    case Z_OK:
+      break;
+
+    case Z_STREAM_ERROR:
+      THROW_GZIP_ERROR("stream error");
+
+    default:
+      THROW_GZIP_ERROR("unknown error");
+  }
+
+  m_stream.reset();
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'line_reader'
 
 line_reader::line_reader(const std::string& fpath)
   : m_filename(fpath)
   , m_file(managed_writer::fopen(fpath, "rb"))
-  , m_gzip_stream(nullptr)
-#if defined(USE_LIBISAL)
-  , m_gzip_header(nullptr)
+#if defined(USE_LIBURING)
+  , m_uring()
 #endif
+  , m_mmap()
+  , m_gzip_stream(nullptr)
   , m_buffer(nullptr)
   , m_buffer_ptr(nullptr)
   , m_buffer_end(nullptr)
   , m_raw_buffer(new char[BUF_SIZE])
   , m_raw_buffer_end(m_raw_buffer + BUF_SIZE)
+  , m_format(block_format::text)
   , m_eof(false)
 {
   if (!m_file) {
     throw io_error("line_reader::open: failed to open file", errno);
   }
+
+#if defined(USE_LIBURING)
+  m_uring = uring_reader::create(m_file);
+  if (m_uring) {
+    // Raw buffers are owned by the uring_reader
+    delete[] m_raw_buffer;
+    m_raw_buffer = nullptr;
+    m_raw_buffer_end = nullptr;
+    return;
+  }
+#endif
+
+  m_mmap = mmap_reader::create(m_file);
+  if (m_mmap) {
+    // Raw buffers are windows into the memory mapped file
+    delete[] m_raw_buffer;
+    m_raw_buffer = nullptr;
+    m_raw_buffer_end = nullptr;
+  }
 }
 
 line_reader::~line_reader()
@@ -167,6 +928,18 @@ line_reader::~line_reader()
   try {
     close_buffers_gzip();
 
+#if defined(USE_LIBURING)
+    if (m_uring) {
+      m_raw_buffer = nullptr;
+      m_uring.reset();
+    }
+#endif
+
+    if (m_mmap) {
+      m_raw_buffer = nullptr;
+      m_mmap.reset();
+    }
+
     delete[] m_raw_buffer;
     m_raw_buffer = nullptr;
 
@@ -180,6 +953,14 @@ line_reader::~line_reader()
   }
 }
 
+void
+line_reader::prefetch()
+{
+#if _POSIX_C_SOURCE >= 200112L
+  posix_fadvise(fileno(m_file), 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+#endif
+}
+
 bool
 line_reader::getline(std::string& dst)
 {
@@ -210,6 +991,25 @@ line_reader::getline(std::string& dst)
   return !dst.empty();
 }
 
+size_t
+line_reader::read_block(std::string& dst, size_t size, block_format& format)
+{
+  dst.clear();
+  if (!m_buffer) {
+    initialize_buffers(true);
+  }
+
+  format = m_format;
+  if (m_format == block_format::bgzf) {
+    while (dst.size() < size && read_bgzf_member(dst)) {
+    }
+
+    return dst.size();
+  }
+
+  return read_buffered(dst, size);
+}
+
 void
 line_reader::refill_buffers()
 {
@@ -221,14 +1021,78 @@ line_reader::refill_buffers()
       refill_buffers_uncompressed();
     }
   } else {
-    refill_raw_buffer();
+    initialize_buffers(false);
+  }
+}
+
+void
+line_reader::initialize_buffers(bool raw)
+{
+  refill_raw_buffer();
+
+  if (identify_bgzf()) {
+    m_format = block_format::bgzf;
+  } else if (identify_gzip()) {
+    m_format = block_format::gzip;
+  }
 
-    if (identify_gzip()) {
-      initialize_buffers_gzip();
+  if (m_format != block_format::text && !raw) {
+    initialize_buffers_gzip();
+  } else {
+    refill_buffers_uncompressed();
+  }
+}
+
+size_t
+line_reader::read_buffered(std::string& dst, size_t size)
+{
+  size_t nread = 0;
+  while (nread < size) {
+    if (m_buffer_ptr == m_buffer_end) {
+      if (m_eof) {
+        break;
+      }
+
+      refill_buffers();
     } else {
-      refill_buffers_uncompressed();
+      const size_t length =
+        std::min<size_t>(size - nread, m_buffer_end - m_buffer_ptr);
+
+      dst.append(m_buffer_ptr, length);
+      m_buffer_ptr += length;
+      nread += length;
     }
   }
+
+  return nread;
+}
+
+bool
+line_reader::read_bgzf_member(std::string& dst)
+{
+  const size_t offset = dst.size();
+  size_t nread = read_buffered(dst, GZIP_HEADER_SIZE);
+  if (!nread) {
+    return false;
+  } else if (nread == GZIP_HEADER_SIZE) {
+    // The extra field (XLEN bytes) is needed to locate the BC subfield
+    const size_t xlen = read_le(dst.data() + offset + 10, 2);
+    nread += read_buffered(dst, xlen);
+
+    const size_t size = bgzf_member_size(dst.data() + offset, nread);
+    if (!size) {
+      throw gzip_error("line_reader::read_bgzf_member: non-BGZF member in "
+                       "BGZF file '" +
+                       m_filename + "'");
+    } else if (size >= nread + GZIP_TRAILER_SIZE &&
+               read_buffered(dst, size - nread) == size - nread) {
+      return true;
+    }
+  }
+
+  throw gzip_error("line_reader::read_bgzf_member: invalid or truncated BGZF "
+                   "member in '" +
+                   m_filename + "'");
 }
 
 void
@@ -242,6 +1106,41 @@ line_reader::refill_buffers_uncompressed()
 void
 line_reader::refill_raw_buffer()
 {
+#if defined(USE_LIBURING)
+  if (m_uring) {
+    const size_t nread = m_uring->read(m_raw_buffer);
+
+    // EOF set only once all data has been consumed
+    m_eof = !nread;
+    m_raw_buffer_end = m_raw_buffer + nread;
+    return;
+  }
+#endif
+
+  if (m_mmap) {
+    if (!m_mmap->changed()) {
+      const size_t nread = m_mmap->read(m_raw_buffer);
+
+      // EOF set only once all data has been consumed
+      m_eof = !nread;
+      m_raw_buffer_end = m_raw_buffer + nread;
+      return;
+    }
+
+    // The file was truncated or appended to since it was mapped; the
+    // remaining data is read using regular reads, to avoid SIGBUS errors
+    const off_t offset = static_cast<off_t>(m_mmap->offset());
+    m_raw_buffer = nullptr;
+    m_mmap.reset();
+
+    m_raw_buffer = new char[BUF_SIZE];
+    m_raw_buffer_end = m_raw_buffer + BUF_SIZE;
+    if (fseeko(m_file, offset, SEEK_SET)) {
+      throw io_error("line_reader::refill_buffer: error seeking in file",
+                     errno);
+    }
+  }
+
   const int nread = fread(m_raw_buffer, 1, BUF_SIZE, m_file);
 
   if (nread == BUF_SIZE) {
@@ -267,6 +1166,12 @@ line_reader::identify_gzip() const
   return true;
 }
 
+bool
+line_reader::identify_bgzf() const
+{
+  return bgzf_member_size(m_raw_buffer, m_raw_buffer_end - m_raw_buffer);
+}
+
 void
 line_reader::initialize_buffers_gzip()
 {
@@ -274,125 +1179,28 @@ line_reader::initialize_buffers_gzip()
   m_buffer_ptr = m_buffer + BUF_SIZE;
   m_buffer_end = m_buffer + BUF_SIZE;
 
-#if defined(USE_LIBISAL)
-  m_gzip_stream.reset(new inflate_state());
-  m_gzip_header.reset(new isal_gzip_header());
-
-  isal_inflate_init(m_gzip_stream.get());
-  m_gzip_stream->crc_flag = ISAL_GZIP_NO_HDR_VER;
-  m_gzip_stream->avail_in = m_raw_buffer_end - m_raw_buffer;
-  m_gzip_stream->next_in = reinterpret_cast<uint8_t*>(m_raw_buffer);
-
-  auto result = isal_read_gzip_header(m_gzip_stream.get(), m_gzip_header.get());
-  check_isal_return_code(__func__, result);
-#else
-  m_gzip_stream.reset(new z_stream());
-  m_gzip_stream->zalloc = nullptr;
-  m_gzip_stream->zfree = nullptr;
-  m_gzip_stream->opaque = nullptr;
-
-  m_gzip_stream->avail_in = m_raw_buffer_end - m_raw_buffer;
-  m_gzip_stream->next_in = reinterpret_cast<Bytef*>(m_raw_buffer);
-
-  switch (inflateInit2(m_gzip_stream.get(), 15 + 16)) {
-    case Z_OK:
-      break;
-
-    case Z_MEM_ERROR:
-      THROW_GZIP_ERROR("insufficient memory");
-
-    case Z_VERSION_ERROR:
-      THROW_GZIP_ERROR("incompatible zlib version");
-
-    case Z_STREAM_ERROR:
-      THROW_GZIP_ERROR("invalid parameters");
-
-    default:
-      THROW_GZIP_ERROR("unknown error");
-  }
-#endif
+  m_gzip_stream.reset(new gzip_inflater());
+  m_gzip_stream->set_input(m_raw_buffer, m_raw_buffer_end - m_raw_buffer);
 }
 
 void
 line_reader::refill_buffers_gzip()
 {
-#if defined(USE_LIBISAL)
-  if (!m_gzip_stream->avail_in) {
+  if (m_gzip_stream->needs_input()) {
     refill_raw_buffer();
-    m_gzip_stream->avail_in = m_raw_buffer_end - m_raw_buffer;
-    m_gzip_stream->next_in = reinterpret_cast<uint8_t*>(m_raw_buffer);
+    m_gzip_stream->set_input(m_raw_buffer, m_raw_buffer_end - m_raw_buffer);
   }
 
-  m_gzip_stream->avail_out = BUF_SIZE;
-  m_gzip_stream->next_out = reinterpret_cast<uint8_t*>(m_buffer);
-
-  if (m_gzip_stream->avail_in &&
-      m_gzip_stream->block_state == isal_block_state::ISAL_BLOCK_FINISH) {
-    isal_inflate_reset(m_gzip_stream.get());
-  }
-
-  check_isal_return_code(__func__, isal_inflate(m_gzip_stream.get()));
-
   m_buffer_ptr = m_buffer;
-  m_buffer_end = m_buffer + (BUF_SIZE - m_gzip_stream->avail_out);
-#else
-  if (!m_gzip_stream->avail_in) {
-    refill_raw_buffer();
-    m_gzip_stream->avail_in = m_raw_buffer_end - m_raw_buffer;
-    m_gzip_stream->next_in = reinterpret_cast<Bytef*>(m_raw_buffer);
-  }
-
-  m_gzip_stream->avail_out = BUF_SIZE;
-  m_gzip_stream->next_out = reinterpret_cast<Bytef*>(m_buffer);
-  switch (inflate(m_gzip_stream.get(), Z_NO_FLUSH)) {
-    case Z_OK:
-    case Z_BUF_ERROR: /* input buffer empty or output buffer full */
-      break;
-
-    case Z_STREAM_END:
-      // Handle concatenated streams; causes unnecessary reset at EOF
-      if (inflateReset(m_gzip_stream.get()) != Z_OK) {
-        THROW_GZIP_ERROR("failed to reset stream");
-      }
-      break;
-
-    case Z_STREAM_ERROR:
-      THROW_GZIP_ERROR("inconsistent stream state");
-
-    default:
-      THROW_GZIP_ERROR("unknown error");
-  }
-
-  m_buffer_ptr = m_buffer;
-  m_buffer_end = m_buffer + (BUF_SIZE - m_gzip_stream->avail_out);
-#endif
+  m_buffer_end = m_buffer + m_gzip_stream->inflate(m_buffer, BUF_SIZE);
 }
 
 void
 line_reader::close_buffers_gzip()
 {
   if (m_gzip_stream) {
-#if defined(USE_LIBISAL)
-    if (m_gzip_stream->block_state != isal_block_state::ISAL_BLOCK_FINISH) {
-      throw_gzip_error(__func__, nullptr, "incomplete gzip stream");
-    }
-
-    m_gzip_stream.reset();
-    m_gzip_header.reset();
-#else
-    switch (inflateEnd(m_gzip_stream.get())) {
-      case Z_OK:
-        break;
-
-      case Z_STREAM_ERROR:
-        THROW_GZIP_ERROR("stream error");
-
-      default:
-        THROW_GZIP_ERROR("unknown error");
-    }
-
+    m_gzip_stream->finish();
     m_gzip_stream.reset();
-#endif
 
     delete[] m_buffer;
     m_buffer = nullptr;
@@ -23,15 +23,22 @@
 \*************************************************************************/
 #pragma once
 
-#include <ios>    // for ios_base, ios_base::failure
-#include <memory> // for unique_ptr
-#include <string> // for string
-#include <zlib.h> // for gzFile
+#include <ios>      // for ios_base, ios_base::failure
+#include <memory>   // for unique_ptr
+#include <stddef.h> // for size_t
+#include <string>   // for string
+#include <zlib.h>   // for gzFile
 
 #if defined(USE_LIBISAL)
 #include <isa-l/igzip_lib.h> // for inflate_state, etc.
 #endif
 
+class mmap_reader;
+
+#if defined(USE_LIBURING)
+class uring_reader;
+#endif
+
 /** Represents errors during basic IO. */
 class io_error : public std::ios_base::failure
 {
@@ -46,6 +53,81 @@ public:
   gzip_error(const std::string& message);
 };
 
+/**
+ * Returns the total size of the BGZF member starting at 'data', as recorded in
+ * the BSIZE field of the gzip header, or 0 if 'data' does not start with a
+ * (complete) BGZF header. BGZF members are regular gzip members with a 'BC'
+ * extra subfield, allowing members to be located without decompression.
+ */
+size_t
+bgzf_member_size(const char* data, size_t length);
+
+/**
+ * Decompresses the complete BGZF members in 'src', replacing the contents of
+ * 'dst' with the decompressed data. Errors are reported using 'gzip_error'.
+ */
+void
+bgzf_decompress(const std::string& src, std::string& dst);
+
+/** Format of blocks of raw data returned by 'line_reader::read_block'. */
+enum class block_format
+{
+  //! Uncompressed text
+  text,
+  //! Part of one or more gzip streams; must be decompressed in order
+  gzip,
+  //! Complete BGZF members; may be decompressed independently
+  bgzf,
+};
+
+/**
+ * Incremental decompression of a gzip stream, or of several concatenated gzip
+ * streams, split arbitrarily across input buffers. Uses isa-l if available and
+ * zlib otherwise. Errors are reported using 'gzip_error'.
+ */
+class gzip_inflater
+{
+public:
+  /** Constructor; throws on errors. */
+  gzip_inflater();
+
+  /** Frees the stream. */
+  ~gzip_inflater();
+
+  /**
+   * Sets the next buffer of compressed data; the buffer must remain valid
+   * until it has been consumed (see 'needs_input').
+   */
+  void set_input(const char* data, size_t length);
+
+  /** Returns true if all input has been consumed. */
+  bool needs_input() const;
+
+  /** Decompresses up to 'size' bytes into 'dst', returning the output size. */
+  size_t inflate(char* dst, size_t size);
+
+  /** Checks that the input ended with a complete stream. */
+  void finish();
+
+  //! Copy construction not supported
+  gzip_inflater(const gzip_inflater&) = delete;
+  //! Assignment not supported
+  gzip_inflater& operator=(const gzip_inflater&) = delete;
+
+private:
+#if defined(USE_LIBISAL)
+  //! GZip stream state
+  std::unique_ptr<inflate_state> m_stream;
+  //! GZip header; read as part of the first call to 'inflate'
+  std::unique_ptr<isal_gzip_header> m_header;
+  //! Indicates if the header has been read
+  bool m_header_read;
+#else
+  //! GZip stream state
+  std::unique_ptr<z_stream> m_stream;
+#endif
+};
+
 /** Base-class for line reading; used by receivers. */
 class line_reader_base
 {
@@ -81,6 +163,21 @@ public:
   /** Reads a line into dst, returning false on EOF. */
   bool getline(std::string& dst);
 
+  /**
+   * Hints that the start of the file will be read soon, allowing the OS to
+   * read it in the background; used for files that are opened ahead of time.
+   */
+  void prefetch();
+
+  /**
+   * Reads a block of raw data into dst, returning the number of bytes read, or
+   * 0 on EOF. Data is not decompressed, but 'format' is set to indicate how the
+   * data is to be decompressed; blocks of BGZF compressed data consist of
+   * complete members. Blocks are not aligned to lines and 'getline' should not
+   * be used on the same file.
+   */
+  size_t read_block(std::string& dst, size_t size, block_format& format);
+
   //! Copy construction not supported
   line_reader(const line_reader&) = delete;
   //! Assignment not supported
@@ -89,6 +186,18 @@ public:
 private:
   //! Refills 'm_buffer' and sets 'm_buffer_ptr' and 'm_buffer_end'.
   void refill_buffers();
+  /**
+   * Fills the buffers for the first time; if 'raw' is set, compressed data
+   * is not decompressed, for use by 'read_block'.
+   */
+  void initialize_buffers(bool raw);
+  /**
+   * Appends up to 'size' bytes of buffered data to 'dst', refilling the
+   * buffers as needed; fewer than 'size' bytes are appended only at EOF.
+   */
+  size_t read_buffered(std::string& dst, size_t size);
+  /** Appends a BGZF member to 'dst', returning false on EOF. */
+  bool read_bgzf_member(std::string& dst);
 
   //! Filename of file
   std::string m_filename;
@@ -99,16 +208,20 @@ private:
   /** Points 'm_buffer' and other points to corresponding 'm_raw_buffer's. */
   void refill_buffers_uncompressed();
 
-#if defined(USE_LIBISAL)
-  std::unique_ptr<inflate_state> m_gzip_stream;
-  std::unique_ptr<isal_gzip_header> m_gzip_header;
-#else
-  //! GZip stream pointer; used if input it detected to be gzip compressed.
-  std::unique_ptr<z_stream> m_gzip_stream;
+#if defined(USE_LIBURING)
+  //! Keeps reads in flight ahead of the parser; null if io_uring is not used.
+  std::unique_ptr<uring_reader> m_uring;
 #endif
+  //! Hands out windows of the input file; null if the file is not mapped.
+  std::unique_ptr<mmap_reader> m_mmap;
+
+  //! GZip stream; used if input it detected to be gzip compressed.
+  std::unique_ptr<gzip_inflater> m_gzip_stream;
 
   /** Returns true if the raw buffer contains gzip'd data. */
   bool identify_gzip() const;
+  /** Returns true if the raw buffer contains a BGZF header. */
+  bool identify_bgzf() const;
   /** Initializes gzip stream and output buffers. */
   void initialize_buffers_gzip();
   /** Refills 'm_buffer' from compressed data; may refill raw buffers. */
@@ -128,6 +241,8 @@ private:
   //! Pointer to end of current raw buffer.
   char* m_raw_buffer_end;
 
+  //! Format of the file, as returned by 'read_block'.
+  block_format m_format;
   //! Indicates if a read across the EOF has been attempted.
   bool m_eof;
 };
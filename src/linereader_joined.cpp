@@ -21,15 +21,18 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#include <vector> // for vector
+#include <utility> // for move
+#include <vector>  // for vector
 
 #include "linereader_joined.hpp"
 
 joined_line_readers::joined_line_readers(const string_vec& filenames)
   : m_filenames(filenames.rbegin(), filenames.rend())
   , m_reader()
+  , m_next_reader()
   , m_filename()
   , m_current_line(0)
+  , m_file_number(0)
 {}
 
 joined_line_readers::~joined_line_readers() {}
@@ -47,6 +50,28 @@ joined_line_readers::getline(std::string& dst)
   }
 }
 
+size_t
+joined_line_readers::read_block(std::string& dst,
+                                size_t size,
+                                block_format& format)
+{
+  dst.clear();
+
+  while (true) {
+    if (m_reader) {
+      const size_t nread = m_reader->read_block(dst, size, format);
+      if (nread) {
+        return nread;
+      }
+    }
+
+    if (!open_next_file()) {
+      format = block_format::text;
+      return 0;
+    }
+  }
+}
+
 const std::string&
 joined_line_readers::filename() const
 {
@@ -59,6 +84,12 @@ joined_line_readers::linenumber() const
   return m_current_line;
 }
 
+size_t
+joined_line_readers::file_number() const
+{
+  return m_file_number;
+}
+
 bool
 joined_line_readers::open_next_file()
 {
@@ -67,11 +98,28 @@ joined_line_readers::open_next_file()
     return false;
   }
 
-  m_reader.reset(new line_reader(m_filenames.back()));
+  if (m_next_reader) {
+    m_reader = std::move(m_next_reader);
+  } else {
+    m_reader.reset(new line_reader(m_filenames.back()));
+  }
+
   m_filename = m_filenames.back();
   m_current_line = 1;
+  m_file_number++;
 
   m_filenames.pop_back();
 
+  // The next file is opened ahead of time, so that the OS can start reading it
+  // before it is needed; failures are instead reported once it is needed
+  if (!m_filenames.empty()) {
+    try {
+      m_next_reader.reset(new line_reader(m_filenames.back()));
+      m_next_reader->prefetch();
+    } catch (const io_error&) {
+      m_next_reader.reset();
+    }
+  }
+
   return true;
 }
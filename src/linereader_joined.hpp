@@ -28,7 +28,7 @@
 #include <string>   // for string
 
 #include "commontypes.hpp" // for string_vec
-#include "linereader.hpp"  // for line_reader_base
+#include "linereader.hpp"  // for line_reader_base, block_format
 
 /**
  * Multi-file line-reader
@@ -53,10 +53,20 @@ public:
    */
   bool getline(std::string& dst);
 
+  /**
+   * Reads a block from the currently open file using line_reader::read_block;
+   * if EOF is encountered, the currently open file is closed and the next file
+   * is opened. Blocks never span files. Returns the number of (raw) bytes
+   * read, or 0 if no files remain.
+   */
+  size_t read_block(std::string& dst, size_t size, block_format& format);
+
   /** Currently open file; empty if no file is open. */
   const std::string& filename() const;
   /** Line number in the current file (1-based); 0 if no file is open. */
   size_t linenumber() const;
+  /** Number of files opened so far; identifies the currently open file. */
+  size_t file_number() const;
 
   //! Copy construction not supported
   joined_line_readers(const joined_line_readers&) = delete;
@@ -66,7 +76,8 @@ public:
 private:
   /**
    * Open the next file, removes it from the queue, and returns true; returns
-   * false if no files remain to be processed.
+   * false if no files remain to be processed. The file following it, if any,
+   * is opened ahead of time and its start is read in the background.
    */
   bool open_next_file();
 
@@ -74,8 +85,12 @@ private:
   string_vec m_filenames;
   //! Currently open file, if any.
   std::unique_ptr<line_reader> m_reader;
+  //! The next file, if any, opened ahead of time; see 'open_next_file'.
+  std::unique_ptr<line_reader> m_next_reader;
   //! The currently open file
   std::string m_filename;
   //! Current line across all files.
   size_t m_current_line;
+  //! Number of files opened so far.
+  size_t m_file_number;
 };
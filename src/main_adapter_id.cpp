@@ -34,11 +34,11 @@
 
 #include "adapterset.hpp"  // for adapter_set
 #include "alignment.hpp"   // for align_paired_ended_sequences, extract_ada...
-#include "commontypes.hpp" // for fastq_vec
 #include "debug.hpp"       // for AR_DEBUG_ASSERT
 #include "fastq.hpp"       // for fastq, ACGT_TO_IDX, fastq_pair_vec, IDX_T...
-#include "fastq_io.hpp"    // for fastq_read_chunk, read_fastq, read_chunk_ptr
-#include "scheduler.hpp"   // for threadstate, scheduler, analytical_step
+#include "fastq_io.hpp"    // for fastq_read_chunk, add_read_steps, read_...
+#include "read_batch.hpp"  // for read_batch
+#include "scheduler.hpp"   // for threadstate, scheduler, typed_step
 #include "userconfig.hpp"  // for userconfig, fastq_encoding_ptr
 #include "vecutils.hpp"    // for merge_vectors
 
@@ -321,11 +321,11 @@ public:
 ///////////////////////////////////////////////////////////////////////////////
 // Threaded adapter identification step
 
-class adapter_identification : public analytical_step
+class adapter_identification : public typed_step<fastq_read_chunk>
 {
 public:
   adapter_identification(const userconfig& config)
-    : analytical_step(processing_order::unordered)
+    : typed_step(processing_order::unordered)
     , m_config(config)
     , m_stats()
   {
@@ -334,11 +334,10 @@ public:
     }
   }
 
-  chunk_vec process(analytical_chunk* chunk)
+  chunk_vec process_chunk(read_chunk_ptr file_chunk)
   {
-    AR_DEBUG_ASSERT(chunk);
-    read_chunk_ptr file_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
     AR_DEBUG_ASSERT(file_chunk);
+    file_chunk->begin_processing();
 
     const fastq empty_adapter("dummy", "", "");
     fastq_pair_vec adapters;
@@ -350,14 +349,14 @@ public:
     auto stats = m_stats.acquire();
 
     AR_DEBUG_ASSERT(file_chunk->reads_1.size() == file_chunk->reads_2.size());
-    fastq_vec::iterator read_1 = file_chunk->reads_1.begin();
-    fastq_vec::iterator read_2 = file_chunk->reads_2.begin();
-
-    while (read_1 != file_chunk->reads_1.end()) {
-      process_reads(aligner, *stats, *read_1++, *read_2++);
+    read_batch& reads_1 = file_chunk->reads_1;
+    read_batch& reads_2 = file_chunk->reads_2;
+    for (size_t i = 0; i < reads_1.size(); ++i) {
+      process_reads(aligner, *stats, reads_1, reads_2, i);
     }
 
     m_stats.release(stats);
+    fastq_read_chunk::release(file_chunk);
 
     return chunk_vec();
   }
@@ -392,30 +391,32 @@ public:
 private:
   void process_reads(const sequence_aligner& aligner,
                      adapter_stats& stats,
-                     fastq& read1,
-                     fastq& read2)
+                     read_batch& reads_1,
+                     read_batch& reads_2,
+                     size_t nth)
   {
     // Throws if read-names or mate numbering does not match
-    fastq::validate_paired_reads(read1, read2, m_config.mate_separator);
+    read_batch::validate_paired_reads(
+      reads_1, reads_2, nth, m_config.mate_separator);
 
     // Reverse complement to match the orientation of read1
-    read2.reverse_complement();
+    reads_2.reverse_complement(nth);
 
     const auto alignment =
-      aligner.align_paired_end(read1, read2, m_config.shift);
+      aligner.align_paired_end(reads_1, reads_2, nth, m_config.shift);
 
     if (m_config.is_good_alignment(alignment)) {
       stats.aligned_pairs++;
       if (m_config.can_merge_alignment(alignment)) {
-        if (extract_adapter_sequences(alignment, read1, read2)) {
+        if (extract_adapter_sequences(alignment, reads_1, reads_2, nth)) {
           stats.pairs_with_adapters++;
 
-          process_adapter(
-            read1.sequence(), stats.pcr1_counts, stats.pcr1_kmers);
+          const std::string pcr1(reads_1.sequence(nth), reads_1.length(nth));
+          process_adapter(pcr1, stats.pcr1_counts, stats.pcr1_kmers);
 
-          read2.reverse_complement();
-          process_adapter(
-            read2.sequence(), stats.pcr2_counts, stats.pcr2_kmers);
+          reads_2.reverse_complement(nth);
+          const std::string pcr2(reads_2.sequence(nth), reads_2.length(nth));
+          process_adapter(pcr2, stats.pcr2_counts, stats.pcr2_kmers);
         }
       }
     } else {
@@ -454,18 +455,17 @@ identify_adapter_sequences(const userconfig& config)
   std::cout << "Attempting to identify adapter sequences" << std::endl;
 
   scheduler sch;
+  sch.set_max_io_per_lane(config.io_threads);
+  sch.set_max_memory_usage(static_cast<size_t>(config.max_memory) << 20);
+  sch.set_trace_file(config.trace_file);
+  sch.set_scheduling_policy(config.scheduling);
 
-  // Step 3: Attempt to identify adapters through pair-wise alignments
-  const size_t identification_step =
+  // Step 2: Attempt to identify adapters through pair-wise alignments
+  const read_step_id identification_step =
     sch.add_step("identify_adapters", new adapter_identification(config));
 
-  // Step 2: Post-process and validate FASTQ reads
-  const size_t postproc_step = sch.add_step(
-    "post_process_fastq",
-    new post_process_fastq(config.io_encoding, identification_step));
-
-  // Step 1: Read input file(s)
-  sch.add_step("read_fastq", new read_fastq(config, postproc_step));
+  // Step 1: Read, decompress, parse, and validate input file(s)
+  add_read_steps(sch, config, identification_step);
 
   return !sch.run(config.max_threads);
 }
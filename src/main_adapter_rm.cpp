@@ -25,7 +25,6 @@
 #include <algorithm> // for max
 #include <cstring>   // for size_t
 #include <iostream>  // for operator<<, endl, basic_ostream, cerr
-#include <limits>    // for numeric_limits
 #include <memory>    // for unique_ptr
 #include <string>    // for operator+, string
 #include <vector>    // for vector
@@ -33,20 +32,21 @@
 #include "adapterset.hpp"     // for adapter_set
 #include "commontypes.hpp"    // for string_vec
 #include "demultiplexing.hpp" // for post_demux_steps, demultiplex_pe_reads
-#include "fastq_io.hpp"       // for gzip_fastq, gzip_split_fastq, read_fastq
+#include "fastq_io.hpp"       // for gzip_fastq, gzip_split_fastq, add_read...
 #include "reports.hpp"        // for write_report
 #include "scheduler.hpp"      // for scheduler
 #include "statistics.hpp"     // for trimming_statistics, ar_statistics
 #include "trimming.hpp"       // for pe_reads_processor, reads_processor
 #include "userconfig.hpp"     // for userconfig, output_files, output_sampl...
 
-size_t
+output_step_id
 add_write_step(const userconfig& config,
                scheduler& sch,
                const std::string& name,
                const std::string& filename)
 {
-  size_t step_id = sch.add_step("write_" + name, new write_fastq(filename));
+  output_step_id step_id =
+    sch.add_step("write_" + name, new write_fastq(filename));
 
   if (config.gzip_stream) {
     step_id = sch.add_step("gzip_" + name, new gzip_fastq(config, step_id));
@@ -66,13 +66,17 @@ remove_adapter_sequences(const userconfig& config)
   std::cerr << "Trimming reads" << std::endl;
 
   scheduler sch;
+  sch.set_max_io_per_lane(config.io_threads);
+  sch.set_max_memory_usage(static_cast<size_t>(config.max_memory) << 20);
+  sch.set_trace_file(config.trace_file);
+  sch.set_scheduling_policy(config.scheduling);
   std::vector<reads_processor*> processors;
   ar_statistics stats(config.report_sample_rate);
 
   auto out_files = config.get_output_filenames();
 
   post_demux_steps steps;
-  size_t processing_step = std::numeric_limits<size_t>::max();
+  read_step_id processing_step;
 
   // Step 4 - N: Trim and write (demultiplexed) reads
   for (size_t nth = 0; nth < config.adapters.adapter_set_count(); ++nth) {
@@ -116,18 +120,21 @@ remove_adapter_sequences(const userconfig& config)
     processing_step = steps.samples.back();
   }
 
-  // Step 2: Post-process, validate, and collect statistics on FASTQ reads
-  const size_t postproc_step = sch.add_step(
-    "post_process_fastq",
-    new post_process_fastq(config.io_encoding, processing_step, &stats));
+  // Step 2: Collect statistics on FASTQ reads
+  const read_step_id postproc_step =
+    sch.add_step("post_process_fastq",
+                 new post_process_fastq(config, processing_step, stats));
 
-  // Step 1: Read input file(s)
-  sch.add_step("read_fastq", new read_fastq(config, postproc_step));
+  // Step 1: Read, decompress, parse, and validate input file(s)
+  collect_fastq* collector = add_read_steps(sch, config, postproc_step);
 
   if (!sch.run(config.max_threads)) {
     return 1;
   }
 
+  stats.peak_memory_usage = sch.peak_memory_usage();
+  stats.chunk_sizes = collector->chunk_sizes();
+
   for (auto ptr : processors) {
     stats.trimming.push_back(*ptr->get_final_statistics());
   }
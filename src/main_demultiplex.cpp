@@ -25,26 +25,24 @@
 #include <algorithm> // for copy, max
 #include <cstring>   // for size_t
 #include <iostream>  // for operator<<, endl, basic_ostream, cerr
-#include <limits>    // for numeric_limits
 #include <memory>    // for unique_ptr
 #include <string>    // for string, operator+
 #include <vector>    // for vector, vector<>::iterator
 
 #include "adapterset.hpp"     // for adapter_set
-#include "commontypes.hpp"    // for fastq_vec, read_type, read_type::mate_1
+#include "commontypes.hpp"    // for read_type, read_type::mate_1
 #include "debug.hpp"          // for AR_DEBUG_ASSERT
 #include "demultiplexing.hpp" // for post_demux_steps, demultiplex_pe_reads
 #include "fastq_io.hpp"       // for fastq_read_chunk, read_chunk_ptr, read...
+#include "read_batch.hpp"     // for read_batch
 #include "reports.hpp"        // for write_report
 #include "scheduler.hpp"      // for scheduler, threadstate, analytical_chunk
 #include "statistics.hpp"     // for trimming_statistics, ar_statistics
 #include "trimming.hpp"       // for trimmed_reads, reads_processor
 #include "userconfig.hpp"     // for userconfig, output_files, output_sampl...
 
-class fastq;
-
 //! Implemented in main_adapter_rm.cpp
-size_t
+output_step_id
 add_write_step(const userconfig& config,
                scheduler& sch,
                const std::string& name,
@@ -59,19 +57,22 @@ public:
     : reads_processor(config, output, nth)
   {}
 
-  chunk_vec process(analytical_chunk* chunk)
+  chunk_vec process_chunk(read_chunk_ptr read_chunk)
   {
-    read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+    read_chunk->begin_processing();
 
     statistics_ptr stats = m_stats.acquire();
     trimmed_reads chunks(m_output, read_chunk->eof);
 
-    for (auto& read : read_chunk->reads_1) {
-      stats->read_1.process(read);
-      chunks.add(read, read_type::mate_1);
+    const read_batch& reads = read_chunk->reads_1;
+    for (size_t i = 0; i < reads.size(); ++i) {
+      stats->read_1.process(reads, i);
+      chunks.add(reads, i, read_type::mate_1);
     }
 
+    stats->flush();
     m_stats.release(stats);
+    fastq_read_chunk::release(read_chunk);
 
     return chunks.finalize();
   }
@@ -86,28 +87,27 @@ public:
     : reads_processor(config, output, nth)
   {}
 
-  chunk_vec process(analytical_chunk* chunk)
+  chunk_vec process_chunk(read_chunk_ptr read_chunk)
   {
-    read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
     AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
+    read_chunk->begin_processing();
 
     statistics_ptr stats = m_stats.acquire();
     trimmed_reads chunks(m_output, read_chunk->eof);
 
-    fastq_vec::iterator it_1 = read_chunk->reads_1.begin();
-    fastq_vec::iterator it_2 = read_chunk->reads_2.begin();
-    while (it_1 != read_chunk->reads_1.end()) {
-      fastq& read_1 = *it_1++;
-      fastq& read_2 = *it_2++;
-
-      stats->read_1.process(read_1);
-      stats->read_2.process(read_2);
+    const read_batch& reads_1 = read_chunk->reads_1;
+    const read_batch& reads_2 = read_chunk->reads_2;
+    for (size_t i = 0; i < reads_1.size(); ++i) {
+      stats->read_1.process(reads_1, i);
+      stats->read_2.process(reads_2, i);
 
-      chunks.add(read_1, read_type::mate_1);
-      chunks.add(read_2, read_type::mate_2);
+      chunks.add(reads_1, i, read_type::mate_1);
+      chunks.add(reads_2, i, read_type::mate_2);
     }
 
+    stats->flush();
     m_stats.release(stats);
+    fastq_read_chunk::release(read_chunk);
 
     return chunks.finalize();
   }
@@ -119,6 +119,10 @@ demultiplex_sequences(const userconfig& config)
   std::cerr << "Demultiplexing reads" << std::endl;
 
   scheduler sch;
+  sch.set_max_io_per_lane(config.io_threads);
+  sch.set_max_memory_usage(static_cast<size_t>(config.max_memory) << 20);
+  sch.set_trace_file(config.trace_file);
+  sch.set_scheduling_policy(config.scheduling);
   std::vector<reads_processor*> processors;
   ar_statistics stats(config.report_sample_rate);
 
@@ -144,7 +148,7 @@ demultiplex_sequences(const userconfig& config)
     steps.samples.push_back(sch.add_step("post_" + sample, processors.back()));
   }
 
-  size_t processing_step = std::numeric_limits<size_t>::max();
+  read_step_id processing_step;
 
   // Step 3: Parse and demultiplex reads based on single or double indices
   if (config.adapters.barcode_count()) {
@@ -170,18 +174,21 @@ demultiplex_sequences(const userconfig& config)
     processing_step = steps.samples.back();
   }
 
-  // Step 2: Post-process, validate, and collect statistics on FASTQ reads
-  const size_t postproc_step = sch.add_step(
-    "post_process_fastq",
-    new post_process_fastq(config.io_encoding, processing_step, &stats));
+  // Step 2: Collect statistics on FASTQ reads
+  const read_step_id postproc_step =
+    sch.add_step("post_process_fastq",
+                 new post_process_fastq(config, processing_step, stats));
 
-  // Step 1: Read input file(s)
-  sch.add_step("read_fastq", new read_fastq(config, postproc_step));
+  // Step 1: Read, decompress, parse, and validate input file(s)
+  collect_fastq* collector = add_read_steps(sch, config, postproc_step);
 
   if (!sch.run(config.max_threads)) {
     return 1;
   }
 
+  stats.peak_memory_usage = sch.peak_memory_usage();
+  stats.chunk_sizes = collector->chunk_sizes();
+
   for (auto ptr : processors) {
     stats.trimming.push_back(*ptr->get_final_statistics());
   }
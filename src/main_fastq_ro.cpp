@@ -25,22 +25,23 @@
 #include <cstring>  // for size_t
 #include <iostream> // for operator<<, endl, basic_ostream, cerr
 
-#include "fastq_io.hpp"   // for read_fastq
+#include "fastq_io.hpp"   // for add_read_steps, fastq_read_chunk
 #include "reports.hpp"    // for write_report
 #include "scheduler.hpp"  // for scheduler
 #include "statistics.hpp" // for ar_statistics
 #include "userconfig.hpp" // for userconfig, output_files
 
-class reads_sink : public analytical_step
+class reads_sink : public typed_step<fastq_read_chunk>
 {
 public:
   reads_sink()
-    : analytical_step(processing_order::unordered)
+    : typed_step(processing_order::unordered)
   {}
 
-  chunk_vec process(analytical_chunk* chunk)
+  chunk_vec process_chunk(read_chunk_ptr read_chunk)
   {
-    delete chunk;
+    fastq_read_chunk::release(read_chunk);
+
     return chunk_vec();
   }
 };
@@ -51,23 +52,30 @@ fastq_report_only(const userconfig& config)
   std::cerr << "Reading FASTQ files" << std::endl;
 
   scheduler sch;
+  sch.set_max_io_per_lane(config.io_threads);
+  sch.set_max_memory_usage(static_cast<size_t>(config.max_memory) << 20);
+  sch.set_trace_file(config.trace_file);
+  sch.set_scheduling_policy(config.scheduling);
   ar_statistics stats(config.report_sample_rate);
 
   // Discard all written reads
-  size_t sink_step = sch.add_step("sink", new reads_sink());
+  const read_step_id sink_step = sch.add_step("sink", new reads_sink());
 
-  // Step 2: Post-processing, validate, and collect statistics on FASTQ reads
-  const size_t postproc_step =
+  // Step 2: Collect statistics on FASTQ reads
+  const read_step_id postproc_step =
     sch.add_step("post_process_fastq",
-                 new post_process_fastq(config.io_encoding, sink_step, &stats));
+                 new post_process_fastq(config, sink_step, stats));
 
-  // Step 1: Read input file(s)
-  sch.add_step("read_fastq", new read_fastq(config, postproc_step));
+  // Step 1: Read, decompress, parse, and validate input file(s)
+  collect_fastq* collector = add_read_steps(sch, config, postproc_step);
 
   if (!sch.run(config.max_threads)) {
     return 1;
   }
 
+  stats.peak_memory_usage = sch.peak_memory_usage();
+  stats.chunk_sizes = collector->chunk_sizes();
+
   const auto out_files = config.get_output_filenames();
   return !write_json_report(config, stats, out_files.settings);
 }
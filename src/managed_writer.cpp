@@ -21,34 +21,69 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#include <cerrno>       // for errno, EMFILE
-#include <iostream>     // for cerr
-#include <mutex>        // for mutex, lock_guard
-#include <stdexcept>    // for runtime_error
-#include <system_error> // for errc, errc::too_many_files_open
-
-#if _POSIX_C_SOURCE >= 200112L
-#include <fcntl.h> // for posix_fadvise
-#endif
-
-#include "debug.hpp" // for AR_DEBUG_ASSERT
+#include <algorithm>          // for min
+#include <cerrno>             // for errno, EMFILE, EINTR
+#include <climits>            // for IOV_MAX
+#include <condition_variable> // for condition_variable
+#include <fcntl.h>            // for open, posix_fadvise, O_WRONLY, ...
+#include <iostream>           // for cerr
+#include <mutex>              // for mutex, lock_guard, unique_lock
+#include <stdexcept>          // for runtime_error
+#include <sys/uio.h>          // for writev, iovec
+#include <unistd.h>           // for close
+
+#include "debug.hpp"      // for AR_DEBUG_ASSERT
+#include "linereader.hpp" // for io_error
 #include "managed_writer.hpp"
 #include "threads.hpp" // for print_locker
 
 static std::mutex g_writer_lock;
+//! Signaled when a writer in use is returned to the list of open writers
+static std::condition_variable g_writer_released;
+//! Number of open writers currently removed from the list while in use
+static size_t g_writers_in_use = 0;
+
 managed_writer* managed_writer::s_head = nullptr;
 managed_writer* managed_writer::s_tail = nullptr;
 bool managed_writer::s_warning_printed = false;
 
+/** Writes the full contents of the vectors, retrying on partial writes. */
+static void
+write_vectors(const std::string& filename, int fd, iovec* iov, size_t count)
+{
+  while (count) {
+    const ssize_t written =
+      ::writev(fd, iov, static_cast<int>(std::min<size_t>(count, IOV_MAX)));
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      throw io_error("managed_writer::write: error writing to " + filename,
+                     errno);
+    }
+
+    size_t remaining = static_cast<size_t>(written);
+    while (count && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+
+    if (remaining) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+}
+
 managed_writer::managed_writer(const std::string& filename)
   : m_filename(filename)
-  , m_stream()
+  , m_fd(-1)
   , m_created(false)
   , m_prev(nullptr)
   , m_next(nullptr)
-{
-  m_stream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
-}
+{}
 
 managed_writer::~managed_writer()
 {
@@ -62,16 +97,17 @@ managed_writer::fopen(const std::string& filename, const char* mode)
 
   while (true) {
     FILE* handle = ::fopen(filename.c_str(), mode);
+
+    if (handle) {
 #if _POSIX_C_SOURCE >= 200112L
-    // Hint that we'll (only) be doing sequential reads
-    posix_fadvise(fileno(handle), 0, 0, POSIX_FADV_SEQUENTIAL);
+      // Hint that we'll (only) be doing sequential reads
+      posix_fadvise(fileno(handle), 0, 0, POSIX_FADV_SEQUENTIAL);
 #endif
 
-    if (handle) {
       return handle;
     } else if (errno == EMFILE) {
-      std::lock_guard<std::mutex> lock(g_writer_lock);
-      managed_writer::close_tail_writer();
+      std::unique_lock<std::mutex> lock(g_writer_lock);
+      managed_writer::close_tail_writer(lock);
     } else {
       return nullptr;
     }
@@ -81,33 +117,43 @@ managed_writer::fopen(const std::string& filename, const char* mode)
 void
 managed_writer::write_buffers(const buffer_vec& buffers, bool flush)
 {
-  std::lock_guard<std::mutex> lock(g_writer_lock);
   if (buffers.size() || flush) {
-    managed_writer::open_writer(this);
+    managed_writer::acquire_writer(this);
 
-    for (auto& buf : buffers) {
-      if (buf.first) {
-        m_stream.write(reinterpret_cast<char*>(buf.second.get()), buf.first);
+    try {
+      std::vector<iovec> vectors;
+      vectors.reserve(buffers.size());
+      for (const auto& buf : buffers) {
+        if (buf.first) {
+          vectors.push_back(iovec{ buf.second.get(), buf.first });
+        }
       }
-    }
 
-    if (flush) {
-      m_stream.flush();
+      write_vectors(m_filename, m_fd, vectors.data(), vectors.size());
+    } catch (...) {
+      managed_writer::release_writer(this);
+      throw;
     }
+
+    managed_writer::release_writer(this);
   }
 }
 
 void
 managed_writer::write_string(const std::string& str, bool flush)
 {
-  std::lock_guard<std::mutex> lock(g_writer_lock);
   if (str.size() || flush) {
-    managed_writer::open_writer(this);
+    managed_writer::acquire_writer(this);
 
-    m_stream.write(str.data(), str.length());
-    if (flush) {
-      m_stream.flush();
+    try {
+      iovec vector{ const_cast<char*>(str.data()), str.length() };
+      write_vectors(m_filename, m_fd, &vector, str.empty() ? 0 : 1);
+    } catch (...) {
+      managed_writer::release_writer(this);
+      throw;
     }
+
+    managed_writer::release_writer(this);
   }
 }
 
@@ -117,9 +163,7 @@ managed_writer::close()
   std::lock_guard<std::mutex> lock(g_writer_lock);
 
   managed_writer::remove_writer(this);
-  if (m_stream.is_open()) {
-    m_stream.close();
-  }
+  close_fd();
 }
 
 const std::string&
@@ -129,22 +173,22 @@ managed_writer::filename() const
 }
 
 void
-managed_writer::open_writer(managed_writer* ptr)
+managed_writer::open_writer(managed_writer* ptr,
+                            std::unique_lock<std::mutex>& lock)
 {
-  const std::ios_base::openmode mode =
-    ptr->m_created ? std::ofstream::app : std::ofstream::trunc;
+  const int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+                    (ptr->m_created ? O_APPEND : O_TRUNC);
 
-  while (!ptr->m_stream.is_open()) {
-    try {
-      ptr->m_stream.open(ptr->m_filename, std::ofstream::binary | mode);
+  while (ptr->m_fd == -1) {
+    ptr->m_fd = ::open(ptr->m_filename.c_str(), flags, 0666);
+    if (ptr->m_fd != -1) {
       break;
-    } catch (const std::ofstream::failure&) {
-      if (errno != int(std::errc::too_many_files_open)) {
-        throw;
-      }
+    } else if (errno == EMFILE) {
+      managed_writer::close_tail_writer(lock);
+    } else if (errno != EINTR) {
+      throw io_error("managed_writer::open: failed to open " + ptr->m_filename,
+                     errno);
     }
-
-    managed_writer::close_tail_writer();
   }
 
   if (ptr != s_head) {
@@ -155,6 +199,33 @@ managed_writer::open_writer(managed_writer* ptr)
   ptr->m_created = true;
 }
 
+void
+managed_writer::acquire_writer(managed_writer* ptr)
+{
+  std::unique_lock<std::mutex> lock(g_writer_lock);
+  managed_writer::open_writer(ptr, lock);
+  // Writers in use are not in the list, and can therefore not be closed by
+  // other threads; this allows writes to proceed without holding the lock
+  managed_writer::remove_writer(ptr);
+  g_writers_in_use++;
+}
+
+void
+managed_writer::release_writer(managed_writer* ptr)
+{
+  {
+    std::lock_guard<std::mutex> lock(g_writer_lock);
+    AR_DEBUG_ASSERT(g_writers_in_use);
+    g_writers_in_use--;
+
+    if (ptr->m_fd != -1) {
+      managed_writer::add_head_writer(ptr);
+    }
+  }
+
+  g_writer_released.notify_all();
+}
+
 void
 managed_writer::remove_writer(managed_writer* ptr)
 {
@@ -214,7 +285,7 @@ managed_writer::add_head_writer(managed_writer* ptr)
 }
 
 void
-managed_writer::close_tail_writer()
+managed_writer::close_tail_writer(std::unique_lock<std::mutex>& lock)
 {
   AR_DEBUG_ASSERT(!s_head == !s_tail);
   if (!s_warning_printed) {
@@ -230,13 +301,33 @@ managed_writer::close_tail_writer()
   }
 
   if (s_tail) {
-    AR_DEBUG_ASSERT(s_tail->m_stream.is_open());
+    AR_DEBUG_ASSERT(s_tail->m_fd != -1);
 
-    s_tail->m_stream.close();
-    managed_writer::remove_writer(s_tail);
+    managed_writer* tail = s_tail;
+    managed_writer::remove_writer(tail);
+    tail->close_fd();
+    return;
+  } else if (g_writers_in_use) {
+    // All open writers are in use by other threads; wait for one to be
+    // returned to the list, after which the caller retries
+    g_writer_released.wait(lock);
     return;
   }
 
   throw std::runtime_error(
     "available number of file-handles too low; could not open any files");
 }
+
+void
+managed_writer::close_fd()
+{
+  if (m_fd != -1) {
+    const int result = ::close(m_fd);
+    m_fd = -1;
+
+    if (result) {
+      throw io_error("managed_writer::close: error closing " + m_filename,
+                     errno);
+    }
+  }
+}
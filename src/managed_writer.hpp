@@ -24,8 +24,8 @@
 #pragma once
 
 #include <cstdio>   // for FILE, fopen, fclose
-#include <fstream>  // for ofstream
 #include <memory>   // for unique_ptr
+#include <mutex>    // for mutex, unique_lock
 #include <stddef.h> // for size_t
 #include <string>   // for string
 #include <utility>  // for pair
@@ -41,7 +41,11 @@ typedef std::vector<buffer_pair> buffer_vec;
  * The file is lazily opened the first time a write is performed;
  * if the file cannot be opened due to the number of already open
  * files, the writer will close the least recently used handle and
- * retry.
+ * retry. Data is written directly to the file descriptor without
+ * additional buffering, and each list of buffers is written using
+ * a single call to writev where possible.
+ *
+ * Errors are reported using 'io_error'.
  */
 class managed_writer
 {
@@ -57,7 +61,12 @@ public:
    */
   static FILE* fopen(const std::string& filename, const char* mode);
 
+  /**
+   * Writes the buffers in order. Writes are not buffered, so 'flush' only
+   * ensures that the file is created even if there is nothing to write.
+   */
   void write_buffers(const buffer_vec& buffers, bool flush);
+  /** Writes the string; see 'write_buffers'. */
   void write_string(const std::string& buffer, bool flush);
 
   void close();
@@ -69,18 +78,28 @@ public:
 
 private:
   /* Ensure that the writer is open, closing existing files if nessesary. */
-  static void open_writer(managed_writer* ptr);
+  static void open_writer(managed_writer* ptr,
+                          std::unique_lock<std::mutex>& lock);
+  /* Opens the writer and removes it from the list for the duration of use. */
+  static void acquire_writer(managed_writer* ptr);
+  /* Returns an acquired writer to the list as the most recently used. */
+  static void release_writer(managed_writer* ptr);
   /* Removes the writer from the list of open writers. */
   static void remove_writer(managed_writer* ptr);
   /* Sets the writer as the most recently used writer. */
   static void add_head_writer(managed_writer* ptr);
-  /* Close the least recently used writer. */
-  static void close_tail_writer();
+  /**
+   * Close the least recently used writer. If all open writers are in use,
+   * this function instead waits until a writer is released.
+   */
+  static void close_tail_writer(std::unique_lock<std::mutex>& lock);
+  /* Closes the file descriptor, if open. */
+  void close_fd();
 
   //! Destination filename; is created lazily.
   std::string m_filename;
   //! Lazily opened, managed handle; may be closed to free up handles.
-  std::ofstream m_stream;
+  int m_fd;
   //! Indicates if the file has been created
   bool m_created;
 
@@ -0,0 +1,270 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2021 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * Schubert, et al. (2016). AdapterRemoval v2: rapid adapter trimming,   *
+ * identification, and read merging. BMC Research Notes, 12;9(1):88      *
+ * https://doi.org/10.1186/s13104-016-1900-2                             *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm> // for count, min
+#include <cstring>   // for memmove
+
+#include "debug.hpp"     // for AR_DEBUG_ASSERT
+#include "fastq_enc.hpp" // for fastq_encoding
+#include "read_batch.hpp"
+
+read_batch::read_batch()
+  : m_headers()
+  , m_sequences()
+  , m_qualities()
+  , m_header_offsets()
+  , m_header_lengths()
+  , m_offsets()
+  , m_lengths()
+{}
+
+void
+read_batch::clear()
+{
+  m_headers.clear();
+  m_sequences.clear();
+  m_qualities.clear();
+  m_header_offsets.clear();
+  m_header_lengths.clear();
+  m_offsets.clear();
+  m_lengths.clear();
+}
+
+size_t
+read_batch::memory_usage() const
+{
+  return m_headers.capacity() + m_sequences.capacity() +
+         m_qualities.capacity() +
+         (m_header_offsets.capacity() + m_header_lengths.capacity() +
+          m_offsets.capacity() + m_lengths.capacity()) *
+           sizeof(size_t);
+}
+
+void
+read_batch::add(const char* header,
+                size_t header_length,
+                const char* sequence,
+                const char* qualities,
+                size_t length)
+{
+  m_header_offsets.push_back(m_headers.size());
+  m_header_lengths.push_back(header_length);
+  m_headers.append(header, header_length);
+
+  m_offsets.push_back(m_sequences.size());
+  m_lengths.push_back(length);
+  m_sequences.append(sequence, length);
+  m_qualities.append(qualities, length);
+}
+
+void
+read_batch::add(const fastq& read)
+{
+  add(read.m_header.data(),
+      read.m_header.size(),
+      read.m_sequence.data(),
+      read.m_qualities.data(),
+      read.length());
+}
+
+void
+read_batch::add(const read_batch& other, size_t nth)
+{
+  AR_DEBUG_ASSERT(&other != this);
+
+  add(other.header(nth),
+      other.header_length(nth),
+      other.sequence(nth),
+      other.qualities(nth),
+      other.length(nth));
+}
+
+void
+read_batch::pop_back()
+{
+  AR_DEBUG_ASSERT(!empty());
+
+  // Data is only removed from the arenas if no other record refers to it
+  if (m_header_offsets.back() + m_header_lengths.back() == m_headers.size()) {
+    m_headers.resize(m_header_offsets.back());
+  }
+
+  if (m_offsets.back() + m_lengths.back() == m_sequences.size()) {
+    m_sequences.resize(m_offsets.back());
+    m_qualities.resize(m_offsets.back());
+  }
+
+  m_header_offsets.pop_back();
+  m_header_lengths.pop_back();
+  m_offsets.pop_back();
+  m_lengths.pop_back();
+}
+
+fastq
+read_batch::get(size_t nth) const
+{
+  // Records have already been validated, and are therefore copied as is
+  fastq read;
+  read.m_header.assign(header(nth), header_length(nth));
+  read.m_sequence.assign(sequence(nth), length(nth));
+  read.m_qualities.assign(qualities(nth), length(nth));
+
+  return read;
+}
+
+size_t
+read_batch::count_ns(size_t nth) const
+{
+  const char* nucleotides = sequence(nth);
+
+  return static_cast<size_t>(
+    std::count(nucleotides, nucleotides + length(nth), 'N'));
+}
+
+fastq::ntrimmed
+read_batch::trim_trailing_bases(size_t nth,
+                                const bool trim_ns,
+                                char low_quality,
+                                const bool preserve5p)
+{
+  const fastq::kept_bases kept = fastq::trailing_bases(sequence(nth),
+                                                       qualities(nth),
+                                                       length(nth),
+                                                       trim_ns,
+                                                       low_quality,
+                                                       preserve5p);
+
+  const fastq::ntrimmed summary(kept.first, length(nth) - kept.second);
+  truncate(nth, kept.first, kept.second - kept.first);
+
+  return summary;
+}
+
+fastq::ntrimmed
+read_batch::trim_windowed_bases(size_t nth,
+                                const bool trim_ns,
+                                char low_quality,
+                                const double window_size,
+                                const bool preserve5p)
+{
+  const fastq::kept_bases kept = fastq::windowed_bases(sequence(nth),
+                                                       qualities(nth),
+                                                       length(nth),
+                                                       trim_ns,
+                                                       low_quality,
+                                                       window_size,
+                                                       preserve5p);
+
+  const fastq::ntrimmed summary(kept.first, length(nth) - kept.second);
+  truncate(nth, kept.first, kept.second - kept.first);
+
+  return summary;
+}
+
+void
+read_batch::truncate(size_t nth, size_t pos, size_t len)
+{
+  size_t& length = m_lengths[nth];
+  AR_DEBUG_ASSERT(pos == 0 || pos <= length);
+
+  m_offsets[nth] += pos;
+  length = std::min(len, length - pos);
+}
+
+void
+read_batch::reverse_complement(size_t nth)
+{
+  fastq::reverse_complement(sequence(nth), qualities(nth), length(nth));
+}
+
+void
+read_batch::post_process(size_t nth, const fastq_encoding& encoding)
+{
+  fastq::clean_sequence(sequence(nth), length(nth));
+
+  encoding.decode(qualities(nth), length(nth));
+}
+
+void
+read_batch::extend(size_t nth,
+                   const char* sequence,
+                   const char* qualities,
+                   size_t length)
+{
+  size_t& offset = m_offsets[nth];
+  const size_t current_length = m_lengths[nth];
+
+  if (offset + current_length != m_sequences.size()) {
+    // The record is copied to the end of the arenas, where it can grow; the
+    // capacity is reserved first, so that the source of the copy stays valid
+    m_sequences.reserve(m_sequences.size() + current_length + length);
+    m_qualities.reserve(m_qualities.size() + current_length + length);
+
+    const size_t new_offset = m_sequences.size();
+    m_sequences.append(m_sequences.data() + offset, current_length);
+    m_qualities.append(m_qualities.data() + offset, current_length);
+    offset = new_offset;
+  }
+
+  m_sequences.append(sequence, length);
+  m_qualities.append(qualities, length);
+  m_lengths[nth] += length;
+}
+
+void
+read_batch::erase_header(size_t nth, size_t pos, size_t len)
+{
+  size_t& header_length = m_header_lengths[nth];
+  AR_DEBUG_ASSERT(pos + len <= header_length);
+
+  char* start = header(nth) + pos;
+  std::memmove(start, start + len, header_length - pos - len);
+  header_length -= len;
+}
+
+void
+read_batch::into_string(size_t nth, std::string& dst) const
+{
+  dst.push_back('@');
+  dst.append(header(nth), header_length(nth));
+  dst.push_back('\n');
+  dst.append(sequence(nth), length(nth));
+  dst.append("\n+\n", 3);
+  fastq_encoding::encode(qualities(nth), length(nth), dst);
+  dst.push_back('\n');
+}
+
+void
+read_batch::validate_paired_reads(read_batch& mate1,
+                                  read_batch& mate2,
+                                  size_t nth,
+                                  char mate_separator)
+{
+  fastq::validate_paired_reads(mate1.header(nth),
+                               mate1.header_length(nth),
+                               mate1.length(nth),
+                               mate2.header(nth),
+                               mate2.header_length(nth),
+                               mate2.length(nth),
+                               mate_separator);
+}
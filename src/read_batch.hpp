@@ -0,0 +1,224 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2021 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * If you use the program, please cite the paper:                        *
+ * Schubert, et al. (2016). AdapterRemoval v2: rapid adapter trimming,   *
+ * identification, and read merging. BMC Research Notes, 12;9(1):88      *
+ * https://doi.org/10.1186/s13104-016-1900-2                             *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#pragma once
+
+#include <stddef.h> // for size_t
+#include <string>   // for string
+#include <vector>   // for vector
+
+#include "fastq.hpp" // for fastq, fastq::ntrimmed, MATE_SEPARATOR
+
+class fastq_encoding;
+
+/**
+ * A batch of FASTQ records stored as a struct of arrays.
+ *
+ * The headers, sequences, and qualities of all records are stored back to
+ * back in one arena each, and records are described by offsets into and
+ * lengths of these arenas; sequences and qualities share offsets. Records are
+ * trimmed by adjusting offsets and lengths, without moving any data, and
+ * clearing a batch keeps the arenas, so that re-used batches stop allocating
+ * once the arenas have grown large enough.
+ *
+ * Records are identified by their index, and functions otherwise mirror those
+ * of 'fastq'. Pointers to the fields of records are invalidated when records
+ * are added or extended.
+ */
+class read_batch
+{
+public:
+  /** Constructs an empty batch. */
+  read_batch();
+
+  /** Returns the number of records in the batch. */
+  size_t size() const;
+  /** Returns true if the batch contains no records. */
+  bool empty() const;
+  /** Removes all records; the arenas are kept for re-use. */
+  void clear();
+  /** Returns the approximate number of bytes used by the batch. */
+  size_t memory_usage() const;
+
+  /**
+   * Appends a record; the header excludes the @, and the qualities must be
+   * Phred+33 encoded, unless 'post_process' is called for the record.
+   */
+  void add(const char* header,
+           size_t header_length,
+           const char* sequence,
+           const char* qualities,
+           size_t length);
+  /** Appends a copy of a FASTQ record. */
+  void add(const fastq& read);
+  /** Appends a copy of the nth record of another batch. */
+  void add(const read_batch& other, size_t nth);
+  /** Removes the last record. */
+  void pop_back();
+
+  /** Returns the header (excluding the @) of a record; not terminated. */
+  const char* header(size_t nth) const;
+  /** Returns the header (excluding the @) of a record; not terminated. */
+  char* header(size_t nth);
+  /** Returns the length of the header of a record. */
+  size_t header_length(size_t nth) const;
+  /** Returns the nucleotide sequence of a record; not terminated. */
+  const char* sequence(size_t nth) const;
+  /** Returns the nucleotide sequence of a record; not terminated. */
+  char* sequence(size_t nth);
+  /** Returns the Phred+33 encoded qualities of a record; not terminated. */
+  const char* qualities(size_t nth) const;
+  /** Returns the Phred+33 encoded qualities of a record; not terminated. */
+  char* qualities(size_t nth);
+  /** Returns the length of the sequence of a record. */
+  size_t length(size_t nth) const;
+
+  /** Returns a copy of a record. */
+  fastq get(size_t nth) const;
+
+  /** Returns the number of ambiguous nucleotides in a record (N). */
+  size_t count_ns(size_t nth) const;
+
+  /** See fastq::trim_trailing_bases. */
+  fastq::ntrimmed trim_trailing_bases(size_t nth,
+                                      const bool trim_ns = true,
+                                      char low_quality = -1,
+                                      const bool preserve5p = false);
+
+  /** See fastq::trim_windowed_bases. */
+  fastq::ntrimmed trim_windowed_bases(size_t nth,
+                                      const bool trim_ns = true,
+                                      char low_quality = -1,
+                                      const double window_size = 0.1,
+                                      const bool preserve5p = false);
+
+  /** See fastq::truncate; only the offset and length of the record change. */
+  void truncate(size_t nth, size_t pos = 0, size_t len = std::string::npos);
+
+  /** Reverse complements a record in place. */
+  void reverse_complement(size_t nth);
+
+  /** Validates and decodes a record in place; see fastq::post_process. */
+  void post_process(size_t nth, const fastq_encoding& encoding);
+
+  /**
+   * Appends bases to the sequence and qualities of a record; the record is
+   * first moved to the end of the arenas, unless it is already there. The
+   * bases must not belong to this batch.
+   */
+  void extend(size_t nth,
+              const char* sequence,
+              const char* qualities,
+              size_t length);
+
+  /** Removes 'len' characters from the header of a record, starting at pos. */
+  void erase_header(size_t nth, size_t pos, size_t len);
+
+  /** Appends a record to a string, in the same format as fastq::into_string */
+  void into_string(size_t nth, std::string& dst) const;
+
+  /** See fastq::validate_paired_reads; the nth records form the pair. */
+  static void validate_paired_reads(read_batch& mate1,
+                                    read_batch& mate2,
+                                    size_t nth,
+                                    char mate_separator = MATE_SEPARATOR);
+
+private:
+  //! Headers of records, excluding the @ sigil
+  std::string m_headers;
+  //! Nucleotide sequences of records
+  std::string m_sequences;
+  //! Phred+33 encoded quality scores; always the same size as 'm_sequences'
+  std::string m_qualities;
+
+  //! Offsets of headers in 'm_headers'
+  std::vector<size_t> m_header_offsets;
+  //! Lengths of headers
+  std::vector<size_t> m_header_lengths;
+  //! Offsets of sequences and qualities in 'm_sequences' and 'm_qualities'
+  std::vector<size_t> m_offsets;
+  //! Lengths of sequences and qualities
+  std::vector<size_t> m_lengths;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+
+inline size_t
+read_batch::size() const
+{
+  return m_lengths.size();
+}
+
+inline bool
+read_batch::empty() const
+{
+  return m_lengths.empty();
+}
+
+inline const char*
+read_batch::header(size_t nth) const
+{
+  return m_headers.data() + m_header_offsets[nth];
+}
+
+inline char*
+read_batch::header(size_t nth)
+{
+  return &m_headers[0] + m_header_offsets[nth];
+}
+
+inline size_t
+read_batch::header_length(size_t nth) const
+{
+  return m_header_lengths[nth];
+}
+
+inline const char*
+read_batch::sequence(size_t nth) const
+{
+  return m_sequences.data() + m_offsets[nth];
+}
+
+inline char*
+read_batch::sequence(size_t nth)
+{
+  return &m_sequences[0] + m_offsets[nth];
+}
+
+inline const char*
+read_batch::qualities(size_t nth) const
+{
+  return m_qualities.data() + m_offsets[nth];
+}
+
+inline char*
+read_batch::qualities(size_t nth)
+{
+  return &m_qualities[0] + m_offsets[nth];
+}
+
+inline size_t
+read_batch::length(size_t nth) const
+{
+  return m_lengths[nth];
+}
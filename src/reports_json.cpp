@@ -43,13 +43,24 @@
   if (const auto section##__LINE__ = (writer).start(key))
 
 void
-write_report_meta(const userconfig& config, json_writer& writer)
+write_report_meta(const userconfig& config,
+                  json_writer& writer,
+                  const ar_statistics& stats)
 {
   WITH_SECTION(writer, "meta")
   {
     writer.write("version", NAME + " " + VERSION);
     writer.write("command", config.args);
     writer.write_float("runtime", config.runtime());
+    writer.write_int("peak_memory_usage", stats.peak_memory_usage);
+
+    WITH_SECTION(writer, "input_chunk_size")
+    {
+      writer.write_int("chunks", stats.chunk_sizes.chunks);
+      writer.write_int("minimum", stats.chunk_sizes.minimum);
+      writer.write_int("maximum", stats.chunk_sizes.maximum);
+      writer.write_int("last", stats.chunk_sizes.last);
+    }
   }
 }
 
@@ -543,7 +554,7 @@ write_json_report(const userconfig& config,
 
     {
       json_writer writer(output);
-      write_report_meta(config, writer);
+      write_report_meta(config, writer, stats);
       write_report_summary(config, writer, stats);
       write_report_input(config, writer, stats);
       write_report_demultiplexing(config, writer, stats);
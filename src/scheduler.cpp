@@ -22,12 +22,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
 #include <algorithm>    // for max
+#include <array>        // for array
+#include <cerrno>       // for errno
+#include <cstring>      // for strerror
+#include <deque>        // for deque
 #include <exception>    // for exception
+#include <fstream>      // for ofstream
 #include <iostream>     // for operator<<, basic_ostream, endl, cerr
+#include <map>          // for map
+#include <sys/stat.h>   // for stat
 #include <system_error> // for system_error
 #include <thread>       // for thread
 
 #include "debug.hpp" // for AR_DEBUG_ASSERT
+#include "json.hpp"  // for json_writer
 #include "scheduler.hpp"
 #include "strutils.hpp" // for cli_formatter
 #include "threads.hpp"  // for print_locker, thread_abort
@@ -35,10 +43,23 @@
 ///////////////////////////////////////////////////////////////////////////////
 // analytical_chunk
 
-analytical_chunk::analytical_chunk() {}
+analytical_chunk::analytical_chunk()
+  : m_memory_charged(0)
+{}
 
 analytical_chunk::~analytical_chunk() {}
 
+size_t
+analytical_chunk::memory_usage() const
+{
+  return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// chunk_pool_base
+
+std::atomic<size_t> chunk_pool_base::s_memory_usage(0);
+
 ///////////////////////////////////////////////////////////////////////////////
 // analytical_step
 
@@ -111,59 +132,297 @@ private:
   chunk_vec m_chunks;
 };
 
+//! Number of chunks that ordered steps can buffer without locking; must be a
+//! power of two. Chunks further ahead are stored in a (locked) overflow queue.
+const size_t REORDER_BUFFER_SIZE = 256;
+
 struct scheduler_step
 {
-  scheduler_step(analytical_step* value, const std::string& name_)
+  scheduler_step(analytical_step* value, const std::string& name_, size_t id_)
     : ptr(value)
+    , active(false)
     , next_chunk(0)
     , last_chunk(0)
-    , queue()
+    , ring()
+    , lock()
+    , overflow()
+    , overflow_size(0)
     , name(name_)
-  {}
+    , id(id_)
+    , lane(0)
+  {
+    for (auto& slot : ring) {
+      slot.store(nullptr);
+    }
+  }
 
-  bool can_run(size_t chunk_id) const
+  ~scheduler_step()
   {
-    if (ptr->ordering() != processing_order::unordered) {
-      return (next_chunk == chunk_id);
+    for (auto& slot : ring) {
+      delete slot.exchange(nullptr);
+    }
+  }
+
+  /** Returns true if the step processes chunks in order. */
+  bool is_ordered() const
+  {
+    return ptr->ordering() != processing_order::unordered;
+  }
+
+  /** Returns true if the step involves disk IO. */
+  bool is_io() const { return ptr->ordering() == processing_order::ordered_io; }
+
+  /**
+   * Adds a chunk to an ordered step and returns true if the step was made
+   * runnable by this; the caller is responsible for queuing the step.
+   */
+  bool add_chunk(size_t chunk_id, chunk_ptr& data)
+  {
+    // 'next_chunk' only increases, so a stale value is merely conservative
+    if (chunk_id - next_chunk < REORDER_BUFFER_SIZE) {
+      auto& slot = ring.at(chunk_id % REORDER_BUFFER_SIZE);
+      AR_DEBUG_ASSERT(!slot.load());
+      slot.store(data.release());
+    } else {
+      std::lock_guard<std::mutex> guard(lock);
+      overflow.emplace_back(chunk_id, data);
+      overflow_size++;
+    }
+
+    return try_activate();
+  }
+
+  /**
+   * Fetches the next chunk for an active, ordered step, returning true on
+   * success; if the next chunk is not available, the step is marked inactive
+   * and false is returned.
+   */
+  bool next(data_chunk& chunk)
+  {
+    AR_DEBUG_ASSERT(active);
+
+    while (!take_next(chunk)) {
+      active = false;
+
+      // The next chunk may have been added after the check above, but before
+      // the step was marked inactive, in which case no one else will run it
+      if (!try_activate()) {
+        return false;
+      }
     }
 
     return true;
   }
 
-  bool has_next() const
+  /** Indicate that the current chunk has been processed. */
+  void advance() { next_chunk++; }
+
+  /** Returns the ID to be used for the next chunk from an ordered step. */
+  size_t next_id() { return last_chunk++; }
+
+  /** Returns the number of chunks waiting to be processed. */
+  size_t pending() const
   {
-    return queue.size() && queue.top().chunk_id == next_chunk;
+    size_t count = overflow_size;
+    for (const auto& slot : ring) {
+      count += slot.load() != nullptr;
+    }
+
+    return count;
   }
 
   //! Analytical step implementation
   std::unique_ptr<analytical_step> ptr;
-  //! The next chunk to be processed
-  size_t next_chunk;
+  //! Indicates if a thread is running or has queued this (ordered) step
+  std::atomic_bool active;
+  //! The next chunk to be processed; only modified by the active thread
+  std::atomic<size_t> next_chunk;
   //! The last chunk queued to the step;
   //! Used to correct numbering for sparse output from sequential steps
-  size_t last_chunk;
-  //! (Ordered) vector of chunks to be processed
-  chunk_queue queue;
+  std::atomic<size_t> last_chunk;
+  //! Chunks to be processed, indexed by chunk ID modulo the buffer size
+  std::array<std::atomic<analytical_chunk*>, REORDER_BUFFER_SIZE> ring;
+  //! Lock used to control access to 'overflow'
+  std::mutex lock;
+  //! (Ordered) chunks too far ahead of 'next_chunk' to fit in 'ring'
+  chunk_queue overflow;
+  //! The number of chunks in 'overflow'; allows checks without locking
+  std::atomic<size_t> overflow_size;
   //! Short name for step used for error reporting
   std::string name;
+  //! ID of the step; steps with lower IDs are further downstream
+  size_t id;
+  //! The IO lane used by this step, if the step involves IO
+  size_t lane;
 
   //! Copy construction not supported
   scheduler_step(const scheduler_step&) = delete;
   //! Assignment not supported
   scheduler_step& operator=(const scheduler_step&) = delete;
+
+private:
+  /** Marks the step as active if it is inactive and the next chunk is ready. */
+  bool try_activate()
+  {
+    bool expected = false;
+    return has_next() && active.compare_exchange_strong(expected, true);
+  }
+
+  /** Takes the next chunk from the ring or overflow queue, if available. */
+  bool take_next(data_chunk& chunk)
+  {
+    const size_t chunk_id = next_chunk;
+    auto data = ring.at(chunk_id % REORDER_BUFFER_SIZE).exchange(nullptr);
+    if (data) {
+      chunk.chunk_id = chunk_id;
+      chunk.data.reset(data);
+
+      return true;
+    } else if (overflow_size) {
+      std::lock_guard<std::mutex> guard(lock);
+      if (!overflow.empty() && overflow.top().chunk_id == chunk_id) {
+        chunk = overflow.pop();
+        overflow_size--;
+
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /** Returns true if the next chunk is available. */
+  bool has_next()
+  {
+    const size_t chunk_id = next_chunk;
+    if (ring.at(chunk_id % REORDER_BUFFER_SIZE).load()) {
+      return true;
+    } else if (overflow_size) {
+      std::lock_guard<std::mutex> guard(lock);
+      return !overflow.empty() && overflow.top().chunk_id == chunk_id;
+    }
+
+    return false;
+  }
+};
+
+/**
+ * A runnable task; unordered steps are queued with the chunk to be processed,
+ * while ordered steps fetch chunks from their own queue when run.
+ */
+struct scheduler_task
+{
+  scheduler_task()
+    : step()
+    , chunk()
+  {}
+
+  scheduler_task(const std::shared_ptr<scheduler_step>& step_)
+    : step(step_)
+    , chunk()
+  {}
+
+  scheduler_task(const std::shared_ptr<scheduler_step>& step_,
+                 size_t chunk_id,
+                 chunk_ptr& data)
+    : step(step_)
+    , chunk(chunk_id, data)
+  {}
+
+  //! The step to be run
+  std::shared_ptr<scheduler_step> step;
+  //! The chunk to be processed by an unordered step
+  data_chunk chunk;
+};
+
+typedef std::chrono::steady_clock trace_clock;
+
+/** Time spent by a thread processing a single chunk or waiting for work. */
+struct trace_event
+{
+  //! Name of the step processing the chunk, or of the activity
+  const std::string* name;
+  //! The ID of the chunk processed; not used when waiting
+  size_t chunk_id;
+  //! The time at which the event started
+  trace_clock::time_point start;
+  //! The time at which the event ended
+  trace_clock::time_point end;
 };
 
+//! Name used for trace events recording time spent waiting for work
+const std::string TRACE_WAIT = "wait";
+
+/** Per-thread queue of runnable tasks. */
+struct scheduler_worker
+{
+  scheduler_worker()
+    : lock()
+    , tasks()
+    , events()
+  {}
+
+  //! Lock used to control access to 'tasks'
+  std::mutex lock;
+  //! Runnable tasks; the owner takes from the back, others from the front
+  std::deque<scheduler_task> tasks;
+  //! Trace events recorded by the owning thread; only written by the owner
+  std::vector<trace_event> events;
+};
+
+/**
+ * Finds the ID of the device on which a file is located; for files that do not
+ * (yet) exist, the device of the parent directory is used instead.
+ */
+bool
+get_device_id(const std::string& filename, dev_t& device)
+{
+  struct stat info;
+  if (!stat(filename.c_str(), &info)) {
+    device = info.st_dev;
+    return true;
+  }
+
+  const size_t sep = filename.rfind('/');
+  const std::string dirname =
+    sep == std::string::npos ? "." : filename.substr(0, std::max<size_t>(sep, 1));
+
+  if (!stat(dirname.c_str(), &info)) {
+    device = info.st_dev;
+    return true;
+  }
+
+  return false;
+}
+
+scheduler::io_lane::io_lane()
+  : queue()
+  , active(0)
+{}
+
 scheduler::scheduler()
   : m_steps()
+  , m_workers()
+  , m_idle_lock()
   , m_condition()
+  , m_idle_workers(0)
   , m_chunk_counter(0)
   , m_tasks(0)
   , m_tasks_max(0)
   , m_live_tasks(0)
-  , m_queue_lock()
-  , m_queue_calc()
-  , m_queue_io()
-  , m_io_active(false)
+  , m_queued_tasks(0)
+  , m_io_lock()
+  , m_io_lanes()
+  , m_max_io_per_lane(1)
+  , m_reading(false)
+  , m_max_memory(0)
+  , m_task_memory(0)
+  , m_memory_usage(0)
+  , m_memory_peak(0)
+  , m_memory_chunk_max(0)
+  , m_policy(scheduling_policy::breadth_first)
+  , m_trace_file()
+  , m_trace_start()
   , m_errors(false)
 {}
 
@@ -175,11 +434,48 @@ scheduler::add_step(const std::string& name, analytical_step* step)
   AR_DEBUG_ASSERT(step);
 
   const size_t step_id = m_steps.size();
-  m_steps.emplace_back(new scheduler_step(step, name));
+  m_steps.emplace_back(new scheduler_step(step, name, step_id));
 
   return step_id;
 }
 
+void
+scheduler::set_max_io_per_lane(size_t n)
+{
+  AR_DEBUG_ASSERT(n >= 1);
+  m_max_io_per_lane = n;
+}
+
+void
+scheduler::set_max_memory_usage(size_t n)
+{
+  m_max_memory = n;
+}
+
+void
+scheduler::set_task_memory_usage(size_t n)
+{
+  m_task_memory = n;
+}
+
+size_t
+scheduler::peak_memory_usage() const
+{
+  return m_memory_peak;
+}
+
+void
+scheduler::set_trace_file(const std::string& filename)
+{
+  m_trace_file = filename;
+}
+
+void
+scheduler::set_scheduling_policy(scheduling_policy policy)
+{
+  m_policy = policy;
+}
+
 bool
 scheduler::run(int nthreads)
 {
@@ -187,13 +483,25 @@ scheduler::run(int nthreads)
   AR_DEBUG_ASSERT(nthreads >= 1);
   AR_DEBUG_ASSERT(!m_chunk_counter);
 
+  // Reading is additionally limited by memory usage if a budget is set
   m_tasks_max = static_cast<size_t>(nthreads) * 3;
+  if (!m_max_memory) {
+    // Chunks differ greatly in size, so a budget is always set per task
+    m_max_memory = m_tasks_max * m_task_memory;
+  }
+
+  assign_io_lanes();
+  m_trace_start = trace_clock::now();
+
+  for (int i = 0; i < nthreads; ++i) {
+    m_workers.emplace_back(new scheduler_worker());
+  }
 
   std::vector<std::thread> threads;
 
   try {
-    for (int i = 0; i < nthreads - 1; ++i) {
-      threads.emplace_back(run_wrapper, this);
+    for (int i = 1; i < nthreads; ++i) {
+      threads.emplace_back(run_wrapper, this, i);
     }
   } catch (const std::system_error& error) {
     print_locker lock;
@@ -204,7 +512,7 @@ scheduler::run(int nthreads)
   }
 
   // Run the main thread (the only thread in case of non-threaded mode)
-  run_wrapper(this);
+  run_wrapper(this, 0);
 
   for (auto& thread : threads) {
     try {
@@ -216,15 +524,21 @@ scheduler::run(int nthreads)
     }
   }
 
+  // Traces are also written on error, as they may help explain the failure
+  if (!m_trace_file.empty() && !write_trace()) {
+    set_errors_occured();
+  }
+
   if (errors_occured()) {
     return false;
   }
 
   for (auto& step : m_steps) {
-    if (!step->queue.empty()) {
+    const size_t pending = step->pending();
+    if (pending) {
       print_locker lock;
       std::cerr << "ERROR: Not all parts run for step " << step->name << "; "
-                << step->queue.size() << " parts left" << std::endl;
+                << pending << " parts left" << std::endl;
 
       set_errors_occured();
     }
@@ -247,10 +561,100 @@ scheduler::run(int nthreads)
 }
 
 void
-scheduler::run_wrapper(scheduler* sch)
+scheduler::assign_io_lanes()
+{
+  // Lane 0 is shared by IO steps for which the device could not be determined
+  std::map<dev_t, size_t> lanes;
+  m_io_lanes.clear();
+  m_io_lanes.emplace_back();
+
+  for (auto& step : m_steps) {
+    if (step->is_io()) {
+      const auto filenames = step->ptr->io_filenames();
+
+      dev_t device = 0;
+      if (!filenames.empty() && get_device_id(filenames.front(), device)) {
+        auto it = lanes.find(device);
+        if (it == lanes.end()) {
+          it = lanes.insert(std::make_pair(device, m_io_lanes.size())).first;
+          m_io_lanes.emplace_back();
+        }
+
+        step->lane = it->second;
+      }
+    }
+  }
+}
+
+bool
+scheduler::write_trace() const
+{
+  try {
+    std::ofstream output(m_trace_file, std::ofstream::out);
+    if (!output.is_open()) {
+      throw std::ofstream::failure(std::strerror(errno));
+    }
+
+    output.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+    {
+      json_writer writer(output);
+      writer.write("displayTimeUnit", "ms");
+      writer.start_list("traceEvents");
+
+      for (size_t worker_id = 0; worker_id < m_workers.size(); ++worker_id) {
+        {
+          const auto _section = writer.start();
+          writer.write("name", "thread_name");
+          writer.write("ph", "M");
+          writer.write_int("pid", 1);
+          writer.write_int("tid", worker_id);
+
+          const auto _args = writer.start("args");
+          writer.write("name", "worker " + std::to_string(worker_id));
+        }
+
+        for (const auto& event : m_workers.at(worker_id)->events) {
+          typedef std::chrono::duration<double, std::micro> microseconds;
+          const auto start = microseconds(event.start - m_trace_start);
+          const auto duration = microseconds(event.end - event.start);
+          const bool waiting = event.name == &TRACE_WAIT;
+
+          const auto _section = writer.start();
+          writer.write("name", *event.name);
+          writer.write("cat", waiting ? "wait" : "step");
+          writer.write("ph", "X");
+          writer.write_float("ts", start.count());
+          writer.write_float("dur", duration.count());
+          writer.write_int("pid", 1);
+          writer.write_int("tid", worker_id);
+
+          if (!waiting) {
+            const auto _args = writer.start("args");
+            writer.write_int("chunk", event.chunk_id);
+          }
+        }
+      }
+
+      writer.end_list();
+    }
+
+    output << std::endl;
+  } catch (const std::ios_base::failure& error) {
+    print_locker lock;
+    std::cerr << "ERROR: Failed to write trace to '" << m_trace_file << "':\n"
+              << cli_formatter::fmt(error.what()) << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+void
+scheduler::run_wrapper(scheduler* sch, size_t worker_id)
 {
   try {
-    return sch->do_run();
+    return sch->do_run(worker_id);
   } catch (const thread_abort&) {
     print_locker lock;
     std::cerr << "Aborting thread due to error." << std::endl;
@@ -265,109 +669,388 @@ scheduler::run_wrapper(scheduler* sch)
   }
 
   sch->set_errors_occured();
-  sch->m_condition.notify_all();
+  sch->wake_all_workers();
 }
 
 void
-scheduler::do_run()
+scheduler::do_run(size_t worker_id)
 {
-  std::unique_lock<std::mutex> lock(m_queue_lock);
+  scheduler_task task;
 
   while (!errors_occured()) {
-    step_ptr step;
-    if (!m_io_active && !m_queue_io.empty()) {
-      // Try to keep the disk busy by preferring IO tasks
-      step = m_queue_io.front();
-      m_queue_io.pop();
-      m_io_active = true;
-    } else if (!m_queue_calc.empty()) {
-      // Otherwise try do do some non-IO work
-      step = m_queue_calc.front();
-      m_queue_calc.pop();
-    } else if (!m_io_active && m_tasks < m_tasks_max) {
-      // If all (or no) tasks are running and IO is idle then read another chunk
-      m_tasks++;
-      m_live_tasks++;
-      m_io_active = true;
-      step = m_steps.back();
-      step->queue.emplace_back(m_chunk_counter++);
-    } else if (m_live_tasks) {
-      // There are either tasks running (which may produce new tasks) or tasks
-      // that cannot yet be run due to IO already being active.
-      m_condition.wait(lock);
-      continue;
-    } else {
-      // We break if there is no live tasks to prevent bugs in the scheduling
-      // from causing infinite loops. Leftover tasks are caught in `run`.
+    if (acquire_task(worker_id, task)) {
+      run_task(worker_id, task);
+    } else if (!wait_for_work(worker_id)) {
+      // There are no live tasks and no more data can be read; leftover tasks
+      // caused by bugs in the scheduling are caught in `run`.
       break;
     }
+  }
 
-    do {
-      data_chunk chunk = step->queue.pop();
+  // Signal any waiting threads
+  wake_all_workers();
+}
+
+bool
+scheduler::acquire_task(size_t worker_id, scheduler_task& task)
+{
+  // Try to keep the disk busy by preferring IO tasks, otherwise try to do
+  // some non-IO work, and finally read another chunk if IO is idle and the
+  // maximum number of tasks has not been reached.
+  return acquire_io_task(task) || acquire_own_task(worker_id, task) ||
+         steal_task(worker_id, task) || acquire_read_task(task);
+}
+
+bool
+scheduler::acquire_io_task(scheduler_task& task)
+{
+  std::lock_guard<std::mutex> lock(m_io_lock);
+  for (auto& lane : m_io_lanes) {
+    if (lane.active < m_max_io_per_lane && !lane.queue.empty()) {
+      task = scheduler_task(lane.queue.front());
+      lane.queue.pop();
+      lane.active++;
+
+      return true;
+    }
+  }
 
-      lock.unlock();
-      chunk_vec chunks = step->ptr->process(chunk.data.release());
-      lock.lock();
+  return false;
+}
+
+bool
+scheduler::acquire_own_task(size_t worker_id, scheduler_task& task)
+{
+  auto& worker = *m_workers.at(worker_id);
+
+  std::lock_guard<std::mutex> lock(worker.lock);
+  if (worker.tasks.empty()) {
+    return false;
+  }
+
+  take_task(worker, task, false);
+
+  return true;
+}
+
+bool
+scheduler::steal_task(size_t worker_id, scheduler_task& task)
+{
+  for (size_t i = 1; i < m_workers.size() && m_queued_tasks; ++i) {
+    auto& worker = *m_workers.at((worker_id + i) % m_workers.size());
+
+    std::lock_guard<std::mutex> lock(worker.lock);
+    if (!worker.tasks.empty()) {
+      take_task(worker, task, true);
+
+      return true;
+    }
+  }
 
-      if (chunks.empty() && step == m_steps.back()) {
-        // The source has stopped producing chunks; nothing more to do
-        m_tasks_max = 0;
+  return false;
+}
+
+void
+scheduler::take_task(scheduler_worker& worker,
+                     scheduler_task& task,
+                     bool stealing)
+{
+  auto& tasks = worker.tasks;
+  AR_DEBUG_ASSERT(!tasks.empty());
+
+  auto it = tasks.begin();
+  if (m_policy == scheduling_policy::depth_first) {
+    // Run the step furthest downstream, starting with the oldest chunk, in
+    // order to get chunks out of the pipeline as soon as possible
+    for (auto other = tasks.begin(); other != tasks.end(); ++other) {
+      if (other->step->id < it->step->id ||
+          (other->step->id == it->step->id &&
+           other->chunk.chunk_id < it->chunk.chunk_id)) {
+        it = other;
       }
+    }
+  } else if (!stealing) {
+    // The most recently added task is the most likely to be found in cache
+    it = tasks.end() - 1;
+  }
 
-      // Schedule each of the resulting blocks
-      for (auto& result : chunks) {
-        AR_DEBUG_ASSERT(result.first < m_steps.size());
-        step_ptr& recipient = m_steps.at(result.first);
-
-        // Inherit reference count from source chunk
-        auto next_id = chunk.chunk_id;
-        if (step->ptr->ordering() != processing_order::unordered) {
-          // Ordered steps are allowed to not return results, so the chunk
-          // numbering is remembered for down-stream steps
-          next_id = recipient->last_chunk++;
-        }
+  task = std::move(*it);
+  tasks.erase(it);
+  m_queued_tasks--;
+}
+
+bool
+scheduler::acquire_read_task(scheduler_task& task)
+{
+  const step_ptr& step = m_steps.back();
 
-        recipient->queue.emplace_back(next_id, std::move(result.second));
+  std::lock_guard<std::mutex> lock(m_io_lock);
+  if (!can_read()) {
+    return false;
+  }
 
-        if (recipient->can_run(next_id)) {
-          if (recipient->ptr->ordering() == processing_order::ordered_io) {
-            m_queue_io.push(recipient);
-          } else {
-            m_queue_calc.push(recipient);
-          }
+  m_tasks++;
+  m_live_tasks++;
+  m_reading = true;
+  if (step->is_io()) {
+    m_io_lanes.at(step->lane).active++;
+  }
 
-          m_live_tasks++;
-        }
+  // The source is only run by one thread at a time and always receives empty
+  // chunks, so these are not queued like chunks for other ordered steps
+  chunk_ptr data;
+  task = scheduler_task(step, m_chunk_counter++, data);
+
+  return true;
+}
+
+void
+scheduler::run_task(size_t worker_id, scheduler_task& task)
+{
+  const step_ptr step = std::move(task.step);
+
+  if (step->is_ordered() && step != m_steps.back()) {
+    // Continue processing this step using the same thread, if possible
+    data_chunk chunk;
+    while (!errors_occured() && step->next(chunk)) {
+      process_chunk(worker_id, step, chunk);
+
+      // Indicate that the next chunk can be processed
+      step->advance();
+    }
+  } else {
+    process_chunk(worker_id, step, task.chunk);
+  }
 
-        m_tasks++;
+  if (step->is_io() || step == m_steps.back()) {
+    {
+      // Unlock use of IO steps after finishing processing
+      std::lock_guard<std::mutex> lock(m_io_lock);
+      if (step->is_io()) {
+        m_io_lanes.at(step->lane).active--;
       }
 
-      if (chunks.size()) {
-        // This worked better than trying to be smart about it
-        m_condition.notify_all();
+      if (step == m_steps.back()) {
+        m_reading = false;
       }
+    }
+
+    // Workers woken while the lane was busy (or while input was being read)
+    // may have gone back to sleep, so another IO task or read is started now
+    wake_workers(1);
+  }
+
+  // Decrement number of running/runnable tasks
+  if (!--m_live_tasks) {
+    // Nothing is running, so idle threads may be able to terminate
+    wake_all_workers();
+  }
+}
+
+void
+scheduler::process_chunk(size_t worker_id,
+                         const step_ptr& step,
+                         data_chunk& chunk)
+{
+  const bool tracing = !m_trace_file.empty();
+  const auto start = tracing ? trace_clock::now() : trace_clock::time_point();
 
-      if (step->ptr->ordering() != processing_order::unordered) {
-        // Indicate that the next chunk can be processed
-        step->next_chunk++;
+  // The chunk may have changed size since it was produced, so the amount
+  // counted at that time is subtracted, instead of the current size
+  const size_t chunk_size = chunk.data ? chunk.data->m_memory_charged : 0;
+  chunk_vec chunks = step->ptr->process(chunk.data.release());
+
+  if (tracing) {
+    m_workers.at(worker_id)->events.push_back(
+      { &step->name, chunk.chunk_id, start, trace_clock::now() });
+  }
+
+  size_t results_size = 0;
+  size_t largest_result = 0;
+  for (const auto& result : chunks) {
+    const size_t result_size = result.second->memory_usage();
+    result.second->m_memory_charged = result_size;
+    largest_result = std::max(largest_result, result_size);
+    results_size += result_size;
+  }
+
+  size_t chunk_max = m_memory_chunk_max;
+  while (largest_result > chunk_max &&
+         !m_memory_chunk_max.compare_exchange_weak(chunk_max, largest_result)) {
+  }
+
+  update_memory_usage(results_size, chunk_size);
+
+  if (chunks.empty() && step == m_steps.back()) {
+    // The source has stopped producing chunks; nothing more to do
+    m_tasks_max = 0;
+  }
+
+  // Schedule each of the resulting blocks
+  size_t new_tasks = 0;
+  for (auto& result : chunks) {
+    AR_DEBUG_ASSERT(result.first < m_steps.size());
+    const step_ptr& recipient = m_steps.at(result.first);
+
+    // Inherit reference count from source chunk
+    auto next_id = chunk.chunk_id;
+    if (step->is_ordered()) {
+      // Ordered steps are allowed to not return results, so the chunk
+      // numbering is remembered for down-stream steps
+      next_id = recipient->next_id();
+    }
+
+    m_tasks++;
+
+    if (!recipient->is_ordered()) {
+      queue_task(worker_id, scheduler_task(recipient, next_id, result.second));
+      new_tasks++;
+    } else if (recipient->add_chunk(next_id, result.second)) {
+      if (recipient->is_io()) {
+        m_live_tasks++;
+
+        std::lock_guard<std::mutex> lock(m_io_lock);
+        m_io_lanes.at(recipient->lane).queue.push(recipient);
+      } else {
+        queue_task(worker_id, scheduler_task(recipient));
+      }
+
+      new_tasks++;
+    }
+  }
+
+  // One less task in memory
+  m_tasks--;
+
+  if (step->is_ordered()) {
+    // This thread may continue processing the step, so another thread is
+    // woken in case it is now possible to read another chunk
+    new_tasks++;
+  } else if (new_tasks) {
+    // This thread will fetch the newest task from its own queue
+    new_tasks--;
+  }
+
+  wake_workers(new_tasks);
+}
+
+void
+scheduler::update_memory_usage(size_t added, size_t removed)
+{
+  const size_t usage =
+    (m_memory_usage += added) + chunk_pool_base::memory_usage();
+  AR_DEBUG_ASSERT(m_memory_usage >= removed);
+  m_memory_usage -= removed;
+
+  // Results are added before the input is removed, so the peak is an upper
+  // bound if the step modified the input in place
+  size_t peak = m_memory_peak;
+  while (usage > peak && !m_memory_peak.compare_exchange_weak(peak, usage)) {
+  }
+}
+
+void
+scheduler::queue_task(size_t worker_id, scheduler_task&& task)
+{
+  m_live_tasks++;
+
+  auto& worker = *m_workers.at(worker_id);
+  std::lock_guard<std::mutex> lock(worker.lock);
+  worker.tasks.push_back(std::move(task));
+  m_queued_tasks++;
+}
+
+bool
+scheduler::wait_for_work(size_t worker_id)
+{
+  const bool tracing = !m_trace_file.empty();
+  const auto start = tracing ? trace_clock::now() : trace_clock::time_point();
+
+  bool work_available = true;
+  {
+    std::unique_lock<std::mutex> lock(m_idle_lock);
+
+    m_idle_workers++;
+    while (!errors_occured() && !has_work()) {
+      if (!m_live_tasks) {
+        work_available = false;
+        break;
       }
 
-      // One less task in memory
-      m_tasks--;
+      m_condition.wait(lock);
+    }
+    m_idle_workers--;
+  }
+
+  if (tracing) {
+    m_workers.at(worker_id)->events.push_back(
+      { &TRACE_WAIT, 0, start, trace_clock::now() });
+  }
 
-      // If possible continue processing this task using the same thread
-    } while (step->ptr->ordering() != processing_order::unordered &&
-             step->has_next() && !errors_occured());
+  return work_available;
+}
 
-    // Decrement number of running/runnable tasks
-    m_live_tasks--;
+bool
+scheduler::has_work()
+{
+  if (m_queued_tasks) {
+    return true;
+  }
 
-    // Unlock use of IO steps after finishing processing
-    if (step->ptr->ordering() == processing_order::ordered_io) {
-      m_io_active = false;
+  std::lock_guard<std::mutex> lock(m_io_lock);
+  for (const auto& lane : m_io_lanes) {
+    if (lane.active < m_max_io_per_lane && !lane.queue.empty()) {
+      return true;
     }
   }
 
-  // Signal any waiting threads
+  return can_read();
+}
+
+bool
+scheduler::can_read() const
+{
+  const step_ptr& step = m_steps.back();
+
+  if (m_policy == scheduling_policy::depth_first) {
+    // Input is only read once work for downstream steps has been started
+    if (m_queued_tasks) {
+      return false;
+    }
+
+    for (const auto& lane : m_io_lanes) {
+      if (!lane.queue.empty()) {
+        return false;
+      }
+    }
+  }
+
+  // Room is reserved for the chunk to be read, based on the largest chunk seen
+  // so far; reading is always possible if no chunks are held, to ensure that
+  // progress can be made when single chunks exceed the budget
+  const size_t usage = m_memory_usage + chunk_pool_base::memory_usage();
+
+  return !m_reading && m_tasks < m_tasks_max &&
+         (!m_max_memory || !m_tasks ||
+          usage + m_memory_chunk_max <= m_max_memory) &&
+         (!step->is_io() ||
+          m_io_lanes.at(step->lane).active < m_max_io_per_lane);
+}
+
+void
+scheduler::wake_workers(size_t n)
+{
+  if (n && m_idle_workers) {
+    std::lock_guard<std::mutex> lock(m_idle_lock);
+    for (size_t i = 0; i < n; ++i) {
+      m_condition.notify_one();
+    }
+  }
+}
+
+void
+scheduler::wake_all_workers()
+{
+  std::lock_guard<std::mutex> lock(m_idle_lock);
   m_condition.notify_all();
 }
@@ -24,7 +24,8 @@
 #pragma once
 
 #include <algorithm>          // for copy, max, copy_backward
-#include <atomic>             // for atomic_bool
+#include <atomic>             // for atomic, atomic_bool
+#include <chrono>             // for steady_clock
 #include <condition_variable> // for condition_variable
 #include <memory>             // for unique_ptr, shared_ptr
 #include <mutex>              // for mutex, lock_guard
@@ -37,6 +38,8 @@
 #include "debug.hpp" // for AR_DEBUG_ASSERT
 
 struct scheduler_step;
+struct scheduler_task;
+struct scheduler_worker;
 struct data_chunk;
 
 /** Simple thread-safe storage backed by a vector. **/
@@ -104,6 +107,76 @@ private:
   std::vector<pointer> m_values;
 };
 
+/** Tracks the total number of bytes held by all 'chunk_pool's. */
+class chunk_pool_base
+{
+public:
+  /** Returns the number of bytes held by chunks in all pools. */
+  static size_t memory_usage() { return s_memory_usage; }
+
+protected:
+  //! Number of bytes held by chunks in all pools
+  static std::atomic<size_t> s_memory_usage;
+};
+
+/**
+ * Thread-safe pool of chunks kept for re-use. Chunks in pools are counted
+ * towards the memory usage of the scheduler; see 'set_max_memory_usage'.
+ */
+template<typename T>
+class chunk_pool : public chunk_pool_base
+{
+public:
+  typedef std::unique_ptr<T> pointer;
+
+  chunk_pool()
+    : m_mutex()
+    , m_chunks()
+  {}
+
+  /** Takes a chunk from the pool, returning null if the pool is empty. */
+  pointer try_acquire()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    pointer chunk;
+    if (!m_chunks.empty()) {
+      s_memory_usage -= m_chunks.back().first;
+      chunk = std::move(m_chunks.back().second);
+      m_chunks.pop_back();
+    }
+
+    return chunk;
+  }
+
+  /**
+   * Adds a chunk to the pool, unless 'max_chunks' chunks are already pooled,
+   * in which case the chunk is freed instead.
+   */
+  void release(pointer& chunk, size_t max_chunks)
+  {
+    const size_t size = chunk->memory_usage();
+    // Excess chunks are freed after the lock has been released
+    pointer excess;
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+
+      if (m_chunks.size() < max_chunks) {
+        s_memory_usage += size;
+        m_chunks.emplace_back(size, std::move(chunk));
+      } else {
+        excess = std::move(chunk);
+      }
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  //! Pooled chunks and the number of bytes counted for each
+  std::vector<std::pair<size_t, pointer>> m_chunks;
+};
+
 /**
  * Base-class for data-chunks produced, processed and consumed by a pipeline.
  */
@@ -115,12 +188,77 @@ public:
 
   /** Destructor; does nothing. */
   virtual ~analytical_chunk();
+
+  /** Returns the (approximate) number of bytes of data held by the chunk. */
+  virtual size_t memory_usage() const;
+
+private:
+  friend class scheduler;
+
+  //! Number of bytes counted for this chunk by the scheduler, which may
+  //! differ from 'memory_usage' if the chunk was modified in place
+  size_t m_memory_charged;
 };
 
 typedef std::unique_ptr<analytical_chunk> chunk_ptr;
 typedef std::pair<size_t, chunk_ptr> chunk_pair;
 typedef std::vector<chunk_pair> chunk_vec;
 
+class scheduler;
+
+/**
+ * ID of a step accepting chunks of type T, as returned by scheduler::add_step.
+ *
+ * Chunks can only be sent to a step via a handle of the matching type (see
+ * 'push_chunk'), so that mis-wired pipelines fail to compile.
+ */
+template<typename T>
+class step_handle
+{
+public:
+  typedef T chunk_type;
+
+  /** Creates a handle that does not refer to any step. */
+  step_handle()
+    : m_id(static_cast<size_t>(-1))
+  {}
+
+  /** Returns the ID of the step in the scheduler. */
+  size_t id() const { return m_id; }
+
+  /** Returns true if the handle refers to a step. */
+  bool is_set() const { return m_id != static_cast<size_t>(-1); }
+
+  bool operator==(const step_handle& other) const
+  {
+    return m_id == other.m_id;
+  }
+
+  bool operator!=(const step_handle& other) const
+  {
+    return m_id != other.m_id;
+  }
+
+private:
+  friend class scheduler;
+
+  explicit step_handle(size_t id)
+    : m_id(id)
+  {}
+
+  //! ID of the step in the scheduler
+  size_t m_id;
+};
+
+/** Adds a chunk to be processed by the specified step to a list of chunks. */
+template<typename T>
+void
+push_chunk(chunk_vec& chunks, const step_handle<T>& step, std::unique_ptr<T> chunk)
+{
+  AR_DEBUG_ASSERT(step.is_set());
+  chunks.emplace_back(step.id(), std::move(chunk));
+}
+
 /** Ordering of input for analytical steps. */
 enum class processing_order
 {
@@ -132,6 +270,17 @@ enum class processing_order
   unordered
 };
 
+/** Strategy used to select the work to be done next by an idle thread. */
+enum class scheduling_policy
+{
+  //! Threads run their most recently queued task, steal the oldest tasks
+  //! queued by other threads, and read more input whenever possible
+  breadth_first,
+  //! Threads run tasks for the steps furthest downstream first, and more input
+  //! is only read once no other work is waiting to be run
+  depth_first
+};
+
 /**
  * Base class for analytical steps in a pipeline.
  *
@@ -157,14 +306,10 @@ public:
   /**
    * Function called by pipeline to generate / process / consume data chunks.
    *
-   * Initially, the first step in the pipeline will receive nullptr; during
-   * subsequent cycles, the pipeline will return the value output from the
-   * last step to the initial step, which may re-use it to avoid allocations;
-   * if this is not done, the chunk must be freed by the first step.
-   *
-   * Best performance is therefore obtained if the chunk contains buffers
-   * for all steps, and these can be re-used across cycles, thereby reducing
-   * the number of (de)allocations that must be performed.
+   * The first step in the pipeline always receives nullptr. Steps that
+   * consume a chunk take ownership of it, and may either free it or return it
+   * to a pool for re-use (see e.g. fastq_read_chunk::release), thereby
+   * reducing the number of (de)allocations that must be performed.
    *
    * To terminate the pipeline, the first step must cease to return chunks;
    * however, any other step MUST return valid chunks, even if no input data
@@ -186,6 +331,13 @@ public:
   /** Returns the expected ordering (ordered / unordered) for input data. **/
   processing_order ordering() const;
 
+  /**
+   * Returns the files read or written by an IO step. These are used to place
+   * IO steps in lanes corresponding to the devices on which the files are
+   * located, so that IO on different devices may run simultaneously.
+   */
+  virtual std::vector<std::string> io_filenames() const;
+
   //! Copy construction not supported
   analytical_step(const analytical_step&) = delete;
   //! Assignment not supported
@@ -196,9 +348,56 @@ private:
   const processing_order m_step_order;
 };
 
+/**
+ * Analytical step processing chunks of type T.
+ *
+ * Steps added using a typed step receive a 'step_handle<T>', which ensures
+ * that only chunks of type T are sent to the step. Chunks can therefore be
+ * passed to 'process_chunk' without checking their type at runtime.
+ */
+template<typename T>
+class typed_step : public analytical_step
+{
+public:
+  typedef T chunk_type;
+  typedef std::unique_ptr<T> pointer;
+
+  /** See analytical_step::analytical_step. */
+  explicit typed_step(processing_order step_order)
+    : analytical_step(step_order)
+  {}
+
+  /** Processes a chunk; see analytical_step::process. */
+  virtual chunk_vec process_chunk(pointer chunk) = 0;
+
+  /** Passes the chunk on to 'process_chunk'. */
+  virtual chunk_vec process(analytical_chunk* chunk) final
+  {
+    return process_chunk(pointer(static_cast<T*>(chunk)));
+  }
+};
+
 /**
  * Multithreaded scheduler.
  *
+ * Each thread owns a deque of runnable tasks; tasks produced by a thread are
+ * added to its own deque and processed in LIFO order, while idle threads steal
+ * the oldest tasks from other threads. Idle threads sleep until woken by a
+ * thread producing new work, and only as many threads as there are new tasks
+ * are woken.
+ *
+ * Chunks for ordered steps are placed in per-step reorder buffers that do not
+ * require locking, except for chunks far ahead of the chunk being processed.
+ *
+ * Steps involving IO are assigned to lanes according to the device on which
+ * their files are located, so that IO on separate devices may run in parallel
+ * while IO on a single device is limited to a fixed number of threads.
+ *
+ * The order in which queued tasks are run is determined by the selected
+ * 'scheduling_policy'. Since the steps to which a step sends its chunks must
+ * be added to the scheduler before the step itself, steps with lower IDs are
+ * further downstream in the pipeline.
+ *
  * See 'analytical_step' for information on implementing analyses.
  */
 class scheduler
@@ -222,6 +421,53 @@ public:
    **/
   size_t add_step(const std::string& name, analytical_step* step);
 
+  /** Adds a typed step to the pipeline; see 'add_step' above. */
+  template<typename T>
+  step_handle<T> add_step(const std::string& name, typed_step<T>* step)
+  {
+    analytical_step* ptr = step;
+
+    return step_handle<T>(add_step(name, ptr));
+  }
+
+  /**
+   * Sets the maximum number of threads simultaneously performing IO on the
+   * same device; defaults to 1.
+   */
+  void set_max_io_per_lane(size_t n);
+
+  /**
+   * Sets the maximum number of bytes held by chunks in the pipeline and in
+   * 'chunk_pool's; new chunks are only read if room remains for a chunk as
+   * large as the largest chunk seen so far, or if no chunks are held in the
+   * pipeline. This applies in addition to the limit on the number of chunks,
+   * which is based on the number of threads. If 0 (the default), the budget
+   * set using 'set_task_memory_usage' applies instead.
+   */
+  void set_max_memory_usage(size_t n);
+
+  /**
+   * Sets the number of bytes budgeted per task if no maximum is set using
+   * 'set_max_memory_usage'; the budget is then this number times the maximum
+   * number of tasks. Since the limit on tasks counts chunks regardless of
+   * their size, this bounds the memory used by many small chunks in flight.
+   * If 0 (the default), memory usage is not limited.
+   */
+  void set_task_memory_usage(size_t n);
+
+  /** Returns the peak number of bytes held by chunks during the run. */
+  size_t peak_memory_usage() const;
+
+  /**
+   * Records the time spent processing each chunk in each step, as well as the
+   * time spent waiting for work, and writes these to the specified file in
+   * the Chrome trace event format once the pipeline has finished.
+   */
+  void set_trace_file(const std::string& filename);
+
+  /** Sets the policy used to select tasks; defaults to breadth-first. */
+  void set_scheduling_policy(scheduling_policy policy);
+
   /** Runs the pipeline with n threads; return false on error. */
   bool run(int nthreads);
 
@@ -234,11 +480,63 @@ private:
   typedef std::shared_ptr<scheduler_step> step_ptr;
   typedef std::queue<step_ptr> runables;
   typedef std::vector<step_ptr> pipeline;
+  typedef std::unique_ptr<scheduler_worker> worker_ptr;
+
+  /** IO steps for files on the same device share a lane. */
+  struct io_lane
+  {
+    io_lane();
+
+    //! Currently runnable IO steps in this lane
+    runables queue;
+    //! The number of threads currently doing IO in this lane
+    size_t active;
+  };
+
+  /** Assigns IO steps to lanes based on the devices they access. */
+  void assign_io_lanes();
+  /** Writes recorded events to the trace file; returns false on error. */
+  bool write_trace() const;
 
   /** Wrapper function which calls do_run on the provided thread. */
-  static void run_wrapper(scheduler*);
+  static void run_wrapper(scheduler*, size_t worker_id);
   /** Work function; invoked by each thread. */
-  void do_run();
+  void do_run(size_t worker_id);
+
+  /** Acquires a runnable task, returning false if none are available. */
+  bool acquire_task(size_t worker_id, scheduler_task& task);
+  /** Tries to acquire a runnable IO task from a lane with spare capacity. */
+  bool acquire_io_task(scheduler_task& task);
+  /** Tries to acquire a task from the worker's own queue. */
+  bool acquire_own_task(size_t worker_id, scheduler_task& task);
+  /** Tries to steal a task from other workers' queues. */
+  bool steal_task(size_t worker_id, scheduler_task& task);
+  /** Takes the next task from a worker's queue; requires 'worker.lock'. */
+  void take_task(scheduler_worker& worker,
+                 scheduler_task& task,
+                 bool stealing);
+  /** Tries to start reading a new chunk of input data. */
+  bool acquire_read_task(scheduler_task& task);
+
+  /** Runs a task; for ordered steps all consecutive chunks are processed. */
+  void run_task(size_t worker_id, scheduler_task& task);
+  /** Adds to (or subtracts from) the memory used by chunks. */
+  void update_memory_usage(size_t added, size_t removed);
+  /** Processes a single chunk and queues the resulting chunks. */
+  void process_chunk(size_t worker_id, const step_ptr& step, data_chunk& chunk);
+  /** Adds a task to the worker's queue. */
+  void queue_task(size_t worker_id, scheduler_task&& task);
+
+  /** Blocks until work may be available; returns false if run is done. */
+  bool wait_for_work(size_t worker_id);
+  /** Returns true if any work is available; requires 'm_idle_lock'. */
+  bool has_work();
+  /** Returns true if the source step may be run; requires 'm_io_lock'. */
+  bool can_read() const;
+  /** Wakes up to n idle threads. */
+  void wake_workers(size_t n = 1);
+  /** Wakes all idle threads, e.g. on errors or when the run is done. */
+  void wake_all_workers();
 
   /** Returns true if an error has occurred, and the run should terminate. */
   bool errors_occured();
@@ -247,28 +545,55 @@ private:
 
   //! Analytical steps
   pipeline m_steps;
+  //! Per thread task queues
+  std::vector<worker_ptr> m_workers;
 
+  //! Lock used to put idle threads to sleep
+  std::mutex m_idle_lock;
   //! Condition used to signal the (potential) availability of work
   std::condition_variable m_condition;
+  //! Number of threads waiting on 'm_condition'
+  std::atomic<size_t> m_idle_workers;
 
   //! Counter used for sequential processing of data
   size_t m_chunk_counter;
   //! The current number of running/queued tasks
-  size_t m_tasks;
+  std::atomic<size_t> m_tasks;
   //! The maximum number of tasks to process simultanously
-  size_t m_tasks_max;
+  std::atomic<size_t> m_tasks_max;
   //! Count of currently running/runable tasks
-  size_t m_live_tasks;
-
-  //! Lock used to control access to chunks
-  std::mutex m_queue_lock;
-  //! Queue used for currently runnable steps involving only calculations
-  runables m_queue_calc;
-  //! Queue used for currently runnable steps involving IO
-  runables m_queue_io;
-
-  //! Indicates if a thread is doing IO; access control through 'm_queue_lock'
-  bool m_io_active;
+  std::atomic<size_t> m_live_tasks;
+  //! Count of tasks queued in per-thread queues
+  std::atomic<size_t> m_queued_tasks;
+
+  //! Lock used to control access to IO lanes
+  std::mutex m_io_lock;
+  //! Lanes used for steps involving IO; access control through 'm_io_lock'
+  std::vector<io_lane> m_io_lanes;
+  //! The maximum number of threads doing IO in a single lane
+  size_t m_max_io_per_lane;
+  //! Indicates if a thread is running the source step; see 'm_io_lock'
+  bool m_reading;
+
+  //! The maximum number of bytes held by chunks; 0 if unlimited
+  size_t m_max_memory;
+  //! The number of bytes budgeted per task if 'm_max_memory' is not set
+  size_t m_task_memory;
+  //! The number of bytes currently held by chunks in the pipeline; chunks
+  //! kept for re-use are tracked by 'chunk_pool_base'
+  std::atomic<size_t> m_memory_usage;
+  //! The peak number of bytes held by chunks
+  std::atomic<size_t> m_memory_peak;
+  //! The largest number of bytes held by a single chunk; reserved when reading
+  std::atomic<size_t> m_memory_chunk_max;
+
+  //! Policy used to select the next task to run
+  scheduling_policy m_policy;
+
+  //! File to which trace events are written; disabled if empty
+  std::string m_trace_file;
+  //! The time at which the pipeline was started; used for trace events
+  std::chrono::steady_clock::time_point m_trace_start;
   //! Set to indicate if errors have occurred
   std::atomic_bool m_errors;
 };
@@ -286,6 +611,12 @@ analytical_step::ordering() const
   return m_step_order;
 }
 
+inline std::vector<std::string>
+analytical_step::io_filenames() const
+{
+  return std::vector<std::string>();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Implementations for 'scheduler'
 
@@ -22,16 +22,95 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
-#include <cstdlib> // for size_t
-#include <string>  // for string
+#include <algorithm> // for fill, min
+#include <cstdlib>   // for size_t
+#include <limits>    // for numeric_limits
+#include <string>    // for string
 
-#include "fastq.hpp"     // for ACGT_TO_IDX, fastq
-#include "fastq_enc.hpp" // for PHRED_OFFSET_33
+#include "fastq.hpp"      // for ACGT_TO_IDX, fastq
+#include "fastq_enc.hpp"  // for PHRED_OFFSET_33
+#include "read_batch.hpp" // for read_batch
 #include "statistics.hpp"
 #include "utilities.hpp" // for prng_seed
 
-fastq_statistics::fastq_statistics(double sample_rate)
+#if defined(__AVX2__)
+#include <immintrin.h> // for _mm256_cmpeq_epi8, _mm256_movemask_epi8, ...
+#endif
+
+//! Maximum number of sampled reads per chunk; ensures that per-position sums
+//! of Phred scores (max 93) do not overflow the 32 bit per-chunk counters
+const size_t MAX_CHUNK_SAMPLED_READS = 1 << 25;
+//! Maximum number of sampled bases per chunk; ensures that the per-chunk
+//! quality distribution does not overflow
+const size_t MAX_CHUNK_SAMPLED_BASES = std::numeric_limits<uint32_t>::max();
+
+//! Index of the first per-position sum of Phred scores in a per-chunk row
+const size_t CHUNK_QUALITY_OFFSET = 5;
+//! Number of counters per position in the per-chunk table; counts of A/C/G/T/N
+//! indexed using ACGT_TO_IDX (N at 4) followed by their sums of Phred scores
+const size_t CHUNK_ROW_SIZE = 2 * CHUNK_QUALITY_OFFSET;
+
+/** Returns the threshold below which raw mt19937 values are sampled. */
+uint32_t
+sample_rate_to_threshold(double sample_rate)
+{
+  if (sample_rate <= 0.0) {
+    return 0;
+  } else if (sample_rate >= 1.0) {
+    return std::numeric_limits<uint32_t>::max();
+  }
+
+  return static_cast<uint32_t>(sample_rate * 4294967296.0);
+}
+
+/** Counts the number of G/Cs and Ns in a (validated) sequence. */
+void
+count_gc_and_n(const char* sequence, size_t length, size_t& n_gc, size_t& n_n)
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i nuc_c = _mm256_set1_epi8('C');
+  const __m256i nuc_g = _mm256_set1_epi8('G');
+  const __m256i nuc_n = _mm256_set1_epi8('N');
+
+  for (; length - i >= 32; i += 32) {
+    const __m256i value =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sequence + i));
+
+    const uint32_t gc_mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+      _mm256_or_si256(_mm256_cmpeq_epi8(value, nuc_c),
+                      _mm256_cmpeq_epi8(value, nuc_g))));
+    const uint32_t n_mask = static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(value, nuc_n)));
+
+    n_gc += __builtin_popcount(gc_mask);
+    n_n += __builtin_popcount(n_mask);
+  }
+#endif
+
+  for (; i < length; ++i) {
+    switch (sequence[i]) {
+      case 'C':
+      case 'G':
+        n_gc++;
+        break;
+
+      case 'N':
+        n_n++;
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+fastq_statistics::fastq_statistics(double sample_rate, size_t max_length)
   : m_sample_rate(sample_rate)
+  , m_sample_threshold(sample_rate_to_threshold(sample_rate))
   , m_rng(prng_seed())
   , m_number_of_input_reads()
   , m_number_of_output_reads()
@@ -44,69 +123,188 @@ fastq_statistics::fastq_statistics(double sample_rate)
   , m_called_pos(4)
   , m_quality_pos(4)
   , m_max_sequence_len()
+  , m_chunk_reads()
+  , m_chunk_sampled_reads()
+  , m_chunk_sampled_bases()
+  , m_chunk_quality_dist(MAX_PHRED_SCORE + 1)
+  , m_chunk_max_length(max_length)
+  , m_chunk_pos()
 {}
 
 void
 fastq_statistics::process(const fastq& read, size_t num_input_reads)
+{
+  process(read.sequence().data(),
+          read.qualities().data(),
+          read.length(),
+          num_input_reads);
+}
+
+void
+fastq_statistics::process(const read_batch& reads,
+                          size_t nth,
+                          size_t num_input_reads)
+{
+  process(reads.sequence(nth),
+          reads.qualities(nth),
+          reads.length(nth),
+          num_input_reads);
+}
+
+void
+fastq_statistics::process(const char* sequence,
+                          const char* qualities,
+                          size_t length,
+                          size_t num_input_reads)
 {
   m_number_of_input_reads += num_input_reads;
   m_number_of_output_reads++;
+  m_chunk_reads++;
 
-  if (read.length() >= m_max_sequence_len) {
-    m_max_sequence_len = read.length();
-
+  if (length >= m_max_sequence_len) {
+    m_max_sequence_len = length;
     m_length_dist.resize_up_to(m_max_sequence_len + 1);
+  }
 
-    m_uncalled_pos.resize_up_to(m_max_sequence_len);
-    m_uncalled_quality_pos.resize_up_to(m_max_sequence_len);
+  m_length_dist.inc(length);
+
+  // Every read is sampled by default, in which case the RNG is not needed
+  if (m_sample_rate >= 1.0 || m_rng() < m_sample_threshold) {
+    m_number_of_sampled_reads += num_input_reads;
 
-    for (size_t nuc_i = 0; nuc_i < 4; ++nuc_i) {
-      m_called_pos.at(nuc_i).resize_up_to(m_max_sequence_len);
-      m_quality_pos.at(nuc_i).resize_up_to(m_max_sequence_len);
+    if (m_chunk_sampled_reads >= MAX_CHUNK_SAMPLED_READS ||
+        MAX_CHUNK_SAMPLED_BASES - m_chunk_sampled_bases < length) {
+      flush();
     }
-  }
 
-  m_length_dist.inc(read.length());
+    m_chunk_sampled_reads++;
+    m_chunk_sampled_bases += length;
 
-  if (std::generate_canonical<float, 32>(m_rng) <= m_sample_rate) {
-    m_number_of_sampled_reads += num_input_reads;
+    // The table is allocated on first use, since many statistics objects
+    // (e.g. for discarded reads) may never see a sampled read
+    if (m_chunk_pos.empty()) {
+      m_chunk_pos.resize(m_chunk_max_length * CHUNK_ROW_SIZE);
+    }
 
-    const std::string& sequence = read.sequence();
-    const std::string& qualities = read.qualities();
-
-    size_t acgt_counts[] = { 0, 0, 0, 0 };
-    for (size_t i = 0; i < sequence.length(); ++i) {
-      const auto nuc = sequence.at(i);
-      if (nuc == 'N') {
-        m_uncalled_pos.inc(i);
-        m_uncalled_quality_pos.inc(i, qualities.at(i));
-      } else {
-        const auto nuc_i = ACGT_TO_IDX(nuc);
-
-        acgt_counts[nuc_i]++;
-        m_called_pos.at(nuc_i).inc(i);
-        m_quality_pos.at(nuc_i).inc(i, qualities.at(i) - PHRED_OFFSET_33);
-      }
+    // Sequences and qualities have been validated, so indices are in range
+    uint32_t* const quality_dist = m_chunk_quality_dist.data();
+    uint32_t* row = m_chunk_pos.data();
+
+    const size_t tabulated = std::min(length, m_chunk_max_length);
+    for (size_t i = 0; i < tabulated; ++i, row += CHUNK_ROW_SIZE) {
+      const auto nuc = sequence[i];
+      const auto nuc_i = (nuc == 'N') ? 4 : ACGT_TO_IDX(nuc);
+      const auto quality = qualities[i] - PHRED_OFFSET_33;
 
-      m_quality_dist.inc(qualities.at(i) - PHRED_OFFSET_33);
+      row[nuc_i]++;
+      row[CHUNK_QUALITY_OFFSET + nuc_i] += quality;
+      quality_dist[quality]++;
     }
 
-    auto n_at = acgt_counts[ACGT_TO_IDX('A')] + acgt_counts[ACGT_TO_IDX('T')];
-    auto n_gc = acgt_counts[ACGT_TO_IDX('G')] + acgt_counts[ACGT_TO_IDX('C')];
+    // Positions past the end of the table are counted directly
+    if (length > tabulated) {
+      resize_counts(length);
+
+      for (size_t i = tabulated; i < length; ++i) {
+        const auto nuc = sequence[i];
+        const auto quality = qualities[i];
+
+        if (nuc == 'N') {
+          m_uncalled_pos.inc(i);
+          m_uncalled_quality_pos.inc(i, quality);
+        } else {
+          const auto nuc_i = ACGT_TO_IDX(nuc);
+
+          m_called_pos.at(nuc_i).inc(i);
+          m_quality_pos.at(nuc_i).inc(i, quality - PHRED_OFFSET_33);
+        }
+
+        quality_dist[quality - PHRED_OFFSET_33]++;
+      }
+    }
+
+    size_t n_gc = 0;
+    size_t n_n = 0;
+    count_gc_and_n(sequence, length, n_gc, n_n);
+
+    const size_t n_at = length - n_gc - n_n;
     if (n_at || n_gc) {
       m_gc_content_dist.inc((100.0 * n_gc) / (n_at + n_gc) + 0.5);
     }
   }
 }
 
+void
+fastq_statistics::flush()
+{
+  merge_chunk();
+}
+
+void
+fastq_statistics::merge_chunk() const
+{
+  if (!m_chunk_reads) {
+    return;
+  }
+
+  resize_counts(m_max_sequence_len);
+
+  if (m_chunk_sampled_reads) {
+    for (size_t i = 0; i < m_chunk_quality_dist.size(); ++i) {
+      m_quality_dist.inc(i, m_chunk_quality_dist.at(i));
+    }
+
+    const size_t tabulated = std::min(m_max_sequence_len, m_chunk_max_length);
+    for (size_t i = 0; i < tabulated; ++i) {
+      const uint32_t* row = m_chunk_pos.data() + i * CHUNK_ROW_SIZE;
+
+      for (size_t nuc_i = 0; nuc_i < 4; ++nuc_i) {
+        m_called_pos.at(nuc_i).inc(i, row[nuc_i]);
+        m_quality_pos.at(nuc_i).inc(i, row[CHUNK_QUALITY_OFFSET + nuc_i]);
+      }
+
+      // Qualities of Ns are summed as raw, Phred+33 encoded scores
+      const int64_t offset = static_cast<int64_t>(row[4]) * PHRED_OFFSET_33;
+
+      m_uncalled_pos.inc(i, row[4]);
+      m_uncalled_quality_pos.inc(i, row[CHUNK_QUALITY_OFFSET + 4] + offset);
+    }
+
+    std::fill(m_chunk_quality_dist.begin(), m_chunk_quality_dist.end(), 0);
+    std::fill(m_chunk_pos.begin(),
+              m_chunk_pos.begin() + tabulated * CHUNK_ROW_SIZE,
+              0);
+  }
+
+  m_chunk_reads = 0;
+  m_chunk_sampled_reads = 0;
+  m_chunk_sampled_bases = 0;
+}
+
+void
+fastq_statistics::resize_counts(size_t length) const
+{
+  m_uncalled_pos.resize_up_to(length);
+  m_uncalled_quality_pos.resize_up_to(length);
+
+  for (size_t nuc_i = 0; nuc_i < 4; ++nuc_i) {
+    m_called_pos.at(nuc_i).resize_up_to(length);
+    m_quality_pos.at(nuc_i).resize_up_to(length);
+  }
+}
+
 fastq_statistics&
 fastq_statistics::operator+=(const fastq_statistics& other)
 {
+  merge_chunk();
+  other.merge_chunk();
+
   m_number_of_input_reads += other.m_number_of_input_reads;
   m_number_of_output_reads += other.m_number_of_output_reads;
   m_number_of_sampled_reads += other.m_number_of_sampled_reads;
   m_length_dist += other.m_length_dist;
   m_quality_dist += other.m_quality_dist;
+  m_gc_content_dist += other.m_gc_content_dist;
   m_uncalled_pos += other.m_uncalled_pos;
   m_uncalled_quality_pos += other.m_uncalled_quality_pos;
 
@@ -137,6 +335,15 @@ trimming_statistics::trimming_statistics(double sample_rate)
   , filtered_ambiguous_bases()
 {}
 
+void
+trimming_statistics::flush()
+{
+  read_1.flush();
+  read_2.flush();
+  merged.flush();
+  discarded.flush();
+}
+
 trimming_statistics&
 trimming_statistics::operator+=(const trimming_statistics& other)
 {
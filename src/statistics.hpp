@@ -24,20 +24,41 @@
 \*************************************************************************/
 #pragma once
 
-#include <cstdlib> // for size_t
-#include <random>  // for mt19937
-#include <vector>  // for vector
+#include <cstdlib>  // for size_t
+#include <random>   // for mt19937
+#include <stdint.h> // for uint32_t
+#include <vector>   // for vector
 
 #include "counts.hpp" // for counts
 #include "fastq.hpp"  // for ACGT_TO_IDX
 
-/** Class used to collect statistics about pre/post-processed FASTQ reads. */
+class read_batch;
+
+//! Default number of positions tabulated per chunk by fastq_statistics
+const size_t FASTQ_STATISTICS_MAX_LENGTH = 512;
+
+/**
+ * Class used to collect statistics about pre/post-processed FASTQ reads.
+ *
+ * Per-position counts for sampled reads are collected in a compact,
+ * position-major per-chunk table, which is merged into the final counts by
+ * 'flush' once a chunk of reads has been processed. Pending counts are also
+ * merged before the statistics are read or summed, so calling 'flush' is not
+ * required for correct results. Positions past the first 'max_length' bases
+ * are counted directly in the final counts.
+ */
 class fastq_statistics
 {
 public:
-  explicit fastq_statistics(double sample_rate = 1.0);
+  explicit fastq_statistics(double sample_rate = 1.0,
+                            size_t max_length = FASTQ_STATISTICS_MAX_LENGTH);
 
   void process(const fastq& read, size_t num_input_reads = 1);
+  /** Collects statistics for the nth read of a batch. */
+  void process(const read_batch& reads, size_t nth, size_t num_input_reads = 1);
+
+  /** Merges counts collected for the current chunk into the final counts. */
+  void flush();
 
   inline size_t number_of_input_reads() const
   {
@@ -55,19 +76,30 @@ public:
   }
 
   inline const counts& length_dist() const { return m_length_dist; }
-  inline const counts& quality_dist() const { return m_quality_dist; }
+  inline const counts& quality_dist() const
+  {
+    merge_chunk();
+    return m_quality_dist;
+  }
   inline const counts& gc_content() const { return m_gc_content_dist; }
-  inline const counts& uncalled_pos() const { return m_uncalled_pos; }
+  inline const counts& uncalled_pos() const
+  {
+    merge_chunk();
+    return m_uncalled_pos;
+  }
   inline const counts& uncalled_quality_pos() const
   {
+    merge_chunk();
     return m_uncalled_quality_pos;
   }
   inline const counts& nucleotides_pos(char nuc) const
   {
+    merge_chunk();
     return m_called_pos.at(ACGT_TO_IDX(nuc));
   }
   inline const counts& qualities_pos(char nuc) const
   {
+    merge_chunk();
     return m_quality_pos.at(ACGT_TO_IDX(nuc));
   }
 
@@ -75,8 +107,25 @@ public:
   fastq_statistics& operator+=(const fastq_statistics& other);
 
 private:
+  /**
+   * Merges pending per-chunk counts into the final counts, if any. This does
+   * not change the observable statistics, and is therefore const.
+   */
+  void merge_chunk() const;
+
+  /** Collects statistics for a read; used by the public 'process' functions. */
+  void process(const char* sequence,
+               const char* qualities,
+               size_t length,
+               size_t num_input_reads);
+
+  /** Resizes per-position counts to accommodate reads of a given length. */
+  void resize_counts(size_t length) const;
+
   //! Sample every nth read for statistics.
   double m_sample_rate;
+  //! Reads are sampled if the RNG returns a value below this threshold
+  uint32_t m_sample_threshold;
   //! RNG used to downsample sample reads for curves
   std::mt19937 m_rng;
 
@@ -90,20 +139,34 @@ private:
   /** Length distribution. */
   counts m_length_dist;
   /** Quality distribution. */
-  counts m_quality_dist;
+  mutable counts m_quality_dist;
   /** GC content distribution. */
   counts m_gc_content_dist;
   /** Count of uncalled bases per position. */
-  counts m_uncalled_pos;
+  mutable counts m_uncalled_pos;
   /** Sum of qualities of Ns per position. */
-  counts m_uncalled_quality_pos;
+  mutable counts m_uncalled_quality_pos;
   /** Count of A/C/G/T per position; indexed using ACGT_TO_IDX. */
-  std::vector<counts> m_called_pos;
+  mutable std::vector<counts> m_called_pos;
   /** Sum of qualities of A/C/G/Ts per position; indexed using ACGT_TO_IDX. */
-  std::vector<counts> m_quality_pos;
+  mutable std::vector<counts> m_quality_pos;
 
   //! Maximum size of read processed; used to resize counters as needed
   size_t m_max_sequence_len;
+
+  //! Number of reads processed since the last flush
+  mutable size_t m_chunk_reads;
+  //! Number of sampled reads processed since the last flush
+  mutable size_t m_chunk_sampled_reads;
+  //! Number of sampled bases processed since the last flush
+  mutable size_t m_chunk_sampled_bases;
+  //! Quality distribution for the current chunk
+  mutable std::vector<uint32_t> m_chunk_quality_dist;
+  //! Number of positions tabulated in the per-chunk table
+  size_t m_chunk_max_length;
+  //! Counts of A/C/G/T/N and sums of their Phred scores for each position in
+  //! the current chunk; stored as one row of counters per position
+  mutable std::vector<uint32_t> m_chunk_pos;
 };
 
 /** Object used to collect summary statistics for trimming. */
@@ -144,6 +207,9 @@ struct trimming_statistics
   size_t filtered_ambiguous_reads;
   size_t filtered_ambiguous_bases;
 
+  /** Merges counts collected for the current chunk into the final counts. */
+  void flush();
+
   /** Combine statistics objects, e.g. those used by different threads. */
   trimming_statistics& operator+=(const trimming_statistics& other);
 };
@@ -171,6 +237,26 @@ struct demultiplexing_statistics
   fastq_statistics unidentified_stats_2;
 };
 
+/** Summary of the number of nucleotides read per chunk of input. */
+struct chunk_size_statistics
+{
+  inline chunk_size_statistics()
+    : chunks(0)
+    , minimum(0)
+    , maximum(0)
+    , last(0)
+  {}
+
+  //! Number of chunks read
+  size_t chunks;
+  //! Smallest number of nucleotides targeted for a chunk
+  size_t minimum;
+  //! Largest number of nucleotides targeted for a chunk
+  size_t maximum;
+  //! Number of nucleotides targeted for the last chunk
+  size_t last;
+};
+
 // FIXME: Rename to something better
 struct ar_statistics
 {
@@ -179,6 +265,8 @@ struct ar_statistics
     , input_2(sample_rate)
     , demultiplexing(sample_rate)
     , trimming()
+    , peak_memory_usage(0)
+    , chunk_sizes()
   {}
 
   fastq_statistics input_1;
@@ -186,4 +274,9 @@ struct ar_statistics
 
   demultiplexing_statistics demultiplexing;
   std::vector<trimming_statistics> trimming;
+
+  //! Peak number of bytes held by chunks of reads in the pipeline
+  size_t peak_memory_usage;
+  //! Sizes of chunks of reads selected while reading the input
+  chunk_size_statistics chunk_sizes;
 };
@@ -21,17 +21,24 @@
  * You should have received a copy of the GNU General Public License     *
  * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
 \*************************************************************************/
+#include <cstring>     // for memchr
 #include <iomanip>     // for operator<<, setw
 #include <limits>      // for numeric_limits
 #include <sstream>     // for stringstream, basic_ostream, operator<<, basi...
 #include <stdexcept>   // for invalid_argument
-#include <stdint.h>    // for int64_t
+#include <stdint.h>    // for int64_t, uint32_t, uint64_t
 #include <sys/ioctl.h> // for ioctl, winsize, TIOCGWINSZ
 #include <unistd.h>    // for STDOUT_FILENO
 
 #include "debug.hpp" // for AR_DEBUG_ASSERT
 #include "strutils.hpp"
 
+#if defined(__AVX2__)
+#include <immintrin.h> // for _mm256_cmpeq_epi8, _mm256_movemask_epi8, ...
+#elif defined(__SSE__) && defined(__SSE2__)
+#include <emmintrin.h> // for _mm_cmpeq_epi8, _mm_movemask_epi8, ...
+#endif
+
 unsigned
 str_to_unsigned(const std::string& s)
 {
@@ -68,6 +75,60 @@ toupper(const std::string& str)
   return uppercased;
 }
 
+/** Appends the offset of every set bit in 'mask' to 'dst'. */
+inline void
+append_mask_offsets(uint64_t mask, size_t offset, std::vector<size_t>& dst)
+{
+  for (; mask; mask &= mask - 1) {
+    dst.push_back(offset + __builtin_ctzll(mask));
+  }
+}
+
+void
+find_newlines(const char* data, size_t size, std::vector<size_t>& dst)
+{
+  size_t offset = 0;
+
+#if defined(__AVX2__)
+  const __m256i newlines = _mm256_set1_epi8('\n');
+  for (; size - offset >= 64; offset += 64) {
+    const __m256i lo =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset));
+    const __m256i hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset + 32));
+
+    const __m256i lo_newlines = _mm256_cmpeq_epi8(lo, newlines);
+    const __m256i hi_newlines = _mm256_cmpeq_epi8(hi, newlines);
+
+    // Bitmap of newlines, with one bit per byte in the 64 byte window
+    const uint64_t lo_mask =
+      static_cast<uint32_t>(_mm256_movemask_epi8(lo_newlines));
+    const uint64_t hi_mask =
+      static_cast<uint32_t>(_mm256_movemask_epi8(hi_newlines));
+    const uint64_t mask = lo_mask | (hi_mask << 32);
+
+    append_mask_offsets(mask, offset, dst);
+  }
+#elif defined(__SSE__) && defined(__SSE2__)
+  const __m128i newlines = _mm_set1_epi8('\n');
+  for (; size - offset >= 16; offset += 16) {
+    const __m128i value =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + offset));
+    const uint64_t mask = static_cast<uint32_t>(
+      _mm_movemask_epi8(_mm_cmpeq_epi8(value, newlines)));
+
+    append_mask_offsets(mask, offset, dst);
+  }
+#endif
+
+  const char* newline = nullptr;
+  while ((newline = static_cast<const char*>(
+            memchr(data + offset, '\n', size - offset)))) {
+    dst.push_back(newline - data);
+    offset = dst.back() + 1;
+  }
+}
+
 std::string
 indent_lines(const std::string& lines, size_t n_indent)
 {
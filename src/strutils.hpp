@@ -25,6 +25,7 @@
 
 #include <stddef.h> // for size_t
 #include <string>   // for string
+#include <vector>   // for vector
 
 const size_t DEFAULT_MAX_COLUMNS = 78;
 const size_t DEFAULT_INDENTATION = 4;
@@ -43,6 +44,15 @@ str_to_unsigned(const std::string& s);
 std::string
 toupper(const std::string& str);
 
+/**
+ * Appends the offsets of all newlines in 'data' to 'dst'.
+ *
+ * Newlines are located 64 bytes at a time using AVX2 where available, making
+ * this considerably faster than calling memchr for every line in the text.
+ */
+void
+find_newlines(const char* data, size_t size, std::vector<size_t>& dst);
+
 /** Split text by newlines and add fixed indentation following newlines. */
 std::string
 indent_lines(const std::string& lines, size_t identation = DEFAULT_INDENTATION);
@@ -31,6 +31,7 @@
 #include "counts.hpp"     // for counts
 #include "debug.hpp"      // for AR_DEBUG_ASSERT
 #include "fastq_io.hpp"   // for output_chunk_ptr, fastq_read_chunk, fastq_...
+#include "read_batch.hpp" // for read_batch
 #include "statistics.hpp" // for trimming_statistics, fastq_statistics
 #include "trimming.hpp"
 #include "userconfig.hpp" // for userconfig, output_sample_files, output_sa...
@@ -42,7 +43,8 @@
 void
 trim_read_termini(const userconfig& config,
                   trimming_statistics& stats,
-                  fastq& read,
+                  read_batch& reads,
+                  size_t nth,
                   read_type type)
 {
   size_t trim_5p = 0;
@@ -73,16 +75,15 @@ trim_read_termini(const userconfig& config,
       throw std::invalid_argument("Invalid read type in trim_read_termini");
   }
 
-  const auto length = read.length();
+  const auto length = reads.length(nth);
   if (trim_5p || trim_3p) {
-    if (trim_5p + trim_3p < read.length()) {
-      read.truncate(trim_5p,
-                    read.length() - std::min(read.length(), trim_5p + trim_3p));
+    if (trim_5p + trim_3p < length) {
+      reads.truncate(nth, trim_5p, length - (trim_5p + trim_3p));
     } else {
-      read.truncate(0, 0);
+      reads.truncate(nth, 0, 0);
     }
 
-    stats.terminal_bases_trimmed += length - read.length();
+    stats.terminal_bases_trimmed += length - reads.length(nth);
   }
 }
 
@@ -90,11 +91,13 @@ trim_read_termini(const userconfig& config,
 bool
 trim_sequence_by_quality(const userconfig& config,
                          trimming_statistics& stats,
-                         fastq& read)
+                         read_batch& reads,
+                         size_t nth)
 {
   fastq::ntrimmed trimmed;
   if (config.trim_window_length >= 0) {
-    trimmed = read.trim_windowed_bases(config.trim_ambiguous_bases,
+    trimmed = reads.trim_windowed_bases(nth,
+                                       config.trim_ambiguous_bases,
                                        config.low_quality_score,
                                        config.trim_window_length,
                                        config.preserve5p);
@@ -102,8 +105,8 @@ trim_sequence_by_quality(const userconfig& config,
     const char quality_score =
       config.trim_by_quality ? config.low_quality_score : -1;
 
-    trimmed = read.trim_trailing_bases(
-      config.trim_ambiguous_bases, quality_score, config.preserve5p);
+    trimmed = reads.trim_trailing_bases(
+      nth, config.trim_ambiguous_bases, quality_score, config.preserve5p);
   }
 
   if (trimmed.first || trimmed.second) {
@@ -119,9 +122,10 @@ trim_sequence_by_quality(const userconfig& config,
 bool
 is_acceptable_read(const userconfig& config,
                    trimming_statistics& stats,
-                   const fastq& seq)
+                   const read_batch& reads,
+                   size_t nth)
 {
-  const auto length = seq.length();
+  const auto length = reads.length(nth);
 
   if (length < config.min_genomic_length) {
     stats.filtered_min_length_reads++;
@@ -136,7 +140,7 @@ is_acceptable_read(const userconfig& config,
   }
 
   const auto max_n = config.max_ambiguous_bases;
-  if (max_n < length && seq.count_ns() > max_n) {
+  if (max_n < length && reads.count_ns(nth) > max_n) {
     stats.filtered_ambiguous_reads++;
     stats.filtered_ambiguous_bases += length;
     return false;
@@ -156,18 +160,18 @@ trimmed_reads::trimmed_reads(const output_sample_files& map, const bool eof)
 
   for (size_t i = 0; i < map.steps.size(); ++i) {
     AR_DEBUG_ASSERT(map.filenames.at(i).size());
-    AR_DEBUG_ASSERT(map.steps.at(i) != output_sample_files::disabled);
+    AR_DEBUG_ASSERT(map.steps.at(i).is_set());
 
-    m_chunks.emplace_back(new fastq_output_chunk(eof));
+    m_chunks.push_back(fastq_output_chunk::acquire(eof));
   }
 }
 
 void
-trimmed_reads::add(fastq& read, const read_type type)
+trimmed_reads::add(const read_batch& reads, size_t nth, const read_type type)
 {
   const size_t offset = m_map.offset(type);
   if (offset != output_sample_files::disabled) {
-    m_chunks.at(offset)->add(read);
+    m_chunks.at(offset)->add(reads, nth);
   }
 }
 
@@ -177,7 +181,7 @@ trimmed_reads::finalize()
   chunk_vec chunks;
 
   for (size_t i = 0; i < m_chunks.size(); ++i) {
-    chunks.emplace_back(m_map.steps.at(i), std::move(m_chunks.at(i)));
+    push_chunk(chunks, m_map.steps.at(i), std::move(m_chunks.at(i)));
   }
 
   return chunks;
@@ -189,7 +193,7 @@ trimmed_reads::finalize()
 reads_processor::reads_processor(const userconfig& config,
                                  const output_sample_files& output,
                                  size_t nth)
-  : analytical_step(processing_order::unordered)
+  : typed_step(processing_order::unordered)
   , m_config(config)
   , m_adapters(config.adapters.get_adapter_set(nth))
   , m_stats()
@@ -222,9 +226,10 @@ se_reads_processor::se_reads_processor(const userconfig& config,
 {}
 
 chunk_vec
-se_reads_processor::process(analytical_chunk* chunk)
+se_reads_processor::process_chunk(read_chunk_ptr read_chunk)
 {
-  read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
+  read_chunk->begin_processing();
+
   trimmed_reads chunks(m_output, read_chunk->eof);
 
   auto stats = m_stats.acquire();
@@ -234,31 +239,35 @@ se_reads_processor::process(analytical_chunk* chunk)
   auto aligner = sequence_aligner(m_adapters);
   aligner.set_mismatch_threshold(m_config.mismatch_threshold);
 
-  for (auto& read : read_chunk->reads_1) {
+  // Reads are trimmed in place, by adjusting the offsets into the batch
+  read_batch& reads = read_chunk->reads_1;
+  for (size_t i = 0; i < reads.size(); ++i) {
     const alignment_info alignment =
-      aligner.align_single_end(read, m_config.shift);
+      aligner.align_single_end(reads, i, m_config.shift);
 
     if (m_config.is_good_alignment(alignment)) {
-      const auto length = read.length();
-      alignment.truncate_single_end(read);
+      const auto length = reads.length(i);
+      alignment.truncate_single_end(reads, i);
 
       stats->adapter_trimmed_reads.inc(alignment.adapter_id);
       stats->adapter_trimmed_bases.inc(alignment.adapter_id,
-                                       length - read.length());
+                                       length - reads.length(i));
     }
 
-    trim_read_termini(m_config, *stats, read, read_type::mate_1);
-    trim_sequence_by_quality(m_config, *stats, read);
-    if (is_acceptable_read(m_config, *stats, read)) {
-      stats->read_1.process(read);
-      chunks.add(read, read_type::mate_1);
+    trim_read_termini(m_config, *stats, reads, i, read_type::mate_1);
+    trim_sequence_by_quality(m_config, *stats, reads, i);
+    if (is_acceptable_read(m_config, *stats, reads, i)) {
+      stats->read_1.process(reads, i);
+      chunks.add(reads, i, read_type::mate_1);
     } else {
-      stats->discarded.process(read);
-      chunks.add(read, read_type::discarded_1);
+      stats->discarded.process(reads, i);
+      chunks.add(reads, i, read_type::discarded_1);
     }
   }
 
+  stats->flush();
   m_stats.release(stats);
+  fastq_read_chunk::release(read_chunk);
 
   return chunks.finalize();
 }
@@ -273,8 +282,10 @@ pe_reads_processor::pe_reads_processor(const userconfig& config,
 {}
 
 chunk_vec
-pe_reads_processor::process(analytical_chunk* chunk)
+pe_reads_processor::process_chunk(read_chunk_ptr read_chunk)
 {
+  read_chunk->begin_processing();
+
   sequence_merger merger;
   merger.set_mate_separator(m_config.mate_separator);
   merger.set_conservative(m_config.merge_conservatively);
@@ -283,7 +294,6 @@ pe_reads_processor::process(analytical_chunk* chunk)
   auto aligner = sequence_aligner(m_adapters);
   aligner.set_mismatch_threshold(m_config.mismatch_threshold);
 
-  read_chunk_ptr read_chunk(dynamic_cast<fastq_read_chunk*>(chunk));
   trimmed_reads chunks(m_output, read_chunk->eof);
 
   auto stats = m_stats.acquire();
@@ -292,47 +302,47 @@ pe_reads_processor::process(analytical_chunk* chunk)
 
   AR_DEBUG_ASSERT(read_chunk->reads_1.size() == read_chunk->reads_2.size());
 
-  auto it_1 = read_chunk->reads_1.begin();
-  auto it_2 = read_chunk->reads_2.begin();
-  while (it_1 != read_chunk->reads_1.end()) {
-    fastq read_1 = *it_1++;
-    fastq read_2 = *it_2++;
-
+  // Reads are processed in place and then serialized; the chunk is recycled
+  read_batch& reads_1 = read_chunk->reads_1;
+  read_batch& reads_2 = read_chunk->reads_2;
+  for (size_t i = 0; i < reads_1.size(); ++i) {
     // Throws if read-names or mate numbering does not match
-    fastq::validate_paired_reads(read_1, read_2, m_config.mate_separator);
+    read_batch::validate_paired_reads(
+      reads_1, reads_2, i, m_config.mate_separator);
 
     // Reverse complement to match the orientation of read_1
-    read_2.reverse_complement();
+    reads_2.reverse_complement(i);
 
     const alignment_info alignment =
-      aligner.align_paired_end(read_1, read_2, m_config.shift);
+      aligner.align_paired_end(reads_1, reads_2, i, m_config.shift);
 
     if (m_config.is_good_alignment(alignment)) {
-      const size_t length = read_1.length() + read_2.length();
-      const size_t n_adapters = alignment.truncate_paired_end(read_1, read_2);
+      const size_t length = reads_1.length(i) + reads_2.length(i);
+      const size_t n_adapters =
+        alignment.truncate_paired_end(reads_1, reads_2, i);
       stats->adapter_trimmed_reads.inc(alignment.adapter_id, n_adapters);
       stats->adapter_trimmed_bases.inc(
-        alignment.adapter_id, length - read_1.length() - read_2.length());
+        alignment.adapter_id, length - reads_1.length(i) - reads_2.length(i));
 
       if (m_config.can_merge_alignment(alignment)) {
         stats->overlapping_reads_merged += 2;
         // Merge read_2 into read_1
-        merger.merge(alignment, read_1, read_2);
+        merger.merge(alignment, reads_1, reads_2, i);
 
-        trim_read_termini(m_config, *stats, read_1, read_type::merged);
+        trim_read_termini(m_config, *stats, reads_1, i, read_type::merged);
 
         if (!m_config.preserve5p) {
           // A merged read essentially consists of two 5p termini, both
           // informative for PCR duplicate removal.
-          trim_sequence_by_quality(m_config, *stats, read_1);
+          trim_sequence_by_quality(m_config, *stats, reads_1, i);
         }
 
-        if (is_acceptable_read(m_config, *stats, read_1)) {
-          stats->merged.process(read_1, 2);
-          chunks.add(read_1, read_type::merged);
+        if (is_acceptable_read(m_config, *stats, reads_1, i)) {
+          stats->merged.process(reads_1, i, 2);
+          chunks.add(reads_1, i, read_type::merged);
         } else {
-          stats->discarded.process(read_1, 2);
-          chunks.add(read_1, read_type::discarded_1);
+          stats->discarded.process(reads_1, i, 2);
+          chunks.add(reads_1, i, read_type::discarded_1);
         }
 
         continue;
@@ -341,19 +351,19 @@ pe_reads_processor::process(analytical_chunk* chunk)
 
     // Reads were not aligned or merging is not enabled
     // Undo reverse complementation (post truncation of adapters)
-    read_2.reverse_complement();
+    reads_2.reverse_complement(i);
 
     // Trim fixed number of bases from 5' and/or 3' termini
-    trim_read_termini(m_config, *stats, read_1, read_type::mate_1);
-    trim_read_termini(m_config, *stats, read_2, read_type::mate_2);
+    trim_read_termini(m_config, *stats, reads_1, i, read_type::mate_1);
+    trim_read_termini(m_config, *stats, reads_2, i, read_type::mate_2);
 
     // Sliding window trimming or single-base trimming
-    trim_sequence_by_quality(m_config, *stats, read_1);
-    trim_sequence_by_quality(m_config, *stats, read_2);
+    trim_sequence_by_quality(m_config, *stats, reads_1, i);
+    trim_sequence_by_quality(m_config, *stats, reads_2, i);
 
     // Are the reads good enough? Not too many Ns?
-    const bool is_ok_1 = is_acceptable_read(m_config, *stats, read_1);
-    const bool is_ok_2 = is_acceptable_read(m_config, *stats, read_2);
+    const bool is_ok_1 = is_acceptable_read(m_config, *stats, reads_1, i);
+    const bool is_ok_2 = is_acceptable_read(m_config, *stats, reads_2, i);
 
     read_type type_1;
     read_type type_2;
@@ -372,23 +382,25 @@ pe_reads_processor::process(analytical_chunk* chunk)
     }
 
     if (is_ok_1) {
-      stats->read_1.process(read_1);
+      stats->read_1.process(reads_1, i);
     } else {
-      stats->discarded.process(read_1);
+      stats->discarded.process(reads_1, i);
     }
 
     if (is_ok_2) {
-      stats->read_2.process(read_2);
+      stats->read_2.process(reads_2, i);
     } else {
-      stats->discarded.process(read_2);
+      stats->discarded.process(reads_2, i);
     }
 
     // Queue reads last, since this result in modifications to lengths
-    chunks.add(read_1, type_1);
-    chunks.add(read_2, type_2);
+    chunks.add(reads_1, i, type_1);
+    chunks.add(reads_2, i, type_2);
   }
 
+  stats->flush();
   m_stats.release(stats);
+  fastq_read_chunk::release(read_chunk);
 
   return chunks.finalize();
 }
@@ -31,10 +31,11 @@
 #include "commontypes.hpp" // for read_type
 #include "fastq.hpp"       // for fastq_pair_vec
 #include "fastq_io.hpp"    // for output_chunk_ptr
-#include "scheduler.hpp"   // for chunk_vec, analytical_step, threadstate
+#include "scheduler.hpp"   // for chunk_vec, typed_step, threadstate
 #include "statistics.hpp"  // for trimming_statistics
 
 class output_sample_files;
+class read_batch;
 class userconfig;
 
 typedef std::unique_ptr<trimming_statistics> statistics_ptr;
@@ -48,10 +49,11 @@ public:
   /**
    * Adds a read of the given type.
    *
-   * @param read A read to be distributed in the pipeline; may be modified.
+   * @param reads A batch containing the read to be distributed.
+   * @param nth The index of the read in the batch.
    * @param type The read type to store the read as.
    */
-  void add(fastq& read, const read_type type);
+  void add(const read_batch& reads, size_t nth, const read_type type);
 
   /** Returns a chunk for each generated type of proccessed reads. */
   chunk_vec finalize();
@@ -63,7 +65,7 @@ private:
   std::vector<output_chunk_ptr> m_chunks;
 };
 
-class reads_processor : public analytical_step
+class reads_processor : public typed_step<fastq_read_chunk>
 {
 public:
   reads_processor(const userconfig& config,
@@ -87,7 +89,7 @@ public:
                      const output_sample_files& output,
                      size_t nth);
 
-  chunk_vec process(analytical_chunk* chunk);
+  chunk_vec process_chunk(read_chunk_ptr read_chunk);
 };
 
 class pe_reads_processor : public reads_processor
@@ -97,5 +99,5 @@ public:
                      const output_sample_files& output,
                      size_t nth);
 
-  chunk_vec process(analytical_chunk* chunk);
+  chunk_vec process_chunk(read_chunk_ptr read_chunk);
 };
@@ -218,6 +218,10 @@ userconfig::userconfig(const std::string& name,
   , merge_conservatively(false)
   , shift(2)
   , max_threads(1)
+  , io_threads(1)
+  , max_memory(0)
+  , trace_file()
+  , scheduling(scheduling_policy::breadth_first)
   , gzip(false)
   , gzip_stream(false)
   , gzip_level(6)
@@ -233,6 +237,7 @@ userconfig::userconfig(const std::string& name,
   , barcode_list()
   , quality_input_base("33")
   , mate_separator_str(1, MATE_SEPARATOR)
+  , scheduling_str("breadth-first")
   , interleaved(false)
   , trim5p()
   , trim3p()
@@ -257,6 +262,31 @@ userconfig::userconfig(const std::string& name,
     "for overlapping mate reads [default: %default].");
   argparser["--threads"] = new argparse::knob(
     &max_threads, "THREADS", "Maximum number of threads [default: %default]");
+  argparser["--io-threads"] = new argparse::knob(
+    &io_threads,
+    "N",
+    "Maximum number of threads reading or writing files on the same device "
+    "[default: %default]");
+  argparser["--max-memory"] = new argparse::knob(
+    &max_memory,
+    "MB",
+    "Maximum amount of memory (in MB) used to hold reads being processed, in "
+    "addition to the limit on the number of reads held in memory, which "
+    "depends on the number of threads; if 0, 1 MB is allowed per chunk of "
+    "reads permitted by the latter limit, i.e. 3 MB per thread "
+    "[default: %default]");
+  argparser["--trace-file"] = new argparse::any(
+    &trace_file,
+    "FILE",
+    "Write a timeline of the work done by each thread to FILE, in the "
+    "Chrome trace event format [default: <not set>].");
+  argparser["--scheduling"] = new argparse::any(
+    &scheduling_str,
+    "POLICY",
+    "Order in which pending work is done; either 'breadth-first', where new "
+    "input is read whenever possible, or 'depth-first', where work furthest "
+    "along the pipeline is done first and new input is only read once no "
+    "other work is waiting [default: %default].");
 
   argparser.add_header("FASTQ OPTIONS:");
   argparser["--qualitybase"] = new argparse::any(
@@ -674,6 +704,24 @@ userconfig::parse_args(int argc, char* argv[])
     return argparse::parse_result::error;
   }
 
+  if (!io_threads) {
+    std::cerr << "Error: --io-threads must be at least 1!" << std::endl;
+    return argparse::parse_result::error;
+  }
+
+  const std::string scheduling_value = toupper(scheduling_str);
+  if (scheduling_value == "BREADTH-FIRST") {
+    scheduling = scheduling_policy::breadth_first;
+  } else if (scheduling_value == "DEPTH-FIRST") {
+    scheduling = scheduling_policy::depth_first;
+  } else {
+    std::cerr << "Error: Invalid value for --scheduling: '" << scheduling_str
+              << "'\n"
+              << "   expected values breadth-first or depth-first."
+              << std::endl;
+    return argparse::parse_result::error;
+  }
+
   try {
     if (argparser.is_set("--trim5p")) {
       trim_fixed_5p = parse_trim_argument(trim5p);
@@ -35,8 +35,10 @@
 #include "argparse.hpp"    // for parse_result, parser
 #include "commontypes.hpp" // for string_vec, read_type, read_type::max
 #include "fastq_enc.hpp"   // for fastq_encoding
+#include "scheduler.hpp"   // for step_handle
 #include "timer.hpp"       // for highres_timer
 
+class fastq_output_chunk;
 struct alignment_info;
 struct trimming_statistics;
 
@@ -62,7 +64,7 @@ public:
   //! Vector of unique output filenames; filenames may be shared
   string_vec filenames;
   //! Vector of unique output steps IDs; steps may be shared
-  std::vector<size_t> steps;
+  std::vector<step_handle<fastq_output_chunk>> steps;
 
   /** Returns mutable offset to step/filename. */
   size_t& offset(read_type value)
@@ -219,6 +221,14 @@ public:
 
   //! The maximum number of threads used by the program
   unsigned max_threads;
+  //! The maximum number of threads doing IO on a single device
+  unsigned io_threads;
+  //! The maximum amount of memory (in MB) used for reads being processed
+  unsigned max_memory;
+  //! File to which a trace of the pipeline is written, if not empty
+  std::string trace_file;
+  //! Policy used by the scheduler to select the work to be done next
+  scheduling_policy scheduling;
 
   //! GZip compression enabled / disabled
   bool gzip;
@@ -269,6 +279,8 @@ private:
   std::string quality_input_base;
   //! Sink for the mate separator character; use mate separator
   std::string mate_separator_str;
+  //! Sink for --scheduling; use scheduling
+  std::string scheduling_str;
   //! Sink for --interleaved
   bool interleaved;
 
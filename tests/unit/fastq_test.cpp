@@ -29,6 +29,7 @@
 #include "debug.hpp"
 #include "fastq.hpp"
 #include "linereader.hpp"
+#include "strutils.hpp"
 #include "testing.hpp"
 
 class vec_reader : public line_reader_base
@@ -199,6 +200,93 @@ TEST_CASE("constructor_invalid_nucleotides", "[fastq::fastq]")
   REQUIRE_THROWS_AS(fastq("Name", "CATs", "IJJI"), fastq_error);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Constructor with records spanning multiple (vectorized) blocks
+
+/** Decodes each quality score individually, using the scalar code path. */
+std::string
+decode_individually(const std::string& qualities,
+                    const fastq_encoding& encoding)
+{
+  std::string decoded;
+  for (const auto quality : qualities) {
+    decoded += fastq("Rec", "A", std::string(1, quality), encoding).qualities();
+  }
+
+  return decoded;
+}
+
+TEST_CASE("constructor_long_record_lowercase_to_uppercase", "[fastq::fastq]")
+{
+  std::string sequence;
+  for (size_t i = 0; i < 8; ++i) {
+    sequence += "acgtnACGTN";
+  }
+
+  const fastq record("Rec", sequence, std::string(sequence.size(), 'I'));
+  REQUIRE(record.sequence() == toupper(sequence));
+}
+
+TEST_CASE("constructor_long_record_invalid_nucleotides", "[fastq::fastq]")
+{
+  const std::string qualities(80, 'I');
+  for (const size_t pos : { 0, 31, 32, 63, 64, 79 }) {
+    std::string sequence(80, 'a');
+    sequence.at(pos) = 'S';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities), fastq_error);
+
+    sequence.at(pos) = '\xc1';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities), fastq_error);
+  }
+}
+
+TEST_CASE("constructor_long_record_decoding", "[fastq::fastq]")
+{
+  const fastq_encoding encodings[] = { FASTQ_ENCODING_33,
+                                       FASTQ_ENCODING_64,
+                                       FASTQ_ENCODING_SAM,
+                                       FASTQ_ENCODING_SOLEXA };
+  const std::string min_scores[] = { "!", "@", "!", ";" };
+  const std::string max_scores[] = { "J", "i", "~", "h" };
+
+  for (size_t i = 0; i < 4; ++i) {
+    std::string qualities;
+    for (char c = min_scores[i].front(); c <= max_scores[i].front(); ++c) {
+      qualities.push_back(c);
+    }
+
+    // Ensure that every score is tested at several offsets in a block
+    qualities += qualities + qualities;
+    const std::string sequence(qualities.size(), 'A');
+    const fastq record("Rec", sequence, qualities, encodings[i]);
+
+    REQUIRE(record.qualities() == decode_individually(qualities, encodings[i]));
+  }
+}
+
+TEST_CASE("constructor_long_record_invalid_scores", "[fastq::fastq]")
+{
+  const std::string sequence(80, 'A');
+  for (const size_t pos : { 0, 31, 32, 63, 64, 79 }) {
+    std::string qualities(80, 'I');
+
+    qualities.at(pos) = ' ';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities), fastq_error);
+    qualities.at(pos) = 'K';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities), fastq_error);
+    qualities.at(pos) = '\x80';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities), fastq_error);
+
+    qualities.assign(80, 'h');
+    qualities.at(pos) = ':';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities, FASTQ_ENCODING_SOLEXA),
+                      fastq_error);
+    qualities.at(pos) = 'i';
+    REQUIRE_THROWS_AS(fastq("Rec", sequence, qualities, FASTQ_ENCODING_SOLEXA),
+                      fastq_error);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Constructor without qualities
 
@@ -963,6 +1051,69 @@ TEST_CASE("ignores_newlines_between_records", "[fastq::fastq]")
   CHECK(!record.read(reader, FASTQ_ENCODING_33));
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Reading from tokenized text
+
+TEST_CASE("tokenizer_records", "[fastq::fastq_tokenizer]")
+{
+  const std::string text = "\n@record_1\nACGAGTCA\n+\n!7BF8DGI\n\r\n\n"
+                           "@record_2 meta\r\nGTCAGGAT\r\n+xyz\r\nD7BIG!F8";
+  fastq_tokenizer tokenizer(text);
+
+  fastq record;
+  CHECK(record.read_unsafe(tokenizer));
+  REQUIRE(record.header() == "record_1");
+  REQUIRE(record.sequence() == "ACGAGTCA");
+  REQUIRE(record.qualities() == "!7BF8DGI");
+  REQUIRE(tokenizer.lines() == 5);
+  CHECK(record.read_unsafe(tokenizer));
+  REQUIRE(record.header() == "record_2 meta");
+  REQUIRE(record.sequence() == "GTCAGGAT");
+  REQUIRE(record.qualities() == "D7BIG!F8");
+  REQUIRE(tokenizer.lines() == 11);
+  CHECK(!record.read_unsafe(tokenizer));
+}
+
+TEST_CASE("tokenizer_empty_text", "[fastq::fastq_tokenizer]")
+{
+  const std::string text = "\n\r\n";
+  fastq_tokenizer tokenizer(text);
+
+  fastq record;
+  CHECK(!record.read_unsafe(tokenizer));
+}
+
+TEST_CASE("tokenizer_errors_follow_valid_records", "[fastq::fastq_tokenizer]")
+{
+  const std::string text = "@record_1\nACGT\n+\n!!!!\n"
+                           "@record_2\nACGT\n+\n!!!\n";
+  fastq_tokenizer tokenizer(text);
+
+  fastq record;
+  CHECK(record.read_unsafe(tokenizer));
+  REQUIRE(record.header() == "record_1");
+  REQUIRE_THROWS_AS(record.read_unsafe(tokenizer), fastq_error);
+  REQUIRE(tokenizer.lines() == 8);
+}
+
+TEST_CASE("tokenizer_malformed_records", "[fastq::fastq_tokenizer]")
+{
+  const string_vec texts = {
+    "record\nACGT\n+\n!!!!\n", "@\nACGT\n+\n!!!!\n",
+    "@record\n\n+\n!!!!\n",     "@record\nACGT\n\n!!!!\n",
+    "@record\nACGT\n-\n!!!!\n", "@record\nACGT\n+\n\n",
+    "@record",                    "@record\nACGT",
+    "@record\nACGT\n+\n",        "@record\nACGT\n+\n!!!!!\n",
+  };
+
+  for (const auto& text : texts) {
+    fastq_tokenizer tokenizer(text);
+
+    fastq record;
+    REQUIRE_THROWS_AS(record.read_unsafe(tokenizer), fastq_error);
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Writing to stream
 
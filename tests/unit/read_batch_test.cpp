@@ -0,0 +1,439 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2021 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <string>
+#include <vector>
+
+#include "alignment.hpp"
+#include "fastq.hpp"
+#include "fastq_enc.hpp"
+#include "read_batch.hpp"
+#include "testing.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+namespace {
+
+/** Returns reads of varying lengths and qualities, including Ns. */
+std::vector<fastq>
+mixed_reads()
+{
+  const size_t lengths[] = { 1, 2, 5, 17, 33, 64, 100 };
+  const std::string nucleotides = "NACGTNAACGTTGCANN";
+
+  std::vector<fastq> reads;
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+    std::string sequence;
+    std::string qualities;
+    for (size_t j = 0; j < lengths[i]; ++j) {
+      sequence.push_back(nucleotides.at((i + j) % nucleotides.size()));
+      qualities.push_back(static_cast<char>('!' + (i * 7 + j * 13) % 42));
+    }
+
+    const std::string header = "read_" + std::to_string(i) + " meta";
+    reads.emplace_back(header, sequence, qualities);
+  }
+
+  return reads;
+}
+
+/** Returns a batch containing copies of the reads. */
+read_batch
+to_batch(const std::vector<fastq>& reads)
+{
+  read_batch batch;
+  for (const auto& read : reads) {
+    batch.add(read);
+  }
+
+  return batch;
+}
+
+/** Requires that the records of a batch match the reads. */
+void
+require_equal(const read_batch& batch, const std::vector<fastq>& reads)
+{
+  REQUIRE(batch.size() == reads.size());
+  for (size_t i = 0; i < reads.size(); ++i) {
+    INFO("record " << i);
+    REQUIRE(batch.get(i) == reads.at(i));
+  }
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Records
+
+TEST_CASE("empty batch", "[read_batch::read_batch]")
+{
+  read_batch batch;
+
+  REQUIRE(batch.empty());
+  REQUIRE(batch.size() == 0);
+}
+
+TEST_CASE("records are stored in the arenas", "[read_batch::add]")
+{
+  const auto reads = mixed_reads();
+  const read_batch batch = to_batch(reads);
+
+  REQUIRE(!batch.empty());
+  for (size_t i = 0; i < reads.size(); ++i) {
+    const fastq& read = reads.at(i);
+
+    REQUIRE(std::string(batch.header(i), batch.header_length(i)) ==
+            read.header());
+    REQUIRE(std::string(batch.sequence(i), batch.length(i)) ==
+            read.sequence());
+    REQUIRE(std::string(batch.qualities(i), batch.length(i)) ==
+            read.qualities());
+  }
+}
+
+TEST_CASE("records copied between batches", "[read_batch::add]")
+{
+  const auto reads = mixed_reads();
+  read_batch source = to_batch(reads);
+  source.truncate(2, 1, 2);
+
+  read_batch batch;
+  batch.add(source, 2);
+  batch.add(source, 0);
+
+  REQUIRE(batch.size() == 2);
+  REQUIRE(batch.get(0) == fastq("read_2 meta",
+                                reads.at(2).sequence().substr(1, 2),
+                                reads.at(2).qualities().substr(1, 2)));
+  REQUIRE(batch.get(1) == reads.at(0));
+}
+
+TEST_CASE("clear removes all records", "[read_batch::clear]")
+{
+  read_batch batch = to_batch(mixed_reads());
+  const size_t usage = batch.memory_usage();
+
+  batch.clear();
+  REQUIRE(batch.empty());
+  // The arenas are kept for re-use
+  REQUIRE(batch.memory_usage() == usage);
+
+  const fastq read("foo", "ACGT", "!!!!");
+  batch.add(read);
+  require_equal(batch, { read });
+}
+
+TEST_CASE("pop_back removes the last record", "[read_batch::pop_back]")
+{
+  auto reads = mixed_reads();
+  read_batch batch = to_batch(reads);
+
+  batch.pop_back();
+  reads.pop_back();
+  require_equal(batch, reads);
+
+  const fastq read("foo", "ACGT", "!!!!");
+  batch.add(read);
+  reads.push_back(read);
+  require_equal(batch, reads);
+}
+
+TEST_CASE("into_string matches fastq", "[read_batch::into_string]")
+{
+  const auto reads = mixed_reads();
+  const read_batch batch = to_batch(reads);
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    std::string expected = "...";
+    std::string result = "...";
+    reads.at(i).into_string(expected);
+    batch.into_string(i, result);
+
+    REQUIRE(result == expected);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Trimming and processing
+
+TEST_CASE("count_ns matches fastq", "[read_batch::count_ns]")
+{
+  const auto reads = mixed_reads();
+  const read_batch batch = to_batch(reads);
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    REQUIRE(batch.count_ns(i) == reads.at(i).count_ns());
+  }
+}
+
+TEST_CASE("truncate matches fastq", "[read_batch::truncate]")
+{
+  auto reads = mixed_reads();
+  read_batch batch = to_batch(reads);
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    const size_t pos = i % 3;
+    const size_t len = (i % 2) ? 7 : std::string::npos;
+
+    reads.at(i).truncate(pos, len);
+    batch.truncate(i, pos, len);
+  }
+
+  require_equal(batch, reads);
+}
+
+TEST_CASE("trim_trailing_bases matches fastq",
+          "[read_batch::trim_trailing_bases]")
+{
+  for (const bool trim_ns : { false, true }) {
+    for (const bool preserve5p : { false, true }) {
+      auto reads = mixed_reads();
+      read_batch batch = to_batch(reads);
+
+      for (size_t i = 0; i < reads.size(); ++i) {
+        const auto expected =
+          reads.at(i).trim_trailing_bases(trim_ns, 20, preserve5p);
+        const auto result =
+          batch.trim_trailing_bases(i, trim_ns, 20, preserve5p);
+
+        REQUIRE(result == expected);
+      }
+
+      require_equal(batch, reads);
+    }
+  }
+}
+
+TEST_CASE("trim_windowed_bases matches fastq",
+          "[read_batch::trim_windowed_bases]")
+{
+  for (const double window_size : { 0.1, 1.0, 3.0 }) {
+    for (const bool preserve5p : { false, true }) {
+      auto reads = mixed_reads();
+      read_batch batch = to_batch(reads);
+
+      for (size_t i = 0; i < reads.size(); ++i) {
+        const auto expected = reads.at(i).trim_windowed_bases(
+          true, 20, window_size, preserve5p);
+        const auto result =
+          batch.trim_windowed_bases(i, true, 20, window_size, preserve5p);
+
+        REQUIRE(result == expected);
+      }
+
+      require_equal(batch, reads);
+    }
+  }
+}
+
+TEST_CASE("reverse_complement matches fastq",
+          "[read_batch::reverse_complement]")
+{
+  auto reads = mixed_reads();
+  read_batch batch = to_batch(reads);
+
+  for (size_t i = 0; i < reads.size(); ++i) {
+    batch.truncate(i, 1);
+    reads.at(i).truncate(1);
+
+    batch.reverse_complement(i);
+    reads.at(i).reverse_complement();
+  }
+
+  require_equal(batch, reads);
+}
+
+TEST_CASE("post_process cleans and decodes records",
+          "[read_batch::post_process]")
+{
+  read_batch batch;
+  batch.add("foo", 3, "acgtN", "@ABCh", 5);
+  batch.post_process(0, FASTQ_ENCODING_64);
+
+  REQUIRE(batch.get(0) == fastq("foo", "ACGTN", "!\"#$I"));
+}
+
+TEST_CASE("post_process rejects invalid records",
+          "[read_batch::post_process]")
+{
+  read_batch batch;
+  batch.add("foo", 3, "ACGTX", "!!!!!", 5);
+  REQUIRE_THROWS_AS(batch.post_process(0, FASTQ_ENCODING_33), fastq_error);
+
+  batch.add("bar", 3, "ACGTA", "!!! !", 5);
+  REQUIRE_THROWS_AS(batch.post_process(1, FASTQ_ENCODING_33), fastq_error);
+}
+
+TEST_CASE("extend moves records to the end of the arenas",
+          "[read_batch::extend]")
+{
+  auto reads = mixed_reads();
+  read_batch batch = to_batch(reads);
+  batch.truncate(1, 1);
+
+  batch.extend(1, "ACGT", "IIII", 4);
+  batch.extend(1, "TT", "##", 2);
+
+  reads.at(1) = fastq("read_1 meta",
+                      reads.at(1).sequence().substr(1) + "ACGTTT",
+                      reads.at(1).qualities().substr(1) + "IIII##");
+  require_equal(batch, reads);
+}
+
+TEST_CASE("erase_header removes part of a header",
+          "[read_batch::erase_header]")
+{
+  read_batch batch;
+  batch.add("foo/1 meta", 10, "ACGT", "!!!!", 4);
+  batch.add("bar", 3, "A", "!", 1);
+  batch.erase_header(0, 3, 2);
+
+  require_equal(batch, { fastq("foo meta", "ACGT"), fastq("bar", "A") });
+}
+
+TEST_CASE("validate_paired_reads fixes mate separators",
+          "[read_batch::validate_paired_reads]")
+{
+  read_batch mate1;
+  read_batch mate2;
+  mate1.add("foo:1 meta", 10, "ACGT", "!!!!", 4);
+  mate2.add("foo:2", 5, "TGCA", "!!!!", 4);
+
+  read_batch::validate_paired_reads(mate1, mate2, 0, ':');
+
+  require_equal(mate1, { fastq("foo/1 meta", "ACGT") });
+  require_equal(mate2, { fastq("foo/2", "TGCA") });
+}
+
+TEST_CASE("validate_paired_reads rejects bad pairs",
+          "[read_batch::validate_paired_reads]")
+{
+  read_batch mate1;
+  read_batch mate2;
+  mate1.add("foo/1", 5, "ACGT", "!!!!", 4);
+  mate2.add("bar/2", 5, "TGCA", "!!!!", 4);
+  mate1.add("foo/2", 5, "ACGT", "!!!!", 4);
+  mate2.add("foo/1", 5, "TGCA", "!!!!", 4);
+
+  REQUIRE_THROWS_AS(read_batch::validate_paired_reads(mate1, mate2, 0),
+                    fastq_error);
+  REQUIRE_THROWS_AS(read_batch::validate_paired_reads(mate1, mate2, 1),
+                    fastq_error);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tokenizing
+
+TEST_CASE("tokenizer appends records to batches", "[fastq::fastq_tokenizer]")
+{
+  const std::string text = "@foo\nACGT\n+\n!!!!\n\n@bar baz\nTT\n+\n##\n";
+
+  read_batch batch;
+  batch.add("first", 5, "A", "!", 1);
+
+  fastq_tokenizer tokenizer(text);
+  REQUIRE(tokenizer.next(batch));
+  REQUIRE(tokenizer.next(batch));
+  REQUIRE(!tokenizer.next(batch));
+
+  require_equal(batch,
+                { fastq("first", "A", "!"),
+                  fastq("foo", "ACGT", "!!!!"),
+                  fastq("bar baz", "TT", "##") });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Alignment and merging
+
+TEST_CASE("batch alignment, truncation, and merging matches fastq",
+          "[read_batch::*]")
+{
+  const fastq_pair_vec adapters = { fastq_pair(
+    fastq("adapter_1", "AGATCGGA"), fastq("adapter_2", "CTCCGATC")) };
+  const sequence_aligner aligner(adapters);
+
+  fastq read1("foo/1", "TTAGCACCGTAGATCGGA", "IIIIIIIIIIIIIIIIII");
+  fastq read2("foo/2", "TCCGATCTACGGTGCTAA", "ABCDEFGHIJABCDEFGH");
+  read_batch reads_1;
+  read_batch reads_2;
+  reads_1.add(fastq("other/1", "ACGT"));
+  reads_2.add(fastq("other/2", "ACGT"));
+  reads_1.add(read1);
+  reads_2.add(read2);
+
+  read2.reverse_complement();
+  reads_2.reverse_complement(1);
+
+  const alignment_info expected = aligner.align_paired_end(read1, read2, 0);
+  const alignment_info result =
+    aligner.align_paired_end(reads_1, reads_2, 1, 0);
+  REQUIRE(result.offset == expected.offset);
+  REQUIRE(result.score == expected.score);
+  REQUIRE(result.length == expected.length);
+  REQUIRE(result.adapter_id == expected.adapter_id);
+
+  REQUIRE(expected.truncate_paired_end(read1, read2) ==
+          result.truncate_paired_end(reads_1, reads_2, 1));
+  require_equal(reads_1, { fastq("other/1", "ACGT"), read1 });
+  require_equal(reads_2, { fastq("other/2", "ACGT"), read2 });
+
+  sequence_merger merger;
+  merger.merge(expected, read1, read2);
+  merger.merge(result, reads_1, reads_2, 1);
+  require_equal(reads_1, { fastq("other/1", "ACGT"), read1 });
+}
+
+TEST_CASE("batch single-end alignment matches fastq", "[read_batch::*]")
+{
+  const fastq_pair_vec adapters = { fastq_pair(
+    fastq("adapter_1", "AGATCGGA"), fastq("adapter_2", "CTCCGATC")) };
+  const sequence_aligner aligner(adapters);
+
+  fastq read("foo", "TTAGCACCGTAGATCGGAAG");
+  read_batch reads;
+  reads.add(read);
+
+  const alignment_info expected = aligner.align_single_end(read, 0);
+  const alignment_info result = aligner.align_single_end(reads, 0, 0);
+  REQUIRE(result.offset == expected.offset);
+  REQUIRE(result.score == expected.score);
+
+  expected.truncate_single_end(read);
+  result.truncate_single_end(reads, 0);
+  require_equal(reads, { read });
+}
+
+TEST_CASE("batch adapter extraction matches fastq",
+          "[read_batch::extract_adapter_sequences]")
+{
+  fastq read1("foo/1", "TTAGCACCGTAGATCGGA");
+  fastq read2("foo/2", "CTCCGATCTACGGTGCTAA");
+  read_batch reads_1;
+  read_batch reads_2;
+  reads_1.add(read1);
+  reads_2.add(read2);
+
+  alignment_info alignment;
+  alignment.offset = -1;
+
+  REQUIRE(extract_adapter_sequences(alignment, read1, read2) ==
+          extract_adapter_sequences(alignment, reads_1, reads_2, 0));
+  require_equal(reads_1, { read1 });
+  require_equal(reads_2, { read2 });
+}
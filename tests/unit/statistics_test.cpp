@@ -0,0 +1,209 @@
+/*************************************************************************\
+ * AdapterRemoval - cleaning next-generation sequencing reads            *
+ *                                                                       *
+ * Copyright (C) 2021 by Mikkel Schubert - mikkelsch@gmail.com           *
+ *                                                                       *
+ * This program is free software: you can redistribute it and/or modify  *
+ * it under the terms of the GNU General Public License as published by  *
+ * the Free Software Foundation, either version 3 of the License, or     *
+ * (at your option) any later version.                                   *
+ *                                                                       *
+ * This program is distributed in the hope that it will be useful,       *
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ * GNU General Public License for more details.                          *
+ *                                                                       *
+ * You should have received a copy of the GNU General Public License     *
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+\*************************************************************************/
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "counts.hpp"
+#include "fastq.hpp"
+#include "statistics.hpp"
+#include "testing.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Helper functions
+
+namespace {
+
+/** Returns reads of varying lengths, including Ns and empty reads. */
+std::vector<fastq>
+mixed_length_reads()
+{
+  const size_t lengths[] = { 0, 1, 2, 3, 4, 7, 100, 511, 512, 513, 600 };
+  const std::string nucleotides = "ACGTNAACGTTGCANN";
+
+  std::vector<fastq> reads;
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+    std::string sequence;
+    std::string qualities;
+    for (size_t j = 0; j < lengths[i]; ++j) {
+      sequence.push_back(nucleotides.at((i + j) % nucleotides.size()));
+      qualities.push_back(static_cast<char>('!' + (i * 7 + j * 3) % 42));
+    }
+
+    reads.emplace_back("read_" + std::to_string(i), sequence, qualities);
+  }
+
+  return reads;
+}
+
+/** Processes reads in two chunks, flushing counts after each chunk. */
+void
+process_reads(fastq_statistics& stats, const std::vector<fastq>& reads)
+{
+  const size_t half = reads.size() / 2;
+  for (size_t i = 0; i < reads.size(); ++i) {
+    stats.process(reads.at(i));
+
+    if (i + 1 == half || i + 1 == reads.size()) {
+      stats.flush();
+    }
+  }
+}
+
+void
+require_equal_counts(const counts& a, const counts& b)
+{
+  const size_t size = std::max(a.size(), b.size());
+  for (size_t i = 0; i < size; ++i) {
+    INFO("position " << i);
+    REQUIRE(a.get(i) == b.get(i));
+  }
+}
+
+void
+require_equal_statistics(const fastq_statistics& a, const fastq_statistics& b)
+{
+  REQUIRE(a.number_of_input_reads() == b.number_of_input_reads());
+  REQUIRE(a.number_of_output_reads() == b.number_of_output_reads());
+  REQUIRE(a.number_of_sampled_reads() == b.number_of_sampled_reads());
+
+  require_equal_counts(a.length_dist(), b.length_dist());
+  require_equal_counts(a.quality_dist(), b.quality_dist());
+  require_equal_counts(a.gc_content(), b.gc_content());
+  require_equal_counts(a.uncalled_pos(), b.uncalled_pos());
+  require_equal_counts(a.uncalled_quality_pos(), b.uncalled_quality_pos());
+
+  for (const char nuc : std::string("ACGT")) {
+    INFO("nucleotide " << nuc);
+    require_equal_counts(a.nucleotides_pos(nuc), b.nucleotides_pos(nuc));
+    require_equal_counts(a.qualities_pos(nuc), b.qualities_pos(nuc));
+  }
+}
+
+} // namespace
+
+///////////////////////////////////////////////////////////////////////////////
+// Per-chunk tables
+
+TEST_CASE("statistics independent of per-chunk table size",
+          "[fastq_statistics::process]")
+{
+  const auto reads = mixed_length_reads();
+
+  fastq_statistics small(1.0, 3);
+  fastq_statistics large(1.0, 512);
+  process_reads(small, reads);
+  process_reads(large, reads);
+
+  REQUIRE(large.number_of_sampled_reads() == reads.size());
+  REQUIRE(large.uncalled_pos().sum() > 0);
+  require_equal_statistics(small, large);
+}
+
+TEST_CASE("read filling the default per-chunk table",
+          "[fastq_statistics::process]")
+{
+  const std::string nucleotides = "ACGTNNTGCA";
+
+  std::string sequence;
+  std::string qualities;
+  for (size_t i = 0; i < FASTQ_STATISTICS_MAX_LENGTH; ++i) {
+    sequence.push_back(nucleotides.at(i % nucleotides.size()));
+    qualities.push_back(static_cast<char>('!' + i % 42));
+  }
+
+  const fastq read("read", sequence, qualities);
+
+  // A single row tabulated per chunk; all other positions overflow
+  fastq_statistics small(1.0, 1);
+  fastq_statistics large(1.0, FASTQ_STATISTICS_MAX_LENGTH);
+  process_reads(small, { read });
+  process_reads(large, { read });
+
+  require_equal_statistics(small, large);
+
+  REQUIRE(small.length_dist().get(FASTQ_STATISTICS_MAX_LENGTH) == 1);
+  REQUIRE(small.quality_dist().sum() == FASTQ_STATISTICS_MAX_LENGTH);
+  for (size_t i = 0; i < FASTQ_STATISTICS_MAX_LENGTH; ++i) {
+    INFO("position " << i);
+    const char nuc = sequence.at(i);
+    const size_t quality = qualities.at(i) - '!';
+
+    if (nuc == 'N') {
+      REQUIRE(small.uncalled_pos().get(i) == 1);
+      // Qualities of Ns are summed as Phred+33 encoded scores
+      REQUIRE(small.uncalled_quality_pos().get(i) == quality + '!');
+    } else {
+      REQUIRE(small.uncalled_pos().get(i) == 0);
+      REQUIRE(small.nucleotides_pos(nuc).get(i) == 1);
+      REQUIRE(small.qualities_pos(nuc).get(i) == quality);
+    }
+  }
+}
+
+TEST_CASE("merged statistics independent of per-chunk table size",
+          "[fastq_statistics::operator+=]")
+{
+  const auto reads = mixed_length_reads();
+
+  fastq_statistics small_1(1.0, 3);
+  fastq_statistics small_2(1.0, 3);
+  fastq_statistics large(1.0, 512);
+  process_reads(small_1, reads);
+  process_reads(small_2, reads);
+  process_reads(large, reads);
+  process_reads(large, reads);
+
+  small_1 += small_2;
+  require_equal_statistics(small_1, large);
+}
+
+TEST_CASE("pending counts are merged when statistics are read",
+          "[fastq_statistics::flush]")
+{
+  const auto reads = mixed_length_reads();
+
+  fastq_statistics flushed(1.0, 3);
+  fastq_statistics pending(1.0, 3);
+  process_reads(flushed, reads);
+  for (const auto& read : reads) {
+    pending.process(read);
+  }
+
+  require_equal_statistics(pending, flushed);
+}
+
+TEST_CASE("pending counts are merged when statistics are summed",
+          "[fastq_statistics::operator+=]")
+{
+  const auto reads = mixed_length_reads();
+
+  fastq_statistics flushed(1.0, 3);
+  fastq_statistics pending_1(1.0, 3);
+  fastq_statistics pending_2(1.0, 3);
+  process_reads(flushed, reads);
+  process_reads(flushed, reads);
+  for (const auto& read : reads) {
+    pending_1.process(read);
+    pending_2.process(read);
+  }
+
+  pending_1 += pending_2;
+  require_equal_statistics(pending_1, flushed);
+}
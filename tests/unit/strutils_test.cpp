@@ -24,6 +24,7 @@
 \*************************************************************************/
 #include <limits>
 #include <stdexcept>
+#include <vector>
 
 #include "strutils.hpp"
 #include "testing.hpp"
@@ -37,6 +38,48 @@ TEST_CASE("ASCII letters are uppercased", "[strutils::toupper]")
   REQUIRE(toupper("a1{2BZ`zAdeK") == "A1{2BZ`ZADEK");
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Tests for 'find_newlines'
+
+std::vector<size_t>
+find_newlines(const std::string& text)
+{
+  std::vector<size_t> newlines;
+  find_newlines(text.data(), text.size(), newlines);
+
+  return newlines;
+}
+
+TEST_CASE("Newlines in short text", "[strutils::find_newlines]")
+{
+  REQUIRE(find_newlines("") == std::vector<size_t>());
+  REQUIRE(find_newlines("abc") == std::vector<size_t>());
+  REQUIRE(find_newlines("\n") == std::vector<size_t>({ 0 }));
+  REQUIRE(find_newlines("a\nb\r\n\n") == std::vector<size_t>({ 1, 4, 5 }));
+}
+
+TEST_CASE("Newlines in long text", "[strutils::find_newlines]")
+{
+  // Newlines at both ends of and spanning multiple SIMD windows
+  std::string text(200, 'A');
+  std::vector<size_t> expected;
+  for (size_t i : { 0, 15, 16, 31, 32, 63, 64, 65, 127, 128, 150, 199 }) {
+    text.at(i) = '\n';
+    expected.push_back(i);
+  }
+
+  REQUIRE(find_newlines(text) == expected);
+}
+
+TEST_CASE("Newlines are appended", "[strutils::find_newlines]")
+{
+  const std::string text = "ab\nc";
+  std::vector<size_t> newlines = { 7 };
+  find_newlines(text.data(), text.size(), newlines);
+
+  REQUIRE(newlines == std::vector<size_t>({ 7, 2 }));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Tests for 'indent_lines'
 